@@ -0,0 +1,870 @@
+/* Headless benchmark driver, built with `make bench`.
+ *
+ * Runs fixed seed workloads without opening a window and prints
+ * the results as JSON. Every workload records one latency sample
+ * per operation (or per batch of operations for the ones that are
+ * too quick to time individually) and reports throughput and
+ * latency percentiles, followed by the process's peak RSS.
+ *
+ * Usage: bench [--seed N] [--chunks N] [--steps N] [--entities N] [--mobs N]
+ *              [--lookups N] [--rays N] [--edits N] [--edit-chunks N]
+ *              [--threads N] [--mesher naive|greedy]
+ *              [--kernel scalar|sse41|avx2] [--out FILE] [--trace FILE]
+ *              [--replay FILE]
+ *
+ * --replay plays a recording made with `tinycraft --record FILE`
+ * back as fast as possible instead of running the other workloads,
+ * and reports the first tick that no longer matches the recording.
+ * --trace writes every zone recorded during the run as a Chrome
+ * trace, it needs a `make TRACE=1` build.
+ */
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <raylib.h>
+#include <raymath.h>
+
+#include "chunk.h"
+#include "entities.h"
+#include "entity.h"
+#include "global.h"
+#include "perlin.h"
+#include "player.h"
+#include "region.h"
+#include "replay.h"
+#include "trace.h"
+#include "worker.h"
+#include "world.h"
+
+typedef struct {
+	unsigned int seed;
+	int chunks;            // the world is chunks x chunks
+	unsigned int steps;    // physics steps
+	unsigned int entities; // entities simulated each step
+	unsigned int mobs;     // entity manager entities simulated each step
+	unsigned int lookups;  // chunk_dict_lookup calls
+	unsigned int rays;     // world_raycast calls
+	unsigned int edits;    // world_set_block calls
+	unsigned int edit_chunks; // chunks the edits are spread over
+	unsigned int threads;  // worker threads, 0 = one per core
+	chunk_mesher mesher;
+	int kernel;            // perlin_kernel, -1 = whatever the CPU supports
+	const char* out;
+	const char* trace;     // Chrome trace of the whole run
+	const char* replay;    // only play this recording back
+} bench_options;
+
+typedef struct {
+	const char* name;
+	const char* unit;   // what one op is
+	size_t ops;
+	double seconds;     // wall time of the whole workload
+	double* samples;    // latency in seconds
+	size_t sample_count;
+	size_t ops_per_sample;
+	size_t sample_capacity;
+} bench_result;
+
+#define BENCH_MAX_RESULTS 16
+
+static bench_result RESULTS[BENCH_MAX_RESULTS];
+static size_t RESULT_COUNT = 0;
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// xorshift, so workloads are the same on every libc
+static unsigned int bench_random(unsigned int* state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static float bench_random_float(unsigned int* state, float min, float max) {
+	return min + (bench_random(state) / (float)0xffffffffu) * (max - min);
+}
+
+static bench_result* bench_begin(const char* name, const char* unit, size_t expected_samples, size_t ops_per_sample) {
+	if (RESULT_COUNT == BENCH_MAX_RESULTS) {
+		fputs("ERROR: Too many benchmark results\n", stderr);
+		exit(1);
+	}
+
+	bench_result* r = &RESULTS[RESULT_COUNT++];
+	*r = (bench_result){
+		.name = name,
+		.unit = unit,
+		.samples = malloc(sizeof(double) * (expected_samples ? expected_samples : 1)),
+		.sample_capacity = expected_samples ? expected_samples : 1,
+		.ops_per_sample = ops_per_sample,
+	};
+
+	if (r->samples == NULL) {
+		fputs("ERROR: Failed to allocate memory for benchmark samples\n", stderr);
+		exit(1);
+	}
+
+	fprintf(stderr, "running %s...\n", name);
+
+	return r;
+}
+
+static void bench_sample(bench_result* r, double seconds) {
+	if (r->sample_count == r->sample_capacity) {
+		r->sample_capacity *= 2;
+		r->samples = realloc(r->samples, sizeof(double) * r->sample_capacity);
+
+		if (r->samples == NULL) {
+			fputs("ERROR: Failed to allocate memory for benchmark samples\n", stderr);
+			exit(1);
+		}
+	}
+
+	r->samples[r->sample_count++] = seconds;
+	r->ops += r->ops_per_sample;
+}
+
+static int bench_compare_double(const void* a, const void* b) {
+	const double da = *(const double*)a;
+	const double db = *(const double*)b;
+
+	return (da > db) - (da < db);
+}
+
+// nearest rank percentile of sorted samples
+static double bench_percentile(const double* sorted, size_t count, double p) {
+	if (count == 0)
+		return 0;
+
+	size_t rank = (size_t)(p / 100.0 * count + 0.5);
+	rank = rank < 1 ? 1 : rank;
+	rank = rank > count ? count : rank;
+
+	return sorted[rank - 1];
+}
+
+// GENERATION AND MESHING
+
+static void bench_generation(const bench_options* opts, chunk_generation_options* gen) {
+	const size_t count = (size_t)opts->chunks * opts->chunks;
+	chunk** chunks = malloc(sizeof(chunk*) * count);
+
+	if (chunks == NULL) {
+		fputs("ERROR: Failed to allocate memory for benchmark chunks\n", stderr);
+		exit(1);
+	}
+
+	bench_result* r = bench_begin("generate_blocks", "chunk", count, 1);
+	double start = bench_now();
+
+	for (size_t i = 0; i < count; i++) {
+		world_chunk_pos pos = { i % opts->chunks - opts->chunks / 2, i / opts->chunks - opts->chunks / 2 };
+
+		double t = bench_now();
+		chunks[i] = chunk_create(pos);
+
+		if (chunks[i] == NULL || !chunk_generate_blocks(gen, chunks[i])) {
+			fputs("ERROR: Failed to generate benchmark chunks\n", stderr);
+			exit(1);
+		}
+		bench_sample(r, bench_now() - t);
+	}
+
+	r->seconds = bench_now() - start;
+
+	r = bench_begin(opts->mesher == CHUNK_MESHER_GREEDY ? "build_mesh_greedy" : "build_mesh_naive", "chunk", count, 1);
+	start = bench_now();
+
+	for (size_t i = 0; i < count; i++) {
+		double t = bench_now();
+		chunk_build_mesh(gen, chunks[i], NULL);
+		bench_sample(r, bench_now() - t);
+	}
+
+	r->seconds = bench_now() - start;
+
+	// the same chunks meshed at each coarser level of detail
+	static const char* lod_names[CHUNK_LOD_COUNT] = {
+		NULL, "build_mesh_lod1", "build_mesh_lod2", "build_mesh_lod3",
+	};
+
+	for (unsigned int lod = 1; lod < CHUNK_LOD_COUNT; lod++) {
+		r = bench_begin(lod_names[lod], "chunk", count, 1);
+		start = bench_now();
+
+		for (size_t i = 0; i < count; i++) {
+			chunks[i]->lod = lod;
+
+			double t = bench_now();
+			chunk_build_mesh(gen, chunks[i], NULL);
+			bench_sample(r, bench_now() - t);
+		}
+
+		r->seconds = bench_now() - start;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		chunk_free(chunks[i]);
+	free(chunks);
+}
+
+// loads every chunk through the worker pool the way the game does
+static void bench_pipeline(const bench_options* opts) {
+	const size_t count = (size_t)opts->chunks * opts->chunks;
+	bench_result* r = bench_begin("world_load_chunks", "chunk", 1, count);
+
+	double start = bench_now();
+
+	// world_load_chunks_around covers a (2 * radius - 1) square
+	world_load_chunks_around((world_chunk_pos){0}, (opts->chunks + 1) / 2);
+	worker_pool_wait_idle();
+
+	r->seconds = bench_now() - start;
+	bench_sample(r, r->seconds);
+	r->ops = WORLD.chunk_dict.count;
+}
+
+static void bench_dict_lookup(const bench_options* opts) {
+	const size_t batch = 1000;
+	const size_t batches = (opts->lookups + batch - 1) / batch;
+	bench_result* r = bench_begin("chunk_dict_lookup", "lookup", batches, batch);
+
+	unsigned int rng = opts->seed | 1;
+	size_t found = 0;
+
+	// half the lookups miss, a quarter of the positions are outside the world
+	const int range = opts->chunks;
+	double start = bench_now();
+
+	for (size_t b = 0; b < batches; b++) {
+		world_chunk_pos positions[1000];
+
+		for (size_t i = 0; i < batch; i++) {
+			positions[i].x = (int)(bench_random(&rng) % range) - range / 2;
+			positions[i].z = (int)(bench_random(&rng) % (range * 2)) - range;
+		}
+
+		double t = bench_now();
+		for (size_t i = 0; i < batch; i++)
+			found += chunk_dict_lookup(&WORLD.chunk_dict, positions[i]) != NULL;
+		bench_sample(r, (bench_now() - t) / batch);
+	}
+
+	r->seconds = bench_now() - start;
+
+	// keep the lookups from being optimised away
+	if (found == (size_t)-1)
+		puts("");
+}
+
+// rays from above the terrain in every direction, about as long as a view distance
+static void bench_raycast(const bench_options* opts) {
+	const size_t batch = 1000;
+	const size_t batches = (opts->rays + batch - 1) / batch;
+	const float length = 32;
+	bench_result* r = bench_begin("world_raycast", "ray", batches, batch);
+
+	const float extent = ((opts->chunks + 1) / 2 - 1) * WORLD_CHUNK_WIDTH;
+	unsigned int rng = opts->seed | 1;
+	size_t hits = 0;
+
+	double start = bench_now();
+
+	for (size_t b = 0; b < batches; b++) {
+		Vector3 origins[1000];
+		Vector3 directions[1000];
+
+		for (size_t i = 0; i < batch; i++) {
+			origins[i] = (Vector3){
+				bench_random_float(&rng, -extent, extent),
+				bench_random_float(&rng, 8, 24),
+				bench_random_float(&rng, -extent, extent),
+			};
+			directions[i] = Vector3Normalize((Vector3){
+				bench_random_float(&rng, -1, 1),
+				bench_random_float(&rng, -1, 1),
+				bench_random_float(&rng, -1, 1),
+			});
+		}
+
+		double t = bench_now();
+		for (size_t i = 0; i < batch; i++)
+			hits += world_raycast(origins[i], directions[i], length).hit;
+		bench_sample(r, (bench_now() - t) / batch);
+	}
+
+	r->seconds = bench_now() - start;
+
+	fprintf(stderr, "%zu of %zu rays hit\n", hits, r->ops);
+}
+
+static void bench_region(const bench_options* opts) {
+	(void)opts;
+
+	const size_t count = WORLD.chunk_dict.count;
+	world_chunk_pos* positions = malloc(sizeof(world_chunk_pos) * count);
+
+	if (positions == NULL) {
+		fputs("ERROR: Failed to allocate memory for benchmark chunks\n", stderr);
+		exit(1);
+	}
+
+	bench_result* r = bench_begin("region_save_chunk", "chunk", count, 1);
+	double start = bench_now();
+
+	size_t it = 0, n = 0;
+	chunk_dict_entry* entry;
+
+	while ((entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL) {
+		positions[n++] = entry->key;
+
+		double t = bench_now();
+		region_save_chunk(entry->value);
+		bench_sample(r, bench_now() - t);
+	}
+
+	r->seconds = bench_now() - start;
+
+	r = bench_begin("region_load_chunk", "chunk", count, 1);
+	start = bench_now();
+
+	for (size_t i = 0; i < n; i++) {
+		chunk* c = chunk_create(positions[i]);
+
+		double t = bench_now();
+		if (!region_load_chunk(c))
+			fprintf(stderr, "WARNING: Chunk (%d, %d) was not saved\n", positions[i].x, positions[i].z);
+		bench_sample(r, bench_now() - t);
+
+		chunk_free(c);
+	}
+
+	r->seconds = bench_now() - start;
+
+	free(positions);
+}
+
+// EDITING
+
+/* Edits spread over a few chunks, remeshed once a frame the way
+ * the game does. A chunk is remeshed once per frame however many
+ * of its blocks changed, so the remesh count should follow the
+ * frames and chunks rather than the edits.
+ */
+static void bench_edit(const bench_options* opts) {
+	const size_t batch = 64; // edits per frame
+	const size_t frames = (opts->edits + batch - 1) / batch;
+
+	// the bench has no GL context, so this only marks them uploaded
+	world_upload_chunks((unsigned int)-1);
+
+	world_chunk_pos* positions = malloc(sizeof(world_chunk_pos) * (opts->edit_chunks ? opts->edit_chunks : 1));
+
+	if (positions == NULL) {
+		fputs("ERROR: Failed to allocate memory for benchmark chunks\n", stderr);
+		exit(1);
+	}
+
+	size_t it = 0, count = 0;
+	chunk_dict_entry* entry;
+
+	while (count < opts->edit_chunks && (entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL)
+		positions[count++] = entry->key;
+
+	if (count == 0) {
+		free(positions);
+		return;
+	}
+
+	bench_result* edits = bench_begin("world_set_block", "edit", frames, batch);
+	bench_result* remeshes = bench_begin("world_remesh_dirty_chunks", "chunk", frames, 0);
+
+	unsigned int rng = opts->seed | 1;
+	size_t failed = 0;
+
+	// each result only counts its own half of the frame
+	for (size_t f = 0; f < frames; f++) {
+		double t = bench_now();
+
+		// around the surface, half of them digging and half building
+		for (size_t i = 0; i < batch; i++) {
+			const unsigned int r = bench_random(&rng);
+			const block b = { .id = r & 1 ? 2 : 0 };
+
+			failed += !world_set_block(positions[(r >> 1) % count],
+					bench_random(&rng) % WORLD_CHUNK_WIDTH,
+					bench_random(&rng) % (2 * CHUNK_SECTION_HEIGHT),
+					bench_random(&rng) % WORLD_CHUNK_WIDTH, b);
+		}
+
+		double elapsed = bench_now() - t;
+		bench_sample(edits, elapsed / batch);
+		edits->seconds += elapsed;
+
+		t = bench_now();
+		const unsigned int remeshed = world_remesh_dirty_chunks();
+		elapsed = bench_now() - t;
+		bench_sample(remeshes, elapsed);
+		remeshes->seconds += elapsed;
+		remeshes->ops += remeshed;
+	}
+
+	fprintf(stderr, "%zu edits over %zu chunks in %zu frames remeshed %zu chunks, %zu edits failed\n",
+			edits->ops, count, frames, remeshes->ops, failed);
+
+	free(positions);
+}
+
+// PHYSICS
+
+static void bench_physics(const bench_options* opts) {
+	const float delta_t = 1.0f / 60.0f;
+	const float gravity = -45.0f;
+
+	entity* entities = malloc(sizeof(entity) * opts->entities);
+	if (entities == NULL && opts->entities > 0) {
+		fputs("ERROR: Failed to allocate memory for benchmark entities\n", stderr);
+		exit(1);
+	}
+
+	// keep everyone a chunk away from the edge of the loaded world
+	const float extent = ((opts->chunks + 1) / 2 - 2) * WORLD_CHUNK_WIDTH;
+	unsigned int rng = opts->seed | 1;
+
+	for (unsigned int i = 0; i < opts->entities; i++) {
+		entities[i] = (entity){
+			.id = i,
+			.position = {
+				bench_random_float(&rng, -extent + 1, extent - 1),
+				bench_random_float(&rng, 20, 40),
+				bench_random_float(&rng, -extent + 1, extent - 1),
+			},
+			.size = { 0.6f, 1.8f, 0.6f },
+			.mass = 1,
+		};
+	}
+
+	bench_result* r = bench_begin("physics_step", "step", opts->steps, 1);
+	double start = bench_now();
+
+	for (unsigned int step = 0; step < opts->steps; step++) {
+		double t = bench_now();
+
+		for (unsigned int i = 0; i < opts->entities; i++) {
+			entity* e = &entities[i];
+
+			// wander, turning around at the edge of the loaded area
+			if (step % 120 == 0) {
+				e->velocity.x = bench_random_float(&rng, -5, 5);
+				e->velocity.z = bench_random_float(&rng, -5, 5);
+			}
+			if (fabsf(e->position.x) > extent)
+				e->velocity.x = e->position.x > 0 ? -fabsf(e->velocity.x) : fabsf(e->velocity.x);
+			if (fabsf(e->position.z) > extent)
+				e->velocity.z = e->position.z > 0 ? -fabsf(e->velocity.z) : fabsf(e->velocity.z);
+
+			e->velocity.y += gravity * delta_t;
+			entity_move(e, delta_t);
+
+			if (e->is_on_ground && step % 90 == (unsigned int)e->id % 90)
+				e->velocity.y = 12;
+		}
+
+		bench_sample(r, bench_now() - t);
+	}
+
+	r->seconds = bench_now() - start;
+
+	free(entities);
+}
+
+/* The entity manager with a crowd of mobs, items and projectiles
+ * spread over the loaded world, one sample per entities_update.
+ */
+static void bench_entities(const bench_options* opts) {
+	const float delta_t = 1.0f / 60.0f;
+	const float extent = ((opts->chunks + 1) / 2 - 2) * WORLD_CHUNK_WIDTH;
+	unsigned int rng = opts->seed | 1;
+
+	for (unsigned int i = 0; i < opts->mobs; i++) {
+		const Vector3 position = {
+			bench_random_float(&rng, -extent + 1, extent - 1),
+			bench_random_float(&rng, 20, 40),
+			bench_random_float(&rng, -extent + 1, extent - 1),
+		};
+
+		// mostly mobs, some items and a few projectiles
+		switch (i % 8) {
+			case 0:
+				entities_spawn(ENTITY_KIND_PROJECTILE, position, (Vector3){ 0.25f, 0.25f, 0.25f },
+						(Vector3){ bench_random_float(&rng, -40, 40), 10, bench_random_float(&rng, -40, 40) }, 0);
+				break;
+			case 1:
+			case 2:
+				entities_spawn(ENTITY_KIND_ITEM, position, (Vector3){ 0.25f, 0.25f, 0.25f }, Vector3Zero(), 0);
+				break;
+			default:
+				entities_spawn(ENTITY_KIND_MOB, position, (Vector3){ 0.6f, 1.8f, 0.6f }, Vector3Zero(), ENTITY_FLAG_SOLID);
+				break;
+		}
+	}
+
+	bench_result* r = bench_begin("entities_update", "step", opts->steps, 1);
+	double start = bench_now();
+
+	for (unsigned int step = 0; step < opts->steps; step++) {
+		// wander, turning around at the edge of the loaded area
+		for (size_t i = 0; i < ENTITIES.count; i++) {
+			Vector3* position = &ENTITIES.position[i];
+			Vector3* velocity = &ENTITIES.velocity[i];
+
+			if (ENTITIES.kind[i] == ENTITY_KIND_MOB && (step + ENTITIES.handle[i]) % 120 == 0) {
+				velocity->x = bench_random_float(&rng, -5, 5);
+				velocity->z = bench_random_float(&rng, -5, 5);
+			}
+			if (fabsf(position->x) > extent)
+				velocity->x = position->x > 0 ? -fabsf(velocity->x) : fabsf(velocity->x);
+			if (fabsf(position->z) > extent)
+				velocity->z = position->z > 0 ? -fabsf(velocity->z) : fabsf(velocity->z);
+		}
+
+		double t = bench_now();
+		entities_update(delta_t);
+		bench_sample(r, bench_now() - t);
+	}
+
+	r->seconds = bench_now() - start;
+}
+
+// REPLAY
+
+static struct {
+	bool ran;
+	unsigned long ticks;
+	long first_divergence; // -1 if every tick matched
+	Vector3 final_position;
+} REPLAY_RESULT = { .first_divergence = -1 };
+
+static void bench_replay(replay* r, player* p) {
+	bench_result* result = bench_begin("replay_tick", "tick", 1024, 1);
+	double start = bench_now();
+
+	input_state in;
+	Vector3 expected;
+
+	while (replay_play_tick(r, &in, &expected)) {
+		// chunk generation is not part of the tick
+		replay_wait_for_world(&in, p);
+
+		double t = bench_now();
+		player_update(p, &in);
+		bench_sample(result, bench_now() - t);
+
+		if (REPLAY_RESULT.first_divergence < 0 && memcmp(&p->e.position, &expected, sizeof(Vector3)) != 0)
+			REPLAY_RESULT.first_divergence = r->tick - 1;
+	}
+
+	result->seconds = bench_now() - start;
+
+	REPLAY_RESULT.ran = true;
+	REPLAY_RESULT.ticks = r->tick;
+	REPLAY_RESULT.final_position = p->e.position;
+}
+
+// OUTPUT
+
+static long bench_peak_rss_kb(void) {
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+	// kilobytes on Linux
+	return usage.ru_maxrss;
+}
+
+static void bench_write_json(FILE* f, const bench_options* opts) {
+	static const char* kernel_names[] = {
+		[PERLIN_KERNEL_SCALAR] = "scalar",
+		[PERLIN_KERNEL_SSE41] = "sse41",
+		[PERLIN_KERNEL_AVX2] = "avx2",
+	};
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"config\": {\n");
+	fprintf(f, "    \"seed\": %u,\n", opts->seed);
+	fprintf(f, "    \"chunks\": %d,\n", opts->chunks);
+	fprintf(f, "    \"steps\": %u,\n", opts->steps);
+	fprintf(f, "    \"entities\": %u,\n", opts->entities);
+	fprintf(f, "    \"mobs\": %u,\n", opts->mobs);
+	fprintf(f, "    \"lookups\": %u,\n", opts->lookups);
+	fprintf(f, "    \"rays\": %u,\n", opts->rays);
+	fprintf(f, "    \"edits\": %u,\n", opts->edits);
+	fprintf(f, "    \"edit_chunks\": %u,\n", opts->edit_chunks);
+	fprintf(f, "    \"threads\": %u,\n", worker_pool_thread_count());
+	fprintf(f, "    \"mesher\": \"%s\",\n", opts->mesher == CHUNK_MESHER_GREEDY ? "greedy" : "naive");
+	fprintf(f, "    \"perlin_kernel\": \"%s\"\n", kernel_names[perlin_noise_get_kernel()]);
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"results\": [\n");
+
+	for (size_t i = 0; i < RESULT_COUNT; i++) {
+		bench_result* r = &RESULTS[i];
+
+		qsort(r->samples, r->sample_count, sizeof(double), bench_compare_double);
+
+		double sum = 0;
+		for (size_t s = 0; s < r->sample_count; s++)
+			sum += r->samples[s];
+
+		const double us = 1e6;
+
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"name\": \"%s\",\n", r->name);
+		fprintf(f, "      \"unit\": \"%s\",\n", r->unit);
+		fprintf(f, "      \"ops\": %zu,\n", r->ops);
+		fprintf(f, "      \"seconds\": %.6f,\n", r->seconds);
+		fprintf(f, "      \"ops_per_second\": %.1f,\n", r->seconds > 0 ? r->ops / r->seconds : 0);
+		fprintf(f, "      \"latency_us\": {\n");
+		fprintf(f, "        \"samples\": %zu,\n", r->sample_count);
+		fprintf(f, "        \"ops_per_sample\": %zu,\n", r->ops_per_sample);
+		fprintf(f, "        \"mean\": %.3f,\n", r->sample_count ? sum / r->sample_count * us : 0);
+		fprintf(f, "        \"min\": %.3f,\n", bench_percentile(r->samples, r->sample_count, 0) * us);
+		fprintf(f, "        \"p50\": %.3f,\n", bench_percentile(r->samples, r->sample_count, 50) * us);
+		fprintf(f, "        \"p90\": %.3f,\n", bench_percentile(r->samples, r->sample_count, 90) * us);
+		fprintf(f, "        \"p99\": %.3f,\n", bench_percentile(r->samples, r->sample_count, 99) * us);
+		fprintf(f, "        \"max\": %.3f\n", bench_percentile(r->samples, r->sample_count, 100) * us);
+		fprintf(f, "      }\n");
+		fprintf(f, "    }%s\n", i + 1 < RESULT_COUNT ? "," : "");
+	}
+
+	fprintf(f, "  ],\n");
+
+	if (REPLAY_RESULT.ran) {
+		const Vector3 p = REPLAY_RESULT.final_position;
+
+		fprintf(f, "  \"replay\": {\n");
+		fprintf(f, "    \"file\": \"%s\",\n", opts->replay);
+		fprintf(f, "    \"ticks\": %lu,\n", REPLAY_RESULT.ticks);
+		fprintf(f, "    \"first_divergence\": %ld,\n", REPLAY_RESULT.first_divergence);
+		fprintf(f, "    \"final_position\": [%.9g, %.9g, %.9g]\n", p.x, p.y, p.z);
+		fprintf(f, "  },\n");
+	}
+
+	fprintf(f, "  \"peak_rss_kb\": %ld\n", bench_peak_rss_kb());
+	fprintf(f, "}\n");
+}
+
+// remove the region files the benchmark wrote
+static void bench_remove_directory(const char* path) {
+	DIR* dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	struct dirent* ent;
+	char file[512];
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+		unlink(file);
+	}
+
+	closedir(dir);
+	rmdir(path);
+}
+
+static void bench_usage(const char* name) {
+	fprintf(stderr,
+			"Usage: %s [--seed N] [--chunks N] [--steps N] [--entities N] [--mobs N]\n"
+			"          [--lookups N] [--rays N] [--edits N] [--edit-chunks N]\n"
+			"          [--threads N] [--mesher naive|greedy]\n"
+			"          [--kernel scalar|sse41|avx2] [--out FILE] [--trace FILE]\n"
+			"          [--replay FILE]\n",
+			name);
+}
+
+int main(int argc, char** argv) {
+	bench_options opts = {
+		.seed = 42,
+		.chunks = 16,
+		.steps = 2000,
+		.entities = 64,
+		.mobs = 10000,
+		.lookups = 1000000,
+		.rays = 100000,
+		.edits = 100000,
+		.edit_chunks = 4,
+		.threads = 0,
+		.mesher = CHUNK_MESHER_GREEDY,
+		.kernel = -1,
+		.out = NULL,
+		.trace = NULL,
+		.replay = NULL,
+	};
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (value == NULL) {
+			bench_usage(argv[0]);
+			return 1;
+		}
+
+		if (strcmp(arg, "--seed") == 0)
+			opts.seed = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--chunks") == 0)
+			opts.chunks = atoi(value);
+		else if (strcmp(arg, "--steps") == 0)
+			opts.steps = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--entities") == 0)
+			opts.entities = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--mobs") == 0)
+			opts.mobs = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--lookups") == 0)
+			opts.lookups = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--rays") == 0)
+			opts.rays = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--edits") == 0)
+			opts.edits = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--edit-chunks") == 0)
+			opts.edit_chunks = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--threads") == 0)
+			opts.threads = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "--mesher") == 0)
+			opts.mesher = strcmp(value, "naive") == 0 ? CHUNK_MESHER_NAIVE : CHUNK_MESHER_GREEDY;
+		else if (strcmp(arg, "--kernel") == 0)
+			opts.kernel = strcmp(value, "scalar") == 0 ? PERLIN_KERNEL_SCALAR :
+				strcmp(value, "sse41") == 0 ? PERLIN_KERNEL_SSE41 : PERLIN_KERNEL_AVX2;
+		else if (strcmp(arg, "--out") == 0)
+			opts.out = value;
+		else if (strcmp(arg, "--trace") == 0)
+			opts.trace = value;
+		else if (strcmp(arg, "--replay") == 0)
+			opts.replay = value;
+		else {
+			bench_usage(argv[0]);
+			return 1;
+		}
+
+		i++;
+	}
+
+	if (opts.chunks < 4) {
+		fputs("ERROR: --chunks must be at least 4\n", stderr);
+		return 1;
+	}
+
+	// no window, so SETTINGS is filled in here instead of globals_init
+	SETTINGS = (settings){
+		.render_distance = (opts.chunks + 1) / 2,
+		.chunk_uploads_per_frame = 4,
+		.chunk_unload_margin = 2,
+		.chunk_memory_budget = (size_t)-1,
+	};
+
+	// region files go somewhere temporary so every run starts from nothing
+	char save_directory[] = "/tmp/tinycraft-bench-XXXXXX";
+	if (mkdtemp(save_directory) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	world_data wd = {
+		.chunk_opts = {
+			.seed = opts.seed,
+			.perlin_amplitude = 3.0f,
+			.perlin_frequency = 0.05f,
+			.octaves = 2,
+			.mesher = opts.mesher,
+		},
+		.save_directory = save_directory,
+		.headless = true,
+	};
+
+	// the recording decides the world and where the player starts
+	replay playback = {0};
+	player replay_player = {0};
+
+	if (opts.replay != NULL) {
+		replay_player = player_init();
+
+		if (!replay_play_begin(&playback, opts.replay, &wd.chunk_opts, &replay_player)) {
+			player_destroy(&replay_player);
+			return 1;
+		}
+
+		opts.seed = wd.chunk_opts.seed;
+	}
+
+	TRACE_THREAD_NAME("main");
+
+	world_init(&wd);
+
+	// world_init starts a pool with one thread per core
+	if (opts.threads != 0) {
+		worker_pool_destroy();
+		worker_pool_init(opts.threads);
+	}
+
+	perlin_noise_init(opts.seed);
+
+	if (opts.kernel >= 0 && !perlin_noise_set_kernel(opts.kernel))
+		fputs("WARNING: The requested perlin kernel is not supported, using the default\n", stderr);
+
+	if (opts.replay != NULL) {
+		bench_replay(&playback, &replay_player);
+		replay_close(&playback);
+		player_destroy(&replay_player);
+	} else {
+		bench_generation(&opts, &WORLD.chunk_opts);
+		bench_pipeline(&opts);
+		bench_dict_lookup(&opts);
+		bench_raycast(&opts);
+		bench_edit(&opts);
+		bench_region(&opts);
+		bench_physics(&opts);
+		bench_entities(&opts);
+	}
+
+	FILE* out = stdout;
+	if (opts.out != NULL && (out = fopen(opts.out, "w")) == NULL) {
+		perror(opts.out);
+		out = stdout;
+	}
+
+	bench_write_json(out, &opts);
+
+	if (out != stdout)
+		fclose(out);
+
+	if (opts.trace != NULL)
+		trace_dump(opts.trace, HUGE_VAL);
+
+	world_unload_all_chunks();
+	worker_pool_destroy();
+	region_close_all();
+	entities_destroy();
+
+	bench_remove_directory(save_directory);
+
+	for (size_t i = 0; i < RESULT_COUNT; i++)
+		free(RESULTS[i].samples);
+
+	return 0;
+}
@@ -13,13 +13,9 @@ void main()
 
 // Input vertex attributes (from vertex shader)
 in vec3 fragPosition;
-in vec2 fragTexCoord;
+in vec4 fragColor;
 in vec3 fragNormal;
 
-// Input uniform values
-uniform sampler2D texture0;
-uniform vec4 colDiffuse;
-
 // Output fragment color
 out vec4 finalColor;
 
@@ -44,8 +40,8 @@ uniform vec3 viewPos;
 
 void main()
 {
-    // Texel color fetching from texture sampler
-    vec4 texelColor = texture(texture0, fragTexCoord);
+    // Block color from the vertex shader
+    vec4 texelColor = fragColor;
     vec3 lightDot = vec3(0.0);
     vec3 normal = normalize(fragNormal);
     vec3 viewD = normalize(viewPos - fragPosition);
@@ -78,8 +74,8 @@ void main()
         }
     }
 
-    finalColor = (texelColor*((colDiffuse + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
-    finalColor += texelColor*(ambient/10.0)*colDiffuse;
+    finalColor = (texelColor*((vec4(1.0) + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
+    finalColor += texelColor*(ambient/10.0);
 
     // Gamma correction
     finalColor = pow(finalColor, vec4(1.0/2.2));
@@ -1,54 +1,82 @@
-/* #version 330 core
-
-layout (location = 0) in vec3 vertex_pos;
-layout (location = 1) in mat4 instance_transform;
-
-uniform vec3 chunk_pos;
-uniform mat4 mvp; // view projection matrix
-
-out vec4 frag_col;
-
-void main()
-{
-	frag_col = vec4(0.7, 0.0, 0.3, 1.0);
-	// gl_Position = mvp * (vec4(chunk_pos, 1.0) + (vec4(vertex_pos, 1.0) * instance_transform));
-	gl_Position = mvp * vec4(vertex_pos, 1.0)
-} */
-
 #version 330
 
 // Input vertex attributes
-in vec3 vertexPosition;
-in vec2 vertexTexCoord;
-in vec3 vertexNormal;
-//in vec4 vertexColor;      // Not required
+layout (location = 0) in vec3 vertexPosition; // corner of a unit quad in the xz plane
 
-in mat4 instanceTransform;
+// Per instance packed chunk_face (see chunk.h), bytes arrive as floats
+layout (location = 6) in vec4 facePosition; // x, y, z, direction
+layout (location = 7) in vec4 faceInfo;     // width, height, block id, unused
+layout (location = 8) in vec2 faceChunk;    // x, z of the face's chunk
 
 // Input uniform values
 uniform mat4 mvp;
-uniform mat4 matNormal;
 
 // Output vertex attributes (to fragment shader)
 out vec3 fragPosition;
-out vec2 fragTexCoord;
 out vec4 fragColor;
 out vec3 fragNormal;
 
-// NOTE: Add here your custom variables
+#define FACE_DIR_FRONT  0
+#define FACE_DIR_BACK   1
+#define FACE_DIR_LEFT   2
+#define FACE_DIR_RIGHT  3
+#define FACE_DIR_TOP    4
+#define FACE_DIR_BOTTOM 5
+
+const vec3 normals[6] = vec3[6](
+    vec3(0.0, 0.0, 1.0),
+    vec3(0.0, 0.0, -1.0),
+    vec3(1.0, 0.0, 0.0),
+    vec3(-1.0, 0.0, 0.0),
+    vec3(0.0, 1.0, 0.0),
+    vec3(0.0, -1.0, 0.0)
+);
+
+// indexed by block id
+const vec4 blockColors[3] = vec4[3](
+    vec4(1.0, 0.0, 1.0, 1.0), // air, should never be drawn
+    vec4(0.3, 0.7, 0.2, 1.0), // grass
+    vec4(0.5, 0.5, 0.5, 1.0)  // stone
+);
 
 void main()
 {
+    int direction = int(facePosition.w);
+    vec2 size = faceInfo.xy;
+
+    // a block at index y spans y - 1 to y
+    vec3 block = facePosition.xyz - vec3(0.0, 1.0, 0.0);
+
+    // flip the quad where needed so every face winds counter clockwise from outside
+    float u = vertexPosition.x;
+    float v = vertexPosition.z;
+    if (direction == FACE_DIR_TOP || direction == FACE_DIR_BACK || direction == FACE_DIR_LEFT)
+        u = 1.0 - u;
+
+    u *= size.x;
+    v *= size.y;
+
+    vec3 localPosition;
+    if (direction == FACE_DIR_TOP)
+        localPosition = block + vec3(u, 1.0, v);
+    else if (direction == FACE_DIR_BOTTOM)
+        localPosition = block + vec3(u, 0.0, v);
+    else if (direction == FACE_DIR_FRONT)
+        localPosition = block + vec3(u, v, 1.0);
+    else if (direction == FACE_DIR_BACK)
+        localPosition = block + vec3(u, v, 0.0);
+    else if (direction == FACE_DIR_LEFT)
+        localPosition = block + vec3(1.0, v, u);
+    else
+        localPosition = block + vec3(0.0, v, u);
+
+    int id = int(faceInfo.z);
+
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(instanceTransform*vec4(vertexPosition, 1.0));
-    fragTexCoord = vertexTexCoord;
-    //fragColor = vertexColor;
-    // fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
-    // fragNormal = normalize(vec3(instanceTransform)*vec3(matNormal*vec4(vertexNormal, 1.0)));
-	// fragNormal = mat3(transpose(inverse(mvp * vec3(instanceTransform)))) * vertexNormal;
-	// fragNormal = mat3(transpose(inverse(mvp * instanceTransform))) * vertexNormal;
-	fragNormal = vec3(mvp*instanceTransform*vec4(vertexNormal, 1.0));
-
-    // Calculate final vertex position, note that we multiply mvp by instanceTransform
-    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);
+    fragPosition = vec3(faceChunk.x, 0.0, faceChunk.y)*16.0 + localPosition; // 16 is WORLD_CHUNK_WIDTH
+    fragNormal = normals[direction];
+    fragColor = id < 3 ? blockColors[id] : vec4(1.0);
+
+    // Calculate final vertex position
+    gl_Position = mvp*vec4(fragPosition, 1.0);
 }
@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+
+#include "block_storage.h"
+
+static size_t block_storage_word_count(unsigned int block_count, unsigned int bits_per_block) {
+	return ((size_t)block_count * bits_per_block + 63) / 64;
+}
+
+// fewest power of two bits that can address palette_size entries
+static unsigned int block_storage_bits_for(unsigned int palette_size) {
+	unsigned int bits = 0;
+
+	while ((1u << bits) < palette_size)
+		bits = bits ? bits * 2 : 1;
+
+	return bits;
+}
+
+void block_storage_init(block_storage* bs, unsigned int block_count, unsigned int id) {
+	*bs = (block_storage){
+		.uniform_id = id,
+		.block_count = block_count,
+	};
+}
+
+bool block_storage_init_palette(block_storage* bs, unsigned int block_count, const unsigned int* palette, unsigned int palette_size) {
+	block_storage_init(bs, block_count, palette[0]);
+
+	if (palette_size < 2)
+		return true;
+
+	const unsigned int bits = block_storage_bits_for(palette_size);
+
+	bs->palette = malloc(sizeof(unsigned int) * palette_size);
+	bs->data = calloc(block_storage_word_count(block_count, bits), sizeof(uint64_t));
+
+	if (bs->palette == NULL || bs->data == NULL) {
+		fputs("Failed to allocate memory for block data\n", stderr);
+		block_storage_free(bs);
+		block_storage_init(bs, block_count, palette[0]);
+		return false;
+	}
+
+	memcpy(bs->palette, palette, sizeof(unsigned int) * palette_size);
+	bs->palette_size = palette_size;
+	bs->palette_capacity = palette_size;
+	bs->bits_per_block = bits;
+
+	return true;
+}
+
+void block_storage_free(block_storage* bs) {
+	unsigned int block_count = bs->block_count;
+
+	free(bs->palette);
+	free(bs->data);
+	block_storage_init(bs, block_count, 0);
+}
+
+size_t block_storage_memory(const block_storage* bs) {
+	return sizeof(unsigned int) * bs->palette_capacity +
+		sizeof(uint64_t) * block_storage_word_count(bs->block_count, bs->bits_per_block);
+}
+
+static inline unsigned int block_storage_get_index(const block_storage* bs, unsigned int index) {
+	const unsigned int bit = index * bs->bits_per_block;
+	const uint64_t mask = (1ULL << bs->bits_per_block) - 1;
+
+	return (bs->data[bit >> 6] >> (bit & 63)) & mask;
+}
+
+static inline void block_storage_set_index(uint64_t* data, unsigned int bits_per_block, unsigned int index, uint64_t palette_index) {
+	const unsigned int bit = index * bits_per_block;
+	const uint64_t mask = (1ULL << bits_per_block) - 1;
+	uint64_t* word = &data[bit >> 6];
+
+	*word = (*word & ~(mask << (bit & 63))) | (palette_index << (bit & 63));
+}
+
+// copy every index into a new data array at new_bits per block
+static bool block_storage_repack(block_storage* bs, unsigned int new_bits) {
+	uint64_t* data = calloc(block_storage_word_count(bs->block_count, new_bits), sizeof(uint64_t));
+
+	if (data == NULL) {
+		fputs("Failed to allocate memory for block data\n", stderr);
+		return false;
+	}
+
+	if (bs->bits_per_block != 0) {
+		for (unsigned int i = 0; i < bs->block_count; i++)
+			block_storage_set_index(data, new_bits, i, block_storage_get_index(bs, i));
+	}
+	// uniform storage is palette index 0 everywhere, which calloc already wrote
+
+	free(bs->data);
+	bs->data = data;
+	bs->bits_per_block = new_bits;
+
+	return true;
+}
+
+// returns the palette index of id, adding it if needed. -1 on failure
+static int block_storage_palette_index(block_storage* bs, unsigned int id) {
+	for (unsigned int i = 0; i < bs->palette_size; i++)
+		if (bs->palette[i] == id)
+			return i;
+
+	if (bs->palette_size == bs->palette_capacity) {
+		unsigned int new_capacity = bs->palette_capacity ? bs->palette_capacity * 2 : 4;
+		unsigned int* palette = realloc(bs->palette, sizeof(unsigned int) * new_capacity);
+
+		if (palette == NULL) {
+			fputs("Failed to allocate memory for a block palette\n", stderr);
+			return -1;
+		}
+
+		bs->palette = palette;
+		bs->palette_capacity = new_capacity;
+	}
+
+	// widen the data once the palette no longer fits in the current bits
+	if (bs->palette_size + 1 > (1u << bs->bits_per_block)) {
+		if (!block_storage_repack(bs, block_storage_bits_for(bs->palette_size + 1)))
+			return -1;
+	}
+
+	bs->palette[bs->palette_size] = id;
+
+	return bs->palette_size++;
+}
+
+bool block_storage_set(block_storage* bs, unsigned int index, unsigned int id) {
+	if (bs->bits_per_block == 0) {
+		// writing the only id there is needs no data array
+		if (bs->uniform_id == id)
+			return true;
+
+		// the uniform id becomes palette entry 0
+		if (bs->palette == NULL) {
+			bs->palette = malloc(sizeof(unsigned int) * 4);
+
+			if (bs->palette == NULL) {
+				fputs("Failed to allocate memory for a block palette\n", stderr);
+				return false;
+			}
+
+			bs->palette_capacity = 4;
+		}
+
+		bs->palette[0] = bs->uniform_id;
+		bs->palette_size = 1;
+	}
+
+	int palette_index = block_storage_palette_index(bs, id);
+	if (palette_index < 0)
+		return false;
+
+	block_storage_set_index(bs->data, bs->bits_per_block, index, palette_index);
+
+	return true;
+}
+
+bool block_storage_compact(block_storage* bs) {
+	if (bs->bits_per_block == 0)
+		return true;
+
+	// old palette index -> new palette index, UINT_MAX when unused
+	unsigned int* remap = malloc(sizeof(unsigned int) * bs->palette_size);
+	if (remap == NULL) {
+		fputs("Failed to allocate memory to compact block storage\n", stderr);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < bs->palette_size; i++)
+		remap[i] = UINT_MAX;
+
+	for (unsigned int i = 0; i < bs->block_count; i++)
+		remap[block_storage_get_index(bs, i)] = 0;
+
+	// number the used entries in palette order, so they only ever move down
+	unsigned int used = 0;
+	for (unsigned int i = 0; i < bs->palette_size; i++)
+		if (remap[i] != UINT_MAX)
+			remap[i] = used++;
+
+	if (used == 1) {
+		unsigned int id = bs->palette[block_storage_get_index(bs, 0)];
+
+		free(remap);
+		block_storage_free(bs);
+		block_storage_init(bs, bs->block_count, id);
+
+		return true;
+	}
+
+	const unsigned int new_bits = block_storage_bits_for(used);
+
+	if (used == bs->palette_size && new_bits == bs->bits_per_block) {
+		free(remap);
+		return true;
+	}
+
+	uint64_t* data = calloc(block_storage_word_count(bs->block_count, new_bits), sizeof(uint64_t));
+	if (data == NULL) {
+		free(remap);
+		fputs("Failed to allocate memory to compact block storage\n", stderr);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < bs->block_count; i++)
+		block_storage_set_index(data, new_bits, i, remap[block_storage_get_index(bs, i)]);
+
+	// palette entries only move down, so this can be done in place
+	for (unsigned int i = 0; i < bs->palette_size; i++)
+		if (remap[i] != UINT_MAX)
+			bs->palette[remap[i]] = bs->palette[i];
+
+	free(bs->data);
+	free(remap);
+
+	bs->data = data;
+	bs->bits_per_block = new_bits;
+	bs->palette_size = used;
+
+	return true;
+}
+
+/* Serialized layout:
+ *   uint32 bits_per_block
+ *   bits_per_block == 0: uint32 uniform_id
+ *   otherwise:           uint32 palette_size, uint32 palette[palette_size],
+ *                        uint64 data[word count]
+ * Everything is memcpy'd since the source may not be aligned.
+ */
+size_t block_storage_serialized_size(const block_storage* bs) {
+	if (bs->bits_per_block == 0)
+		return 2 * sizeof(uint32_t);
+
+	return 2 * sizeof(uint32_t) +
+		sizeof(uint32_t) * bs->palette_size +
+		sizeof(uint64_t) * block_storage_word_count(bs->block_count, bs->bits_per_block);
+}
+
+size_t block_storage_serialize(const block_storage* bs, unsigned char* out) {
+	unsigned char* p = out;
+	uint32_t value = bs->bits_per_block;
+
+	memcpy(p, &value, sizeof(value));
+	p += sizeof(value);
+
+	if (bs->bits_per_block == 0) {
+		value = bs->uniform_id;
+		memcpy(p, &value, sizeof(value));
+		return p + sizeof(value) - out;
+	}
+
+	value = bs->palette_size;
+	memcpy(p, &value, sizeof(value));
+	p += sizeof(value);
+
+	for (unsigned int i = 0; i < bs->palette_size; i++) {
+		value = bs->palette[i];
+		memcpy(p, &value, sizeof(value));
+		p += sizeof(value);
+	}
+
+	const size_t data_size = sizeof(uint64_t) * block_storage_word_count(bs->block_count, bs->bits_per_block);
+	memcpy(p, bs->data, data_size);
+
+	return p + data_size - out;
+}
+
+size_t block_storage_deserialize(block_storage* bs, unsigned int block_count, const unsigned char* in, size_t size) {
+	const unsigned char* p = in;
+	uint32_t bits, value;
+
+	block_storage_init(bs, block_count, 0);
+
+	if (size < 2 * sizeof(uint32_t))
+		return 0;
+
+	memcpy(&bits, p, sizeof(bits));
+	memcpy(&value, p + sizeof(bits), sizeof(value));
+	p += 2 * sizeof(uint32_t);
+
+	if (bits == 0) {
+		bs->uniform_id = value;
+		return p - in;
+	}
+
+	const uint32_t palette_size = value;
+
+	if (bits != block_storage_bits_for(palette_size) || palette_size < 2)
+		return 0;
+
+	const size_t word_count = block_storage_word_count(block_count, bits);
+	if ((size_t)(in + size - p) < sizeof(uint32_t) * palette_size + sizeof(uint64_t) * word_count)
+		return 0;
+
+	bs->palette = malloc(sizeof(unsigned int) * palette_size);
+	bs->data = malloc(sizeof(uint64_t) * word_count);
+
+	if (bs->palette == NULL || bs->data == NULL) {
+		fputs("Failed to allocate memory for block data\n", stderr);
+		block_storage_free(bs);
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < palette_size; i++) {
+		memcpy(&value, p, sizeof(value));
+		bs->palette[i] = value;
+		p += sizeof(value);
+	}
+
+	memcpy(bs->data, p, sizeof(uint64_t) * word_count);
+	p += sizeof(uint64_t) * word_count;
+
+	bs->palette_size = palette_size;
+	bs->palette_capacity = palette_size;
+	bs->bits_per_block = bits;
+
+	// a corrupt index would read past the palette later on
+	for (unsigned int i = 0; i < block_count; i++) {
+		if (block_storage_get_index(bs, i) >= palette_size) {
+			block_storage_free(bs);
+			return 0;
+		}
+	}
+
+	return p - in;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Palette compressed array of block ids.
+ * Every distinct id gets a palette slot and the data array
+ * stores palette indices with just enough bits to address the
+ * palette (0, 1, 2, 4, 8 or 16 bits). Bit widths are powers of
+ * two so an index never straddles two words.
+ * When the palette outgrows the current width everything is
+ * repacked at the next width. Palette entries are only removed
+ * by block_storage_compact.
+ * While every block has the same id the storage is "uniform":
+ * it holds just that id and allocates nothing.
+ */
+typedef struct {
+	unsigned int uniform_id; // only meaningful when bits_per_block is 0
+	unsigned int* palette;
+	unsigned int palette_size;
+	unsigned int palette_capacity;
+	unsigned int bits_per_block; // 0 means uniform, palette and data are NULL
+	uint64_t* data;
+	unsigned int block_count;
+} block_storage;
+
+/* Set up uniform storage for block_count blocks that are all id.
+ * This never allocates.
+ */
+void block_storage_init(block_storage* bs, unsigned int block_count, unsigned int id);
+
+/* Set up storage for block_count blocks with the given palette
+ * (of distinct ids) at the fewest bits that address it, every
+ * block at palette index 0. For writers that know up front which
+ * ids they will store and pack the indices into data themselves.
+ * A palette of one id gives uniform storage.
+ * Returns false if memory could not be allocated, bs is then
+ * uniform palette[0].
+ */
+bool block_storage_init_palette(block_storage* bs, unsigned int block_count, const unsigned int* palette, unsigned int palette_size);
+
+/* Free the palette and data
+ */
+void block_storage_free(block_storage* bs);
+
+/* Bytes of heap memory used by the storage
+ */
+size_t block_storage_memory(const block_storage* bs);
+
+static inline bool block_storage_is_uniform(const block_storage* bs) {
+	return bs->bits_per_block == 0;
+}
+
+static inline unsigned int block_storage_get(const block_storage* bs, unsigned int index) {
+	if (bs->bits_per_block == 0)
+		return bs->uniform_id;
+
+	const unsigned int bit = index * bs->bits_per_block;
+	const uint64_t mask = (1ULL << bs->bits_per_block) - 1;
+
+	return bs->palette[(bs->data[bit >> 6] >> (bit & 63)) & mask];
+}
+
+/* Store id at index, growing the palette (and repacking) if the
+ * id has not been seen before.
+ * Returns false if the storage could not grow, nothing is changed.
+ */
+bool block_storage_set(block_storage* bs, unsigned int index, unsigned int id);
+
+/* Drop palette entries that are no longer used and shrink the
+ * data to the fewest bits that fit. Storage where every block
+ * has the same id becomes uniform again.
+ * Returns false if memory for the smaller copy could not be
+ * allocated, the storage is left as it was.
+ */
+bool block_storage_compact(block_storage* bs);
+
+/* Bytes block_storage_serialize writes for bs
+ */
+size_t block_storage_serialized_size(const block_storage* bs);
+
+/* Write bs into out, which must hold block_storage_serialized_size
+ * bytes. Values are stored in native byte order.
+ * Returns the number of bytes written.
+ */
+size_t block_storage_serialize(const block_storage* bs, unsigned char* out);
+
+/* Read storage for block_count blocks written by
+ * block_storage_serialize from the size bytes at in.
+ * bs must be freed (or never initialized); on failure it is
+ * left uniform air.
+ * Returns the number of bytes read, 0 if the data is invalid
+ * or memory could not be allocated.
+ */
+size_t block_storage_deserialize(block_storage* bs, unsigned int block_count, const unsigned char* in, size_t size);
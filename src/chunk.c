@@ -1,242 +1,222 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
 
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
 
 #include "chunk.h"
+#include "face_arena.h"
 #include "global.h"
+#include "trace.h"
 
 // CHUNK DICTIONARY
-static size_t chunk_dict_hash(world_chunk_pos key) {
-	return abs(key.z + 1) * 5 + abs(key.x) ;
-}
 
-chunk_dict_entry* chunk_dict_lookup(chunk_dictionary* chunk_dict, world_chunk_pos key) {
-	size_t index = chunk_dict_hash(key) % CHUNK_DICT_ENTRIES;
-	chunk_dict_entry* entry = chunk_dict->entries[index];
+#define CHUNK_DICT_MIN_CAPACITY 64
 
-	while (entry != NULL) {
-		if (entry->key.x == key.x && entry->key.z == key.z)
-			return entry;
-		entry = entry->next;
-	}
+static inline uint64_t chunk_dict_hash(world_chunk_pos key) {
+	// pack both coordinates into one integer
+	uint64_t h = (uint64_t)(uint32_t)key.x << 32 | (uint32_t)key.z;
 
-	// chunk not found
-	return NULL;
+	// murmur3 finalizer, spreads nearby positions across the table
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
 }
 
-void chunk_dict_delete(chunk_dictionary* chunk_dict, world_chunk_pos key) {
-	size_t index = chunk_dict_hash(key) % CHUNK_DICT_ENTRIES;
-	chunk_dict->count--;
-	chunk_dict_entry* entry = chunk_dict->entries[index];
-	chunk_dict_entry* prev = NULL;
+static inline bool chunk_dict_key_equals(world_chunk_pos a, world_chunk_pos b) {
+	return a.x == b.x && a.z == b.z;
+}
 
-	while (entry != NULL && entry->key.x != key.x && entry->key.z != key.z) {
-		prev = entry;
-		entry = entry->next;
-	}
+chunk_dict_entry* chunk_dict_lookup(chunk_dictionary* chunk_dict, world_chunk_pos key) {
+	if (chunk_dict->count == 0)
+		return NULL;
 
-	if (entry == NULL)
-		return;
+	const size_t mask = chunk_dict->capacity - 1;
+	size_t index = chunk_dict_hash(key) & mask;
 
-	// entry has been found
+	for (;;) {
+		chunk_dict_entry* entry = &chunk_dict->entries[index];
 
-	if (prev == NULL)
-		chunk_dict->entries[index] = entry->next;
-	else
-		prev->next = entry->next;
+		// an empty slot ends the probe sequence
+		if (entry->value == NULL)
+			return NULL;
 
-	free(entry->value);
-	free(entry);
-}
+		if (chunk_dict_key_equals(entry->key, key))
+			return entry;
 
-void chunk_dict_delete_all(chunk_dictionary* chunk_dict) {
-	chunk_dict->count = 0;
-	for (size_t i = 0; i < CHUNK_DICT_ENTRIES; i++) {
-		chunk_dict_entry* entry = chunk_dict->entries[i];
-		if (entry != NULL) {
-			while (entry->next != NULL) {
-				chunk_dict_entry* next_entry = entry->next;
-
-				UnloadMesh(entry->value->face_mesh);
-				free(entry->value->transforms);
-				free(entry->value);
-				free(entry);
-
-				entry = next_entry;
-			}
-		}
+		index = (index + 1) & mask;
 	}
 }
 
-void chunk_dict_insert(chunk_dictionary* chunk_dict, world_chunk_pos key, chunk* value) {
-	size_t index = chunk_dict_hash(key) % CHUNK_DICT_ENTRIES;
+static bool chunk_dict_grow(chunk_dictionary* chunk_dict) {
+	unsigned int new_capacity = chunk_dict->capacity ? chunk_dict->capacity * 2 : CHUNK_DICT_MIN_CAPACITY;
+	chunk_dict_entry* entries = calloc(new_capacity, sizeof(chunk_dict_entry));
 
-	chunk_dict->count++;
-	chunk_dict_entry* entry = malloc(sizeof(chunk_dict_entry));
-
-	if (entry == NULL) {
-		fputs("Failed to allocate memory for a chunk entry\n", stderr);
-		return;
+	if (entries == NULL) {
+		fputs("Failed to allocate memory for the chunk dictionary\n", stderr);
+		return false;
 	}
 
-	*entry = (chunk_dict_entry){
-		.key = key,
-		.value = value,
-		.next = NULL,
-	};
-	
-	if (chunk_dict->entries[index] == NULL)
-		chunk_dict->entries[index] = entry;
-	else {
-		chunk_dict_entry* entry_ptr = chunk_dict->entries[index];
+	const size_t mask = new_capacity - 1;
 
-		while (entry_ptr->next != NULL)
-			entry_ptr = entry_ptr->next;
+	// reinsert everything, no key can be a duplicate here
+	for (size_t i = 0; i < chunk_dict->capacity; i++) {
+		chunk_dict_entry entry = chunk_dict->entries[i];
+		if (entry.value == NULL)
+			continue;
 
-		entry_ptr->next = entry;
-	}
-}
+		size_t index = chunk_dict_hash(entry.key) & mask;
+		while (entries[index].value != NULL)
+			index = (index + 1) & mask;
 
-void for_each_chunk(chunk_dictionary* chunk_dict, void (*func)(world_chunk_pos pos, chunk* chunk, void* args), void* args) {
-	for (size_t i = 0; i < CHUNK_DICT_ENTRIES; i++) {
-		chunk_dict_entry* entry = chunk_dict->entries[i];
-		while (entry != NULL) {
-			func(entry->key, entry->value, args);
-			entry = entry->next;
-		}
+		entries[index] = entry;
 	}
-}
 
-void for_each_block(chunk* chunk, void (*func)(block* block, void* args), void* args) {
-	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
-		for (unsigned int y = 0; y < WORLD_CHUNK_HEIGHT; y++) {
-			for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
-				
-				func(&chunk->blocks[x][y][z], args);
-			}
-		}
-	}
+	free(chunk_dict->entries);
+	chunk_dict->entries = entries;
+	chunk_dict->capacity = new_capacity;
+
+	return true;
 }
 
+chunk* chunk_dict_remove(chunk_dictionary* chunk_dict, world_chunk_pos key) {
+	chunk_dict_entry* entry = chunk_dict_lookup(chunk_dict, key);
 
-#include <math.h>
+	if (entry == NULL)
+		return NULL;
+
+	// entry has been found
+	chunk* value = entry->value;
+	chunk_dict->count--;
 
-// PERLIN NOISE GENERATION
+	/* backward shift deletion: move later entries of the probe
+	 * sequence into the hole until an entry is already in its
+	 * home slot or an empty slot is reached
+	 */
+	const size_t mask = chunk_dict->capacity - 1;
+	size_t hole = entry - chunk_dict->entries;
+	size_t index = hole;
 
-// permutation table for perlin noise
-static int ptable[512];
+	for (;;) {
+		index = (index + 1) & mask;
+		chunk_dict_entry* next = &chunk_dict->entries[index];
 
-void perlin_noise_init(unsigned int seed) {
-	int permutation[] = { 151,160,137,91,90,15,
-				131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-				190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-				88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-				77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-				102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-				135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-				5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-				223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-				129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-				251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-				49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-				138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
+		if (next->value == NULL)
+			break;
 
-	srand(seed);
+		size_t home = chunk_dict_hash(next->key) & mask;
 
-	// shuffle permutation array with seed
-	for (int i = 255; i > 0; i--) {
-		int j = rand() % (i + 1);
-		int temp = permutation[i];
-		permutation[i] = permutation[j];
-		permutation[j] = temp;
+		// next may only move back if its home is not between the hole and itself
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			chunk_dict->entries[hole] = *next;
+			hole = index;
+		}
 	}
 
-	// fill ptable with permutation values repeated twice
-	for (int i = 0; i < 256; i++)
-		ptable[256+i] = ptable[i] = permutation[i];
-}
+	chunk_dict->entries[hole] = (chunk_dict_entry){0};
 
-static inline float perlin_fade(float t) {
-	return t * t * t * (t * (t * 6 - 15) + 10);
+	return value;
 }
 
-static inline float perlin_lerp(float t, float a, float b) {
-	return a + t * (b - a);
+void chunk_dict_delete(chunk_dictionary* chunk_dict, world_chunk_pos key) {
+	chunk* value = chunk_dict_remove(chunk_dict, key);
+
+	if (value != NULL)
+		chunk_free(value);
 }
 
-static inline float perlin_grad(int hash, float x, float y, float z) {
-	int h = hash & 15;
-	float u = h < 8 ? x : y;
-	float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
-	return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+void chunk_dict_delete_all(chunk_dictionary* chunk_dict) {
+	for (size_t i = 0; i < chunk_dict->capacity; i++) {
+		if (chunk_dict->entries[i].value != NULL)
+			chunk_free(chunk_dict->entries[i].value);
+	}
+
+	free(chunk_dict->entries);
+	*chunk_dict = (chunk_dictionary){0};
 }
 
-float perlin_noise_3D(float x, float y, float z) {
-	int X = (int)floor(x) & 255;
-	int Y = (int)floor(y) & 255;
-	int Z = (int)floor(z) & 255;
+void chunk_dict_insert(chunk_dictionary* chunk_dict, world_chunk_pos key, chunk* value) {
+	// keep the table at most half full so probe sequences stay short
+	if ((chunk_dict->count + 1) * 2 > chunk_dict->capacity && !chunk_dict_grow(chunk_dict))
+		return;
 
-	x -= floor(x);
-	y -= floor(y);
-	z -= floor(z);
+	const size_t mask = chunk_dict->capacity - 1;
+	size_t index = chunk_dict_hash(key) & mask;
 
-	float u = perlin_fade(x);
-	float v = perlin_fade(y);
-	float w = perlin_fade(z);
+	for (;;) {
+		chunk_dict_entry* entry = &chunk_dict->entries[index];
+
+		if (entry->value == NULL) {
+			*entry = (chunk_dict_entry){
+				.key = key,
+				.value = value,
+			};
+			chunk_dict->count++;
+			return;
+		}
 
-	int A = ptable[X] + Y;
-	int AA = ptable[A] + Z;
-	int AB = ptable[A + 1] + Z;
-	int B = ptable[X + 1] + Y;
-	int BA = ptable[B] + Z;
-	int BB = ptable[B + 1] + Z;
+		if (chunk_dict_key_equals(entry->key, key)) {
+			entry->value = value;
+			return;
+		}
 
-	return perlin_lerp(w, 
-			perlin_lerp(v,
-				perlin_lerp(u, perlin_grad(ptable[AA], x, y, z), perlin_grad(ptable[BA], x - 1, y, z)),
-			perlin_lerp(u, perlin_grad(ptable[AB], x, y - 1, z), perlin_grad(ptable[BB], x - 1, y - 1, z))),
-			perlin_lerp(v,
-				perlin_lerp(u, perlin_grad(ptable[AA + 1], x, y, z - 1), perlin_grad(ptable[BA + 1], x - 1, y, z - 1)),
-				perlin_lerp(u, perlin_grad(ptable[AB + 1], x, y - 1, z - 1), perlin_grad(ptable[BB + 1], x - 1, y - 1, z - 1))));
+		index = (index + 1) & mask;
+	}
 }
 
-inline float perlin_noise_2D(float x, float y) {
-	return perlin_noise_3D(x, y, 0.0f);
+chunk_dict_entry* chunk_dict_next(chunk_dictionary* chunk_dict, size_t* iterator) {
+	while (*iterator < chunk_dict->capacity) {
+		chunk_dict_entry* entry = &chunk_dict->entries[(*iterator)++];
+
+		if (entry->value != NULL)
+			return entry;
+	}
+
+	return NULL;
 }
 
-// calculate perlin noise value based on chunk_generation_options
-static float chunk_perlin_noise(chunk_generation_options* opts, float x, float z) {
-				float value = 0;
+void for_each_chunk(chunk_dictionary* chunk_dict, void (*func)(world_chunk_pos pos, chunk* chunk, void* args), void* args) {
+	size_t it = 0;
+	chunk_dict_entry* entry;
+
+	while ((entry = chunk_dict_next(chunk_dict, &it)) != NULL)
+		func(entry->key, entry->value, args);
+}
 
-				float amplitude = opts->perlin_amplitude;
-				float frequency = opts->perlin_frequency;
+void for_each_block(chunk* chunk, void (*func)(block* block, void* args), void* args) {
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		if (chunk_section_is_air(&chunk->sections[s]))
+			continue;
 
-				for (unsigned int i = 0; i < opts->octaves; i++) {
-					value += amplitude * perlin_noise_2D(
-							x * frequency + .5f, 
-							z * frequency + .5f
-							);
+		for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
+			for (unsigned int y = s * CHUNK_SECTION_HEIGHT; y < (s + 1) * CHUNK_SECTION_HEIGHT; y++) {
+				for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
 
-					frequency *= 2;
-					amplitude /= 2;
-				}
+					block b = chunk_get_block(chunk, x, y, z);
+					const unsigned int id = b.id;
 
-				// clip value between -1 and 1
-				value = value > 1.0f ? 1.0f : value;
-				value = value < -1.0f ? -1.0f : value;
+					func(&b, args);
 
-				// normalise for positive numbers
-				const float max_val = 10;
-				const float min_val = 5;
-				return min_val + (value + 1.0f) * 0.5f * max_val;
+					if (b.id != id)
+						chunk_set_block(chunk, x, y, z, b);
+				}
+			}
+		}
+	}
 }
 
+
 #include "world.h"
 
 #include <string.h>
-#include <rlgl.h>
 
 void print_matrix(Matrix m) {
 		printf( " %.2f %.2f %.2f %.2f \n"
@@ -252,328 +232,1040 @@ void print_matrix(Matrix m) {
 
 // CHUNK GENERATION
 
-// unless you intend to re-generate the chunk, use world_load_chunk
-chunk* chunk_generate_chunk(chunk_generation_options* opts, chunk_dictionary* chunk_dict, world_chunk_pos pos) {
+chunk* chunk_create(world_chunk_pos pos) {
 	chunk* const chunk = malloc(sizeof(*chunk));
 	if (chunk == NULL) {
 		fprintf(stderr, "Failed to allocate memory for chunk. Chunk locations: %d, %d", pos.x, pos.z);
 		return NULL;
 	}
 
-	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
-	for (unsigned int y = 0; y < WORLD_CHUNK_HEIGHT; y++) {
-	for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
+	// everything starts as air
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		block_storage_init(&chunk->sections[s].blocks, CHUNK_SECTION_BLOCK_COUNT, 0);
+		chunk->sections[s].solid = NULL;
+	}
+
+	chunk->position = pos;
+	atomic_init(&chunk->state, CHUNK_STATE_REQUESTED);
+	atomic_init(&chunk->discarded, false);
+	chunk->dirty = false;
+	chunk->from_region = false;
+	chunk->modified = false;
+	chunk->edited = false;
+	chunk->remeshing = false;
+	chunk->pending_mesh = NULL;
+	chunk->lod = 0;
+	chunk->face_count = 0;
+	chunk->faces = NULL;
+	memset(chunk->face_start, 0, sizeof(chunk->face_start));
+	// see through everything until the mesh says otherwise
+	memset(chunk->section_visibility, 0x3f, sizeof(chunk->section_visibility));
+	chunk->cave_visible = 0;
+	chunk->cave_frame = 0;
+	chunk->mesh_min_y = 0;
+	chunk->mesh_max_y = 0;
+	chunk->last_visible_frame = 0;
+	chunk->arena_offset = 0;
+	chunk->face_capacity = 0;
 
-		Vector3 block_pos = get_block_real_pos(pos, x, y, z);
-		float noise = chunk_perlin_noise(opts, block_pos.x, block_pos.z);
+	return chunk;
+}
 
-		// truncate
-		unsigned int height = floorf(noise);
+// give the chunk's faces in the face arena back. MAIN THREAD ONLY.
+static void chunk_unload_mesh(chunk* chunk) {
+	face_arena_free(chunk->arena_offset, chunk->face_capacity);
 
-		if (y == height) {
-			chunk->blocks[x][y][z].id = 1; // GRASS
-		} else if (y > height) {
-			chunk->blocks[x][y][z].id = 0; // AIR
-		} else {
-			chunk->blocks[x][y][z].id = 2; // STONE
-		}
-	}}}
+	chunk->arena_offset = 0;
+	chunk->face_capacity = 0;
+}
 
-	// get adjacent chunk block id
-	block adjacent_blocks[4][WORLD_CHUNK_WIDTH][WORLD_CHUNK_HEIGHT];
-
-	/* adjacent_blocks[n] layout
-	 *
-	 *  +y  +z
-	 *  |  / 
-	 *  |/___ +x
-	 *             0
-	 *        ___________
-	 *      /           /
-	 * 3  /  CHUNK    /  2
-	 *  /           /
-	 * ------------
-	 *     1
-	 */
-	for (unsigned int i = 0; i < 4; i++) {
-	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
-	for (unsigned int y = 0; y < WORLD_CHUNK_HEIGHT; y++) {
-
-		Vector3 block_pos;
-
-		switch (i) {
-			case (0): // +z
-				block_pos = get_block_real_pos(pos, x, y, WORLD_CHUNK_WIDTH);
-				break;
-			case (1): // -z
-				block_pos = get_block_real_pos(pos, x, y, -1);
-				break;
-			case (2): // +x
-				block_pos = get_block_real_pos(pos, WORLD_CHUNK_WIDTH, y, x);
-				break;
-			case (3): // -x
-				block_pos = get_block_real_pos(pos, -1, y, x);
-				break;
+void chunk_free(chunk* chunk) {
+	if (chunk == NULL)
+		return;
+
+	if (chunk->face_capacity > 0)
+		chunk_unload_mesh(chunk);
+
+	if (chunk->pending_mesh != NULL) {
+		free(chunk->pending_mesh->faces);
+		free(chunk->pending_mesh);
+	}
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		block_storage_free(&chunk->sections[s].blocks);
+		free(chunk->sections[s].solid);
+	}
+
+	free(chunk->faces);
+	free(chunk);
+}
+
+bool chunk_section_update_solid(chunk_section* section) {
+	const block_storage* bs = &section->blocks;
+
+	if (block_storage_is_uniform(bs)) {
+		free(section->solid);
+		section->solid = NULL;
+		return true;
+	}
+
+	if (section->solid == NULL) {
+		section->solid = malloc(sizeof(uint16_t) * WORLD_CHUNK_WIDTH * WORLD_CHUNK_WIDTH);
+
+		if (section->solid == NULL) {
+			fputs("Failed to allocate memory for a chunk section's solid masks\n", stderr);
+			return false;
 		}
+	}
 
-		float noise = chunk_perlin_noise(opts, block_pos.x, block_pos.z);
-		unsigned int height = floorf(noise);
+	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++)
+	for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
+		uint16_t bits = 0;
+
+		for (unsigned int y = 0; y < CHUNK_SECTION_HEIGHT; y++)
+			if (block_storage_get(bs, chunk_section_block_index(x, y, z)) != 0)
+				bits |= 1u << y;
+
+		section->solid[x * WORLD_CHUNK_WIDTH + z] = bits;
+	}
+
+	return true;
+}
+
+bool chunk_update_solid(chunk* chunk) {
+	bool ok = true;
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++)
+		ok &= chunk_section_update_solid(&chunk->sections[s]);
+
+	return ok;
+}
 
-		if (y == height) {
-			adjacent_blocks[i][x][y].id = 1;
-		} else if (y > height) {
-			adjacent_blocks[i][x][y].id = 0;
-		} else {
-			adjacent_blocks[i][x][y].id = 2;
+// block id of the generated terrain at height y in a column of the given height
+static inline unsigned int chunk_terrain_block_id(unsigned int height, unsigned int y) {
+	if (y == height)
+		return 1; // GRASS
+	else if (y > height)
+		return 0; // AIR
+	else
+		return 2; // STONE
+}
+
+void chunk_generate_heightmap(chunk_generation_options* opts, chunk* chunk) {
+	const world_chunk_pos pos = chunk->position;
+
+	// noise only depends on the column, the whole ring is sampled as one grid per octave
+	enum { SIZE = WORLD_CHUNK_WIDTH + 2 };
+
+	float value[SIZE][SIZE] = {0};
+	float octave[SIZE][SIZE];
+	float xs[SIZE], zs[SIZE];
+
+	float amplitude = opts->perlin_amplitude;
+	float frequency = opts->perlin_frequency;
+
+	for (unsigned int o = 0; o < opts->octaves; o++) {
+		for (int i = 0; i < SIZE; i++) {
+			Vector3 block_pos = get_block_real_pos(pos, i - 1, 0, i - 1);
+
+			xs[i] = block_pos.x * frequency + .5f;
+			zs[i] = block_pos.z * frequency + .5f;
 		}
-	}}}
 
-	unsigned int face_count = 0;
-	
-	/* the divide by two is allowed here since if the chunk was filled entirely 
-	 * with blocks there would be no internal faces. The larges number of faces
-	 * would be blocks in a 3D checkerboard pattern, which would be half the
-	 * number of blocks.
-	 */
-	const size_t max_transforms_count = 6 * (WORLD_CHUNK_WIDTH * WORLD_CHUNK_WIDTH * WORLD_CHUNK_HEIGHT)/2;
+		perlin_noise_2D_grid(xs, SIZE, zs, SIZE, &octave[0][0]);
 
-	Matrix* transforms = malloc(sizeof(Matrix) * max_transforms_count);
+		for (int x = 0; x < SIZE; x++)
+			for (int z = 0; z < SIZE; z++)
+				value[x][z] += amplitude * octave[x][z];
 
-	if (transforms == NULL) {
-		fprintf(stderr, "Failed to allocate memory for chunk transforms. Chunk location: %d, %d", pos.x, pos.z);
-		free(chunk);
-		return NULL;
+		frequency *= 2;
+		amplitude /= 2;
 	}
 
-	// generate instance data for chunk
+	for (int x = 0; x < SIZE; x++) {
+	for (int z = 0; z < SIZE; z++) {
+		float v = value[x][z];
+
+		// clip value between -1 and 1
+		v = v > 1.0f ? 1.0f : v;
+		v = v < -1.0f ? -1.0f : v;
+
+		// normalise for positive numbers
+		const float max_val = 10;
+		const float min_val = 5;
+		float noise = min_val + (v + 1.0f) * 0.5f * max_val;
+
+		// truncate, and keep the surface inside the chunk
+		float height = floorf(noise);
+		height = height < 0 ? 0 : height;
+		height = height > WORLD_CHUNK_HEIGHT - 1 ? WORLD_CHUNK_HEIGHT - 1 : height;
+
+		chunk->heightmap[x][z] = height;
+	}}
+}
+
+bool chunk_generate_blocks(chunk_generation_options* opts, chunk* chunk) {
+	TRACE_ZONE("chunk_generate_blocks");
+
+	chunk_generate_heightmap(opts, chunk);
+
+	unsigned int min_height = WORLD_CHUNK_HEIGHT, max_height = 0;
+
 	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
-	for (unsigned int y = 0; y < WORLD_CHUNK_HEIGHT; y++) {
 	for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
-		unsigned int block_id = chunk->blocks[x][y][z].id;
-		if (block_id == 0)
-			continue;
+		unsigned int height = chunk_get_height(chunk, x, z);
 
-#define FACE_FRONT  (1 << 0) // +z
-#define FACE_BACK   (1 << 1) // -z
-#define FACE_LEFT   (1 << 2) // +x
-#define FACE_RIGHT  (1 << 3) // -x
-#define FACE_TOP    (1 << 4) // +y
-#define FACE_BOTTOM (1 << 5) // -y
+		min_height = height < min_height ? height : min_height;
+		max_height = height > max_height ? height : max_height;
+	}}
 
-		unsigned char faces = 0;
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		const unsigned int section_y = s * CHUNK_SECTION_HEIGHT;
+		block_storage* bs = &chunk->sections[s].blocks;
+
+		block_storage_free(bs);
 
-		switch (x) {
-			case (WORLD_CHUNK_WIDTH - 1):
-				faces |= adjacent_blocks[2][z][y].id == 0 ? FACE_LEFT   : 0;
-				faces |= chunk->blocks[x-1][y][z].id == 0 ? FACE_RIGHT  : 0;
-				break;
-			case (0):
-				faces |= adjacent_blocks[3][z][y].id == 0 ? FACE_RIGHT  : 0;
-				faces |= chunk->blocks[x+1][y][z].id == 0 ? FACE_LEFT   : 0;
-				break;
-			default:
-				faces |= chunk->blocks[x+1][y][z].id == 0 ? FACE_LEFT   : 0;
-				faces |= chunk->blocks[x-1][y][z].id == 0 ? FACE_RIGHT  : 0;
+		// above every column, all air
+		if (section_y > max_height) {
+			block_storage_init(bs, CHUNK_SECTION_BLOCK_COUNT, 0);
+			continue;
 		}
 
-		switch (y) {
-			case (WORLD_CHUNK_HEIGHT - 1):
-				faces |= chunk->blocks[x][y-1][z].id == 0 ? FACE_BOTTOM : 0;
-				break;
-			case (0):
-				faces |= chunk->blocks[x][y+1][z].id == 0 ? FACE_TOP    : 0;
-				break;
-			default:
-				faces |= chunk->blocks[x][y+1][z].id == 0 ? FACE_TOP    : 0;
-				faces |= chunk->blocks[x][y-1][z].id == 0 ? FACE_BOTTOM : 0;
+		// below every column's surface, all stone
+		if (section_y + CHUNK_SECTION_HEIGHT - 1 < min_height) {
+			block_storage_init(bs, CHUNK_SECTION_BLOCK_COUNT, 2);
+			continue;
 		}
 
-		switch (z) {
-			case (WORLD_CHUNK_WIDTH - 1):
-				faces |= adjacent_blocks[0][x][y].id == 0 ? FACE_FRONT  : 0;
-				faces |= chunk->blocks[x][y][z-1].id == 0 ? FACE_BACK   : 0;
-				break;
-			case (0):
-				faces |= adjacent_blocks[1][x][y].id == 0 ? FACE_BACK   : 0;
-				faces |= chunk->blocks[x][y][z+1].id == 0 ? FACE_FRONT  : 0;
-				break;
-			default:
-				faces |= chunk->blocks[x][y][z+1].id == 0 ? FACE_FRONT  : 0;
-				faces |= chunk->blocks[x][y][z-1].id == 0 ? FACE_BACK   : 0;
+		// the surface passes through this section, find which ids it holds
+		const unsigned int section_top = section_y + CHUNK_SECTION_HEIGHT - 1;
+		bool has_air = false, has_stone = false, has_grass = false;
+
+		for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
+		for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
+			const unsigned int height = chunk_get_height(chunk, x, z);
+
+			has_air |= height < section_top;
+			has_stone |= height > section_y;
+			has_grass |= height >= section_y && height <= section_top;
+		}}
+
+		// palette index of every terrain id, indexed by chunk_terrain_block_id
+		unsigned int palette[3], slot[3] = {0};
+		unsigned int palette_size = 0;
+
+		if (has_air) {
+			slot[0] = palette_size;
+			palette[palette_size++] = 0;
+		}
+		if (has_stone) {
+			slot[2] = palette_size;
+			palette[palette_size++] = 2;
+		}
+		if (has_grass) {
+			slot[1] = palette_size;
+			palette[palette_size++] = 1;
 		}
 
-		if (faces == 0)
+		if (!block_storage_init_palette(bs, CHUNK_SECTION_BLOCK_COUNT, palette, palette_size))
+			return false;
+
+		if (block_storage_is_uniform(bs))
 			continue;
 
-		// translate the top face to the cube faces
-		Matrix t, r, res;
+		/* blocks are indexed (x * 16 + y) * 16 + z, so the 16 blocks
+		 * along z at one x and y are a run of bits in a single word,
+		 * built whole and stored at once
+		 */
+		const unsigned int bits = bs->bits_per_block;
 
-		if (faces & FACE_FRONT) {
-			t = MatrixTranslate(x + .5, y - .5, z + 1);
-			r = MatrixRotateX(PI/2);
-			res = MatrixMultiply(r, t);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
-		}
-		
-		if (faces & FACE_BACK) {
-			t = MatrixTranslate(x + .5, y - .5, z);
-			r = MatrixRotateX(-PI/2);
-			res = MatrixMultiply(r, t);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
+		for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
+		for (unsigned int y = section_y; y <= section_top; y++) {
+			uint64_t run = 0;
+
+			for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++)
+				run |= (uint64_t)slot[chunk_terrain_block_id(chunk_get_height(chunk, x, z), y)] << (z * bits);
+
+			const unsigned int bit = chunk_section_block_index(x, y, 0) * bits;
+			bs->data[bit >> 6] |= run << (bit & 63);
+		}}
+	}
+
+	// solid masks for every section at once, now that the blocks are in
+	chunk_update_solid(chunk);
+	chunk_set_state(chunk, CHUNK_STATE_GENERATED);
+
+	return true;
+}
+
+// chunk_mesh_grid.masks bits, one per chunk_face_direction
+#define FACE_FRONT  (1 << FACE_DIR_FRONT)  // +z
+#define FACE_BACK   (1 << FACE_DIR_BACK)   // -z
+#define FACE_LEFT   (1 << FACE_DIR_LEFT)   // +x
+#define FACE_RIGHT  (1 << FACE_DIR_RIGHT)  // -x
+#define FACE_TOP    (1 << FACE_DIR_TOP)    // +y
+#define FACE_BOTTOM (1 << FACE_DIR_BOTTOM) // -y
+
+/* What the meshers work from: the chunk as a grid of cells with
+ * the faces of each cell that are exposed to air. At full detail
+ * a cell is one block, at level of detail n it is a cube of
+ * 1 << n blocks. Cells are laid out [x][y][z] like the chunk.
+ * ids is only valid where masks is not 0.
+ */
+typedef struct {
+	unsigned int scale;  // blocks along each side of a cell
+	unsigned int width;  // cells along x and z
+	unsigned int height; // cells along y
+	unsigned char masks[WORLD_CHUNK_WIDTH * WORLD_CHUNK_HEIGHT * WORLD_CHUNK_WIDTH];
+	unsigned char ids[WORLD_CHUNK_WIDTH * WORLD_CHUNK_HEIGHT * WORLD_CHUNK_WIDTH];
+} chunk_mesh_grid;
+
+static inline unsigned int chunk_mesh_cell(const chunk_mesh_grid* grid, unsigned int x, unsigned int y, unsigned int z) {
+	return (x * grid->height + y) * grid->width + z;
+}
+
+/* Face d of the w by h cells from cell (x, y, z), in blocks.
+ * Faces on the positive side of a cell belong to its last block.
+ */
+static inline chunk_face chunk_mesh_face(const chunk_mesh_grid* grid, unsigned int x, unsigned int y, unsigned int z,
+		unsigned int d, unsigned int w, unsigned int h, unsigned int id) {
+	const unsigned int s = grid->scale;
+
+	return (chunk_face){
+		.x = x * s + (d == FACE_DIR_LEFT ? s - 1 : 0),
+		.y = y * s + (d == FACE_DIR_TOP ? s - 1 : 0),
+		.z = z * s + (d == FACE_DIR_FRONT ? s - 1 : 0),
+		.direction = d,
+		.width = w * s,
+		.height = h * s,
+		.block_id = id,
+	};
+}
+
+// one instance per visible cell face
+static unsigned int chunk_mesh_naive(const chunk* chunk, const chunk_mesh_grid* grid, chunk_face* faces) {
+	unsigned int face_count = 0;
+	const unsigned int section_height = CHUNK_SECTION_HEIGHT / grid->scale;
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		if (chunk_section_is_air(&chunk->sections[s]))
+			continue;
+
+		for (unsigned int x = 0; x < grid->width; x++) {
+		for (unsigned int y = s * section_height; y < (s + 1) * section_height; y++) {
+		for (unsigned int z = 0; z < grid->width; z++) {
+			const unsigned int cell = chunk_mesh_cell(grid, x, y, z);
+			unsigned char mask = grid->masks[cell];
+
+			if (mask == 0)
+				continue;
+
+			for (unsigned int d = 0; d < 6; d++) {
+				if (!(mask & (1 << d)))
+					continue;
+
+				faces[face_count++] = chunk_mesh_face(grid, x, y, z, d, 1, 1, grid->ids[cell]);
+			}
+		}}}
+	}
+
+	return face_count;
+}
+
+/* Merges coplanar faces of the same block into larger quads.
+ * Each section is meshed on its own, so quads never cross a
+ * section boundary. Each face direction is swept one slice of
+ * cells at a time, the visible faces in a slice are collected
+ * into a 2D mask of block ids and then covered with as few
+ * rectangles as possible.
+ * See chunk_face for which axes width and height run along.
+ */
+static unsigned int chunk_mesh_greedy(const chunk* chunk, const chunk_mesh_grid* grid, chunk_face* faces) {
+	unsigned int face_count = 0;
+	const unsigned int section_height = CHUNK_SECTION_HEIGHT / grid->scale;
+
+	// a slice of a section is at most 16x16 cells
+	unsigned int mask[WORLD_CHUNK_WIDTH * CHUNK_SECTION_HEIGHT];
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		if (chunk_section_is_air(&chunk->sections[s]))
+			continue;
+
+		const unsigned int section_y = s * section_height;
+
+		for (unsigned int d = 0; d < 6; d++) {
+			const unsigned char face = 1 << d;
+
+			// slices are taken along the face normal
+			unsigned int slices, width, height;
+
+			switch (face) {
+				case (FACE_TOP):
+				case (FACE_BOTTOM):
+					slices = section_height;
+					width = grid->width;  // x
+					height = grid->width; // z
+					break;
+				case (FACE_FRONT):
+				case (FACE_BACK):
+					slices = grid->width;
+					width = grid->width;     // x
+					height = section_height; // y
+					break;
+				default:
+					slices = grid->width;
+					width = grid->width;     // z
+					height = section_height; // y
+			}
+
+			for (unsigned int slice = 0; slice < slices; slice++) {
+				bool slice_empty = true;
+
+				// build the mask, 0 means no face
+				for (unsigned int v = 0; v < height; v++) {
+				for (unsigned int u = 0; u < width; u++) {
+					unsigned int x, y, z;
+
+					switch (face) {
+						case (FACE_TOP):
+						case (FACE_BOTTOM):
+							x = u; y = section_y + slice; z = v;
+							break;
+						case (FACE_FRONT):
+						case (FACE_BACK):
+							x = u; y = section_y + v; z = slice;
+							break;
+						default:
+							x = slice; y = section_y + v; z = u;
+					}
+
+					const unsigned int cell = chunk_mesh_cell(grid, x, y, z);
+					unsigned int id = grid->masks[cell] & face ? grid->ids[cell] : 0;
+					mask[v * width + u] = id;
+					slice_empty &= id == 0;
+				}}
+
+				if (slice_empty)
+					continue;
+
+				// cover the mask with rectangles
+				for (unsigned int v = 0; v < height; v++) {
+				for (unsigned int u = 0; u < width;) {
+					unsigned int id = mask[v * width + u];
+
+					if (id == 0) {
+						u++;
+						continue;
+					}
+
+					// grow along u
+					unsigned int w = 1;
+					while (u + w < width && mask[v * width + u + w] == id)
+						w++;
+
+					// grow along v while the whole row matches
+					unsigned int h = 1;
+					for (; v + h < height; h++) {
+						bool row_matches = true;
+
+						for (unsigned int i = 0; i < w; i++) {
+							if (mask[(v + h) * width + u + i] != id) {
+								row_matches = false;
+								break;
+							}
+						}
+
+						if (!row_matches)
+							break;
+					}
+
+					// clear the covered faces so they are not emitted again
+					for (unsigned int j = 0; j < h; j++)
+						for (unsigned int i = 0; i < w; i++)
+							mask[(v + j) * width + u + i] = 0;
+
+					switch (face) {
+						case (FACE_TOP):
+						case (FACE_BOTTOM):
+							faces[face_count++] = chunk_mesh_face(grid, u, section_y + slice, v, d, w, h, id);
+							break;
+						case (FACE_FRONT):
+						case (FACE_BACK):
+							faces[face_count++] = chunk_mesh_face(grid, u, section_y + v, slice, d, w, h, id);
+							break;
+						default:
+							faces[face_count++] = chunk_mesh_face(grid, slice, section_y + v, u, d, w, h, id);
+					}
+
+					u += w;
+				}}
+			}
 		}
-		
-		if (faces & FACE_LEFT) {
-			t = MatrixTranslate(x + 1, y - .5, z + .5);
-			r = MatrixRotateZ(-PI/2);
-			res = MatrixMultiply(r, t);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
+	}
+
+	return face_count;
+}
+
+/* Blocks just outside the chunk come from the neighbour on that
+ * side if there is one, the heightmap ring otherwise.
+ * Exactly one of x and z is outside the chunk.
+ */
+static inline bool chunk_border_is_air(const chunk* chunk, const chunk_neighbours* neighbours, int x, unsigned int y, int z) {
+	if (neighbours != NULL) {
+		chunk_face_direction side;
+
+		if (x == WORLD_CHUNK_WIDTH)
+			side = FACE_DIR_LEFT;
+		else if (x < 0)
+			side = FACE_DIR_RIGHT;
+		else if (z == WORLD_CHUNK_WIDTH)
+			side = FACE_DIR_FRONT;
+		else
+			side = FACE_DIR_BACK;
+
+		if (neighbours->sides[side] != NULL) {
+			return chunk_get_block(neighbours->sides[side],
+					(x + WORLD_CHUNK_WIDTH) % WORLD_CHUNK_WIDTH,
+					y,
+					(z + WORLD_CHUNK_WIDTH) % WORLD_CHUNK_WIDTH).id == 0;
 		}
+	}
+
+	return chunk_terrain_block_id(chunk_get_height(chunk, x, z), y) == 0;
+}
+
+// x, y, z step across each chunk_face_direction
+static const int CHUNK_FACE_STEPS[6][3] = {
+	{ 0, 0, 1 }, { 0, 0, -1 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 },
+};
+
+/* Flood fill the air of the section from each of its outside
+ * blocks, every face a pocket of air touches can see every other
+ * face it touches. Pockets that touch no face do not matter, so
+ * fills only start from the outside.
+ */
+void chunk_section_build_visibility(const chunk_section* section, unsigned char visibility[6]) {
+	if (block_storage_is_uniform(&section->blocks)) {
+		const unsigned char all = section->blocks.uniform_id == 0 ? 0x3f : 0;
+
+		for (unsigned int f = 0; f < 6; f++)
+			visibility[f] = all;
+		return;
+	}
+
+	memset(visibility, 0, 6);
+
+	// blocks are indexed (x * 16 + z) * 16 + y, seen holds air already filled and solid blocks
+	uint16_t seen[WORLD_CHUNK_WIDTH * WORLD_CHUNK_WIDTH];
+	uint16_t stack[CHUNK_SECTION_BLOCK_COUNT];
+
+	for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++)
+		for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++)
+			seen[x * WORLD_CHUNK_WIDTH + z] = chunk_section_solid_column(section, x, z);
+
+	const unsigned int last = WORLD_CHUNK_WIDTH - 1;
+	const unsigned int top = CHUNK_SECTION_HEIGHT - 1;
+
+	for (unsigned int start = 0; start < CHUNK_SECTION_BLOCK_COUNT; start++) {
+		const unsigned int sx = start / (WORLD_CHUNK_WIDTH * CHUNK_SECTION_HEIGHT);
+		const unsigned int sz = start / CHUNK_SECTION_HEIGHT % WORLD_CHUNK_WIDTH;
+		const unsigned int sy = start % CHUNK_SECTION_HEIGHT;
+
+		if (sx != 0 && sx != last && sz != 0 && sz != last && sy != 0 && sy != top)
+			continue;
+		if (seen[sx * WORLD_CHUNK_WIDTH + sz] & (1u << sy))
+			continue;
+
+		unsigned char touched = 0;
+		unsigned int count = 0;
+
+		seen[sx * WORLD_CHUNK_WIDTH + sz] |= 1u << sy;
+		stack[count++] = start;
+
+		while (count > 0) {
+			const unsigned int i = stack[--count];
+			const unsigned int x = i / (WORLD_CHUNK_WIDTH * CHUNK_SECTION_HEIGHT);
+			const unsigned int z = i / CHUNK_SECTION_HEIGHT % WORLD_CHUNK_WIDTH;
+			const unsigned int y = i % CHUNK_SECTION_HEIGHT;
+
+			touched |= (z == last ? FACE_FRONT : 0) | (z == 0 ? FACE_BACK : 0)
+				| (x == last ? FACE_LEFT : 0) | (x == 0 ? FACE_RIGHT : 0)
+				| (y == top ? FACE_TOP : 0) | (y == 0 ? FACE_BOTTOM : 0);
 
-		if (faces & FACE_RIGHT) {
-			t = MatrixTranslate(x, y - .5, z + .5);
-			r = MatrixRotateZ(PI/2);
-			res = MatrixMultiply(r, t);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
+			for (unsigned int n = 0; n < 6; n++) {
+				const unsigned int nx = x + CHUNK_FACE_STEPS[n][0];
+				const unsigned int ny = y + CHUNK_FACE_STEPS[n][1];
+				const unsigned int nz = z + CHUNK_FACE_STEPS[n][2];
+
+				// unsigned, so -1 wraps past the end too
+				if (nx > last || nz > last || ny > top)
+					continue;
+
+				uint16_t* column = &seen[nx * WORLD_CHUNK_WIDTH + nz];
+				if (*column & (1u << ny))
+					continue;
+
+				*column |= 1u << ny;
+				stack[count++] = (nx * WORLD_CHUNK_WIDTH + nz) * CHUNK_SECTION_HEIGHT + ny;
+			}
 		}
 
-		if (faces & FACE_TOP) {
-			res = MatrixTranslate(x + .5, y, z + .5);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
+		for (unsigned int f = 0; f < 6; f++)
+			if (touched & (1 << f))
+				visibility[f] |= touched;
+	}
+}
+
+/* Full detail cells, one per block. neighbours (or the heightmap)
+ * decide which faces on the chunk's sides are exposed.
+ */
+static void chunk_mesh_grid_fill(const chunk* chunk, const chunk_neighbours* neighbours, chunk_mesh_grid* grid) {
+	grid->scale = 1;
+	grid->width = WORLD_CHUNK_WIDTH;
+	grid->height = WORLD_CHUNK_HEIGHT;
+
+	// find which faces of each block are exposed to air
+	memset(grid->masks, 0, sizeof(grid->masks));
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		const chunk_section* section = &chunk->sections[s];
+
+		// nothing to draw in a section of air
+		if (chunk_section_is_air(section))
+			continue;
+
+		// in a section that is one solid block only the outer shell can have faces
+		const bool section_solid = block_storage_is_uniform(&section->blocks);
+
+		for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
+		for (unsigned int y = s * CHUNK_SECTION_HEIGHT; y < (s + 1) * CHUNK_SECTION_HEIGHT; y++) {
+		for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
+			if (section_solid &&
+					x != 0 && x != WORLD_CHUNK_WIDTH - 1 &&
+					z != 0 && z != WORLD_CHUNK_WIDTH - 1 &&
+					y % CHUNK_SECTION_HEIGHT != 0 && y % CHUNK_SECTION_HEIGHT != CHUNK_SECTION_HEIGHT - 1)
+				continue;
+
+			unsigned int block_id = chunk_get_block(chunk, x, y, z).id;
+			if (block_id == 0)
+				continue;
+
+			unsigned char faces = 0;
+
+			switch (x) {
+				case (WORLD_CHUNK_WIDTH - 1):
+					faces |= chunk_border_is_air(chunk, neighbours, WORLD_CHUNK_WIDTH, y, z) ? FACE_LEFT   : 0;
+					faces |= chunk_get_block(chunk, x-1, y, z).id == 0 ? FACE_RIGHT  : 0;
+					break;
+				case (0):
+					faces |= chunk_border_is_air(chunk, neighbours, -1, y, z) ? FACE_RIGHT  : 0;
+					faces |= chunk_get_block(chunk, x+1, y, z).id == 0 ? FACE_LEFT   : 0;
+					break;
+				default:
+					faces |= chunk_get_block(chunk, x+1, y, z).id == 0 ? FACE_LEFT   : 0;
+					faces |= chunk_get_block(chunk, x-1, y, z).id == 0 ? FACE_RIGHT  : 0;
+			}
+
+			switch (y) {
+				case (WORLD_CHUNK_HEIGHT - 1):
+					faces |= chunk_get_block(chunk, x, y-1, z).id == 0 ? FACE_BOTTOM : 0;
+					break;
+				case (0):
+					faces |= chunk_get_block(chunk, x, y+1, z).id == 0 ? FACE_TOP    : 0;
+					break;
+				default:
+					faces |= chunk_get_block(chunk, x, y+1, z).id == 0 ? FACE_TOP    : 0;
+					faces |= chunk_get_block(chunk, x, y-1, z).id == 0 ? FACE_BOTTOM : 0;
+			}
+
+			switch (z) {
+				case (WORLD_CHUNK_WIDTH - 1):
+					faces |= chunk_border_is_air(chunk, neighbours, x, y, WORLD_CHUNK_WIDTH) ? FACE_FRONT  : 0;
+					faces |= chunk_get_block(chunk, x, y, z-1).id == 0 ? FACE_BACK   : 0;
+					break;
+				case (0):
+					faces |= chunk_border_is_air(chunk, neighbours, x, y, -1) ? FACE_BACK   : 0;
+					faces |= chunk_get_block(chunk, x, y, z+1).id == 0 ? FACE_FRONT  : 0;
+					break;
+				default:
+					faces |= chunk_get_block(chunk, x, y, z+1).id == 0 ? FACE_FRONT  : 0;
+					faces |= chunk_get_block(chunk, x, y, z-1).id == 0 ? FACE_BACK   : 0;
+			}
+
+			const unsigned int cell = chunk_mesh_cell(grid, x, y, z);
+			grid->masks[cell] = faces;
+			grid->ids[cell] = block_id;
+		}}}
+	}
+}
+
+/* Cells of 1 << lod blocks for a level of detail mesh. A cell is
+ * solid if any of its blocks is and takes the id of its highest
+ * block, so the coarse terrain never dips below the real terrain
+ * and grass stays on top.
+ * Faces on the chunk's sides are always exposed. They hang down
+ * as skirts under the coarse surface and cover the gaps against
+ * neighbours meshed at other levels, which are never lower than
+ * their real terrain either.
+ */
+static void chunk_mesh_grid_downsample(const chunk* chunk, unsigned int lod, chunk_mesh_grid* grid) {
+	const unsigned int s = 1u << lod;
+
+	grid->scale = s;
+	grid->width = WORLD_CHUNK_WIDTH / s;
+	grid->height = WORLD_CHUNK_HEIGHT / s;
+
+	const unsigned int section_height = CHUNK_SECTION_HEIGHT / s;
+	const unsigned int last = grid->width - 1;
+
+	memset(grid->ids, 0, grid->width * grid->height * grid->width);
+
+	for (unsigned int section = 0; section < CHUNK_SECTION_COUNT; section++) {
+		const chunk_section* sec = &chunk->sections[section];
+
+		if (chunk_section_is_air(sec))
+			continue;
+
+		const unsigned int first = section * section_height;
+
+		if (block_storage_is_uniform(&sec->blocks)) {
+			for (unsigned int x = 0; x < grid->width; x++)
+				for (unsigned int y = first; y < first + section_height; y++)
+					memset(&grid->ids[chunk_mesh_cell(grid, x, y, 0)], sec->blocks.uniform_id, grid->width);
+			continue;
 		}
 
-		if (faces & FACE_BOTTOM) {
-			t = MatrixTranslate(x + .5, y - 1, z + .5);
-			r = MatrixRotateX(PI);
-			res = MatrixMultiply(r, t);
-			memcpy(transforms + face_count++, &res, sizeof(Matrix));
+		// going up, so the last block written to a cell is its highest
+		for (unsigned int y = section * CHUNK_SECTION_HEIGHT; y < (section + 1) * CHUNK_SECTION_HEIGHT; y++) {
+		for (unsigned int x = 0; x < WORLD_CHUNK_WIDTH; x++) {
+		for (unsigned int z = 0; z < WORLD_CHUNK_WIDTH; z++) {
+			const unsigned int id = chunk_get_block(chunk, x, y, z).id;
+
+			if (id != 0)
+				grid->ids[chunk_mesh_cell(grid, x / s, y / s, z / s)] = id;
+		}}}
+	}
+
+	for (unsigned int x = 0; x < grid->width; x++) {
+	for (unsigned int y = 0; y < grid->height; y++) {
+	for (unsigned int z = 0; z < grid->width; z++) {
+		const unsigned int cell = chunk_mesh_cell(grid, x, y, z);
+		unsigned char faces = 0;
+
+		if (grid->ids[cell] != 0) {
+			faces |= x == last || grid->ids[chunk_mesh_cell(grid, x + 1, y, z)] == 0 ? FACE_LEFT  : 0;
+			faces |= x == 0    || grid->ids[chunk_mesh_cell(grid, x - 1, y, z)] == 0 ? FACE_RIGHT : 0;
+			faces |= z == last || grid->ids[chunk_mesh_cell(grid, x, y, z + 1)] == 0 ? FACE_FRONT : 0;
+			faces |= z == 0    || grid->ids[chunk_mesh_cell(grid, x, y, z - 1)] == 0 ? FACE_BACK  : 0;
+
+			// like full detail, nothing above the top or below the bottom of the world
+			if (y + 1 < grid->height && grid->ids[chunk_mesh_cell(grid, x, y + 1, z)] == 0)
+				faces |= FACE_TOP;
+			if (y > 0 && grid->ids[chunk_mesh_cell(grid, x, y - 1, z)] == 0)
+				faces |= FACE_BOTTOM;
 		}
+
+		grid->masks[cell] = faces;
 	}}}
+}
+
+bool chunk_mesh_build(chunk_generation_options* opts, const chunk* chunk, unsigned int lod, const chunk_neighbours* neighbours, chunk_mesh* mesh) {
+	TRACE_ZONE("chunk_mesh_build");
+
+	const world_chunk_pos pos = chunk->position;
+
+	unsigned int face_count = 0;
 
-	// shrink allocation to fit data
-	transforms = realloc(transforms, face_count * sizeof(Matrix));
+	chunk_mesh_grid grid;
+
+	if (lod == 0)
+		chunk_mesh_grid_fill(chunk, neighbours, &grid);
+	else
+		chunk_mesh_grid_downsample(chunk, lod, &grid);
+
+	const size_t cell_count = (size_t)grid.width * grid.height * grid.width;
+
+	/* the divide by two is allowed here since if the chunk was filled entirely 
+	 * with blocks there would be no internal faces. The larges number of faces
+	 * would be blocks in a 3D checkerboard pattern, which would be half the
+	 * number of blocks.
+	 * Level of detail skirts expose the sides as well, so those are not
+	 * halved, their grids are small anyway.
+	 */
+	const size_t max_face_count = lod == 0 ? 6 * cell_count / 2 : 6 * cell_count;
+
+	chunk_face* unsorted = malloc(sizeof(chunk_face) * max_face_count);
+
+	if (unsorted == NULL) {
+		fprintf(stderr, "Failed to allocate memory for chunk faces. Chunk location: %d, %d", pos.x, pos.z);
+		return false;
+	}
+
+	if (opts->mesher == CHUNK_MESHER_GREEDY)
+		face_count = chunk_mesh_greedy(chunk, &grid, unsorted);
+	else
+		face_count = chunk_mesh_naive(chunk, &grid, unsorted);
+
+	/* sort the faces by direction, then section, so the renderer can
+	 * leave out every direction that faces away from the camera.
+	 * Faces never cross a section, the first block's y places them.
+	 */
+	unsigned int face_start[CHUNK_FACE_BUCKET_COUNT + 1] = {0};
 
 	for (unsigned int i = 0; i < face_count; i++)
-		transforms[i] = MatrixMultiply(transforms[i], MatrixTranslate(pos.x * WORLD_CHUNK_WIDTH, 0, pos.z * WORLD_CHUNK_WIDTH));
+		face_start[chunk_face_bucket(unsorted[i].direction, unsorted[i].y / CHUNK_SECTION_HEIGHT) + 1]++;
 
-	chunk->face_count = face_count;
-	chunk->transforms = transforms;
-	chunk->face_mesh = GenMeshPlane(1,1,1,1);
+	for (unsigned int b = 0; b < CHUNK_FACE_BUCKET_COUNT; b++)
+		face_start[b + 1] += face_start[b];
 
-	chunk_dict_insert(chunk_dict, pos, chunk);
+	// sorting into an allocation that fits also drops the space the mesher did not use
+	chunk_face* faces = face_count > 0 ? malloc(sizeof(chunk_face) * face_count) : NULL;
 
-	return chunk;
+	if (face_count > 0 && faces == NULL) {
+		fprintf(stderr, "Failed to allocate memory for chunk faces. Chunk location: %d, %d", pos.x, pos.z);
+		free(unsorted);
+		return false;
+	}
+
+	unsigned int next[CHUNK_FACE_BUCKET_COUNT];
+	memcpy(next, face_start, sizeof(next));
+
+	for (unsigned int i = 0; i < face_count; i++)
+		faces[next[chunk_face_bucket(unsorted[i].direction, unsorted[i].y / CHUNK_SECTION_HEIGHT)]++] = unsorted[i];
+
+	free(unsorted);
+
+	// vertical extent of the mesh, so culling can use a tight box
+	unsigned int min_y = WORLD_CHUNK_HEIGHT, max_y = 0;
+
+	for (unsigned int i = 0; i < face_count; i++) {
+		const chunk_face f = faces[i];
+		const bool vertical = f.direction != FACE_DIR_TOP && f.direction != FACE_DIR_BOTTOM;
+		const unsigned int top = vertical ? f.y + f.height - 1 : f.y;
+
+		min_y = f.y < min_y ? f.y : min_y;
+		max_y = top > max_y ? top : max_y;
+	}
+
+	mesh->lod = lod;
+	mesh->face_count = face_count;
+	mesh->faces = faces;
+	memcpy(mesh->face_start, face_start, sizeof(face_start));
+
+	// coarse meshes are past where cave culling stops, they count as open
+	if (lod == 0) {
+		for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++)
+			chunk_section_build_visibility(&chunk->sections[s], mesh->section_visibility[s]);
+	} else
+		memset(mesh->section_visibility, 0x3f, sizeof(mesh->section_visibility));
+
+	// block y spans [y - 1, y] in world space
+	mesh->mesh_min_y = face_count ? (float)min_y - 1 : 0;
+	mesh->mesh_max_y = face_count ? (float)max_y : 0;
+
+	return true;
 }
 
-static bool is_box_in_frustum(Vector4 planes[6], Vector3 min, Vector3 max) {
-	for (unsigned int i = 0; i < 6; i++) {
-		Vector4 p = planes[i];
+void chunk_mesh_apply(chunk* chunk, chunk_mesh* mesh) {
+	free(chunk->faces);
+	chunk->lod = mesh->lod;
+	chunk->face_count = mesh->face_count;
+	chunk->faces = mesh->faces;
+	memcpy(chunk->face_start, mesh->face_start, sizeof(chunk->face_start));
+	memcpy(chunk->section_visibility, mesh->section_visibility, sizeof(chunk->section_visibility));
+	chunk->mesh_min_y = mesh->mesh_min_y;
+	chunk->mesh_max_y = mesh->mesh_max_y;
+
+	mesh->face_count = 0;
+	mesh->faces = NULL;
+
+	chunk_set_state(chunk, CHUNK_STATE_MESHED);
+}
+
+bool chunk_build_mesh(chunk_generation_options* opts, chunk* chunk, const chunk_neighbours* neighbours) {
+	chunk_mesh mesh;
+
+	if (!chunk_mesh_build(opts, chunk, chunk->lod, neighbours, &mesh))
+		return false;
+
+	chunk_mesh_apply(chunk, &mesh);
+
+	return true;
+}
+
+// see chunk_take_uploaded_bytes
+static size_t CHUNK_UPLOADED_BYTES = 0;
+
+void chunk_upload_mesh(chunk* chunk) {
+	// a remeshed chunk whose faces still fit keeps its range
+	if (chunk->face_count > chunk->face_capacity || chunk->face_count == 0) {
+		// edited chunks tend to grow again, leave them some room
+		const bool remeshed = chunk->face_capacity != 0;
+		const unsigned int capacity = remeshed ? chunk->face_count + chunk->face_count / 4 : chunk->face_count;
 
-		Vector3 positive = {
-			(p.x >= 0) ? max.x : min.x,
-			(p.y >= 0) ? max.y : min.y,
-			(p.z >= 0) ? max.z : min.z,
-		};
+		chunk_unload_mesh(chunk);
 
-		if ((
-			p.x * positive.x + 
-			p.y * positive.y + 
-			p.z * positive.z +
-			p.w
-			) < 0)
-			return false; // box is outside of the frustum
+		if (capacity > 0 && face_arena_alloc(capacity, &chunk->arena_offset))
+			chunk->face_capacity = capacity;
 	}
-	return true; // box is inside or intesects the frustum
+
+	// without a range the chunk is not drawn, see chunk_render_chunk
+	if (chunk->face_capacity > 0) {
+		face_arena_write(chunk->arena_offset, chunk->position, chunk->faces, chunk->face_count);
+		CHUNK_UPLOADED_BYTES += chunk->face_count * sizeof(face_arena_face);
+	}
+
+	chunk_set_state(chunk, CHUNK_STATE_UPLOADED);
 }
 
-static void create_frustum_planes(Matrix viewp_matrix, Vector4* fplanes) {
+size_t chunk_take_uploaded_bytes(void) {
+	const size_t bytes = CHUNK_UPLOADED_BYTES;
+	CHUNK_UPLOADED_BYTES = 0;
+	return bytes;
+}
 
-	// left plane
-	fplanes[0].x = viewp_matrix.m3  + viewp_matrix.m0;
-	fplanes[0].y = viewp_matrix.m7  + viewp_matrix.m4;
-	fplanes[0].z = viewp_matrix.m11 + viewp_matrix.m8;
-	fplanes[0].w = viewp_matrix.m15 + viewp_matrix.m12;
+size_t chunk_memory_usage(const chunk* chunk) {
+	size_t bytes = sizeof(*chunk) + sizeof(chunk_face) * chunk->face_count;
 
-	// right plane
-	fplanes[1].x = viewp_matrix.m3  - viewp_matrix.m0;
-	fplanes[1].y = viewp_matrix.m7  - viewp_matrix.m4;
-	fplanes[1].z = viewp_matrix.m11 - viewp_matrix.m8;
-	fplanes[1].w = viewp_matrix.m15 - viewp_matrix.m12;
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		bytes += block_storage_memory(&chunk->sections[s].blocks);
 
-	// top plane
-	fplanes[2].x = viewp_matrix.m3  - viewp_matrix.m1;
-	fplanes[2].y = viewp_matrix.m7  - viewp_matrix.m5;
-	fplanes[2].z = viewp_matrix.m11 - viewp_matrix.m9;
-	fplanes[2].w = viewp_matrix.m15 - viewp_matrix.m13;
+		if (chunk->sections[s].solid != NULL)
+			bytes += sizeof(uint16_t) * WORLD_CHUNK_WIDTH * WORLD_CHUNK_WIDTH;
+	}
 
-	// bottom plane
-	fplanes[3].x = viewp_matrix.m3  + viewp_matrix.m1;
-	fplanes[3].y = viewp_matrix.m7  + viewp_matrix.m5;
-	fplanes[3].z = viewp_matrix.m11 + viewp_matrix.m9;
-	fplanes[3].w = viewp_matrix.m15 + viewp_matrix.m13;
+	// the face arena keeps its own copy of the faces
+	bytes += sizeof(face_arena_face) * chunk->face_capacity;
 
-	// near plane
-	fplanes[4].x = viewp_matrix.m3  + viewp_matrix.m2;
-	fplanes[4].y = viewp_matrix.m7  + viewp_matrix.m6;
-	fplanes[4].z = viewp_matrix.m11 + viewp_matrix.m10;
-	fplanes[4].w = viewp_matrix.m15 + viewp_matrix.m14;
+	return bytes;
+}
 
-	// far plane
-	fplanes[5].x = viewp_matrix.m3  - viewp_matrix.m2;
-	fplanes[5].y = viewp_matrix.m7  - viewp_matrix.m6;
-	fplanes[5].z = viewp_matrix.m11 - viewp_matrix.m10;
-	fplanes[5].w = viewp_matrix.m15 - viewp_matrix.m14;
+// unless you intend to re-generate the chunk, use world_load_chunk
+chunk* chunk_generate_chunk(chunk_generation_options* opts, chunk_dictionary* chunk_dict, world_chunk_pos pos) {
+	TRACE_ZONE("chunk_generate_chunk");
 
-	// normalise frustum planes
-	for (unsigned int i = 0; i < 6; i++) {
-		// Quaternions are Vector4s so this is acceptable
-		QuaternionNormalize(fplanes[i]);
+	chunk* const chunk = chunk_create(pos);
+	if (chunk == NULL)
+		return NULL;
+
+	if (!chunk_generate_blocks(opts, chunk) || !chunk_build_mesh(opts, chunk, NULL)) {
+		chunk_free(chunk);
+		return NULL;
 	}
+
+	chunk_upload_mesh(chunk);
+	chunk_dict_insert(chunk_dict, pos, chunk);
+
+	return chunk;
 }
 
 // CHUNK RENDERING
-void chunk_render_chunk(world_chunk_pos pos, chunk* chunk, Camera3D* camera, Shader shader) {
+
+// ranges of the face arena queued by chunk_render_chunk this frame
+static struct {
+	face_arena_range* ranges;
+	size_t count;
+	size_t capacity;
+	Vector3 camera; // position, for chunk_facing_directions
+} CHUNK_DRAWS = {0};
+
+/* Directions (bit d for chunk_face_direction d) of the faces in
+ * the chunk that can face the camera. A face is seen from the
+ * side its normal points to, so when the camera is past the
+ * chunk's bounds on one side no face pointing the other way can
+ * be seen.
+ */
+static unsigned int chunk_facing_directions(world_chunk_pos pos, const chunk* chunk) {
+	const Vector3 camera = CHUNK_DRAWS.camera;
+	const float min_x = pos.x * WORLD_CHUNK_WIDTH, max_x = min_x + WORLD_CHUNK_WIDTH;
+	const float min_z = pos.z * WORLD_CHUNK_WIDTH, max_z = min_z + WORLD_CHUNK_WIDTH;
+	unsigned int directions = 0x3f;
+
+	if (camera.z <= min_z)
+		directions &= ~FACE_FRONT;
+	if (camera.z >= max_z)
+		directions &= ~FACE_BACK;
+	if (camera.x <= min_x)
+		directions &= ~FACE_LEFT;
+	if (camera.x >= max_x)
+		directions &= ~FACE_RIGHT;
+	if (camera.y <= chunk->mesh_min_y)
+		directions &= ~FACE_TOP;
+	if (camera.y >= chunk->mesh_max_y)
+		directions &= ~FACE_BOTTOM;
+
+	return directions;
+}
+
+void chunk_render_begin(Camera3D* camera, Shader shader) {
+	float cam_pos[3] = {camera->position.x, camera->position.y, camera->position.z};
+	Matrix mvp = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+
+	// the vertex shader expands each packed face into a quad
+	rlEnableShader(shader.id);
+	rlSetUniform(shader.locs[SHADER_LOC_VECTOR_VIEW], cam_pos, RL_SHADER_UNIFORM_VEC3, 1);
+	rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], mvp);
+
+	CHUNK_DRAWS.camera = camera->position;
+}
+
+static void chunk_render_queue(unsigned int first, unsigned int count) {
+	if (CHUNK_DRAWS.count == CHUNK_DRAWS.capacity) {
+		size_t new_capacity = CHUNK_DRAWS.capacity ? CHUNK_DRAWS.capacity * 2 : 256;
+		face_arena_range* ranges = realloc(CHUNK_DRAWS.ranges, sizeof(*ranges) * new_capacity);
+
+		if (ranges == NULL) {
+			fputs("Failed to allocate memory for the chunk draw list\n", stderr);
+			return;
+		}
+
+		CHUNK_DRAWS.ranges = ranges;
+		CHUNK_DRAWS.capacity = new_capacity;
+	}
+
+	CHUNK_DRAWS.ranges[CHUNK_DRAWS.count++] = (face_arena_range){ first, count };
+}
+
+void chunk_render_chunk(world_chunk_pos pos, chunk* chunk, uint16_t sections) {
 	if (chunk == NULL) {
 		fprintf(stderr, "%s:%d render NULL chunk (%d, %d)\n", __FILE__, __LINE__, pos.x, pos.z);
 		return;
 	}
 
-	// frustum culling initialization
-	Matrix projection_matrix = MatrixPerspective(
-			camera->fovy * DEG2RAD,
-			(float)GetScreenWidth() / (float)GetScreenHeight(), 
-			0.01f, 1000.0f);
-	Matrix viewp_matrix = MatrixMultiply(GetCameraMatrix(*camera), projection_matrix);
-
-	// create frustum planes
-	Vector4 fplanes[6];
-
-	create_frustum_planes(viewp_matrix, fplanes);
-
-	// occlude chunk if outside the frustum
-	if (!is_box_in_frustum(fplanes, 
-				(Vector3){
-					pos.x * WORLD_CHUNK_WIDTH,
-					0,
-					pos.z * WORLD_CHUNK_WIDTH
-				}, (Vector3){
-					pos.x * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH,
-					WORLD_CHUNK_HEIGHT,
-					pos.z * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH
-				})) {
+	// frustum culling is done by the caller, see world_render_chunks
+
+	// chunks without faces, or whose faces did not fit in the face arena, have no range
+	if (chunk->face_capacity == 0 || sections == 0)
 		return;
-	}
 
-	float cam_pos[3] = {camera->position.x, camera->position.y, camera->position.z};
-	SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], cam_pos, SHADER_UNIFORM_VEC3);
-	// SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_MVP], projection_matrix);
+	const unsigned int directions = chunk_facing_directions(pos, chunk);
+
+	// one range per run of visible sections of each direction facing the camera
+	for (unsigned int d = 0; d < 6; d++) {
+		if (!(directions & (1u << d)))
+			continue;
+
+		for (unsigned int s = 0; s < CHUNK_SECTION_COUNT;) {
+			if (!(sections & (1u << s))) {
+				s++;
+				continue;
+			}
+
+			const unsigned int first = chunk->face_start[chunk_face_bucket(d, s)];
+			while (s < CHUNK_SECTION_COUNT && (sections & (1u << s)))
+				s++;
+			// the last section's end is the next direction's start
+			const unsigned int end = chunk->face_start[chunk_face_bucket(d, s)];
 
-	// draw chunks
+			if (end > first)
+				chunk_render_queue(chunk->arena_offset + first, end - first);
+		}
+	}
+}
 
-	// do the equivilent of LoadMaterialDefault without heap allocation
-	Material mat = DEFAULT_MATERIAL;
+void chunk_render_end(void) {
+	face_arena_draw(CHUNK_DRAWS.ranges, CHUNK_DRAWS.count);
+	CHUNK_DRAWS.count = 0;
 
-	mat.shader = shader;
-	mat.maps[MATERIAL_MAP_DIFFUSE].color = BLUE;
-	mat.maps[MATERIAL_MAP_NORMAL].value = .2f;
-	DrawMeshInstanced(chunk->face_mesh, mat, chunk->transforms, chunk->face_count);
+	rlDisableShader();
 }
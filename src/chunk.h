@@ -1,10 +1,21 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <raylib.h>
 
+#include "block_storage.h"
+#include "perlin.h"
+
 #define WORLD_CHUNK_HEIGHT 256
 #define WORLD_CHUNK_WIDTH 16
 
+// chunks are split vertically into sections of this height
+#define CHUNK_SECTION_HEIGHT 16
+#define CHUNK_SECTION_COUNT (WORLD_CHUNK_HEIGHT / CHUNK_SECTION_HEIGHT)
+#define CHUNK_SECTION_BLOCK_COUNT (WORLD_CHUNK_WIDTH * CHUNK_SECTION_HEIGHT * WORLD_CHUNK_WIDTH)
+
+_Static_assert(WORLD_CHUNK_HEIGHT % CHUNK_SECTION_HEIGHT == 0, "chunks must be a whole number of sections");
+
 typedef struct {
 	unsigned int id;
 } block;
@@ -14,91 +25,419 @@ typedef struct {
 	int x, z;
 } world_chunk_pos;
 
-// data format for vertex buffer
+typedef enum {
+	FACE_DIR_FRONT = 0, // +z
+	FACE_DIR_BACK,      // -z
+	FACE_DIR_LEFT,      // +x
+	FACE_DIR_RIGHT,     // -x
+	FACE_DIR_TOP,       // +y
+	FACE_DIR_BOTTOM,    // -y
+} chunk_face_direction;
+
+/* Packed per-instance data for one quad, expanded into
+ * vertices by shaders/chunk_vert.glsl.
+ * x, y, z is the first block the quad covers, relative to
+ * the chunk. width and height are in blocks and run along:
+ *   FACE_DIR_TOP/BOTTOM: width = x, height = z
+ *   FACE_DIR_FRONT/BACK: width = x, height = y
+ *   FACE_DIR_LEFT/RIGHT: width = z, height = y
+ */
 typedef struct {
-	Vector3 v0,v1,v2,v3;
-	Color color;
-} vb_format;
+	unsigned char x, y, z;
+	unsigned char direction; // chunk_face_direction
+	unsigned char width, height;
+	unsigned char block_id;
+	unsigned char padding;
+} chunk_face;
+
+_Static_assert(sizeof(chunk_face) == 8, "chunk_face must stay tightly packed");
+_Static_assert(WORLD_CHUNK_HEIGHT <= 256 && WORLD_CHUNK_WIDTH <= 256, "chunk_face stores block positions in bytes");
+
+// vertex attribute locations, must match shaders/chunk_vert.glsl
+#define CHUNK_ATTRIB_LOCATION_VERTEX 0
+#define CHUNK_ATTRIB_LOCATION_FACE_POSITION 6
+#define CHUNK_ATTRIB_LOCATION_FACE_INFO 7
+#define CHUNK_ATTRIB_LOCATION_FACE_CHUNK 8
+
+/* Levels of detail a chunk can be meshed at. Level n meshes
+ * cubes of 1 << n blocks as if they were one block, so distant
+ * chunks need far fewer faces. See chunk_build_mesh.
+ */
+#define CHUNK_LOD_COUNT 4
+
+_Static_assert(CHUNK_SECTION_HEIGHT % (1 << (CHUNK_LOD_COUNT - 1)) == 0, "level of detail cells must not cross sections");
+
+// one range of faces per face direction and section, see chunk.face_start
+#define CHUNK_FACE_BUCKET_COUNT (6 * CHUNK_SECTION_COUNT)
 
+static inline unsigned int chunk_face_bucket(chunk_face_direction direction, unsigned int section) {
+	return direction * CHUNK_SECTION_COUNT + section;
+}
+
+/* Chunks move through these states in order. Everything up to
+ * CHUNK_STATE_MESHED happens on a worker thread, only the upload
+ * to the GPU is done on the main thread. A chunk meshed again
+ * at a new level of detail goes back to CHUNK_STATE_GENERATED
+ * while a worker has it, see chunk.remeshing.
+ */
+typedef enum {
+	CHUNK_STATE_REQUESTED = 0, // queued, block data not valid yet
+	CHUNK_STATE_GENERATED,     // block data valid, faces being built
+	CHUNK_STATE_MESHED,        // faces built, waiting for upload
+	CHUNK_STATE_UPLOADED,      // ready to render
+} chunk_state;
+
+/* A 16 block tall slice of a chunk. Sections where every block
+ * is the same (all air, all stone) hold just that id and no
+ * per block data, see block_storage.
+ * Sections that are not uniform also keep which blocks are
+ * solid (not air) as one 16 bit mask per column, bit y for the
+ * y-th block of the section, for collision and other queries
+ * that only care about solidity.
+ */
+typedef struct {
+	block_storage blocks;
+	uint16_t* solid; // [x * WORLD_CHUNK_WIDTH + z], NULL while uniform, see chunk_section_solid_column
+} chunk_section;
+
+/* A mesh built apart from its chunk, see chunk_mesh_build. The
+ * fields are the ones of the same name in chunk.
+ */
 typedef struct {
-	Vector3 position;
-	Vector3 normal;
-	Color color;
-} chunk_vertex;
+	unsigned char lod;
+	unsigned int face_count;
+	chunk_face* faces;
+	unsigned int face_start[CHUNK_FACE_BUCKET_COUNT + 1];
+	unsigned char section_visibility[CHUNK_SECTION_COUNT][6];
+	float mesh_min_y;
+	float mesh_max_y;
+} chunk_mesh;
 
 typedef struct {
+	world_chunk_pos position;
+	atomic_int state; // chunk_state
+	atomic_bool discarded; // unloaded while a worker still owned it
+	bool dirty; // blocks changed since the mesh was built, see world_set_block
+	bool from_region; // blocks were read from a region file, which already holds them unless modified
+	bool modified; // blocks changed since they were generated or read from a region file
+	bool edited; // blocks ever changed by world_set_block, so the heightmap does not describe them
+	bool remeshing; // with a worker for a new level of detail, the old mesh is still drawn. Main thread only
+	chunk_mesh* pending_mesh; // built by that worker, NULL if it failed
+	unsigned char lod; // level of detail the mesh is built at, below CHUNK_LOD_COUNT
 	unsigned int face_count;
-	Mesh face_mesh;
-	Matrix* transforms;
-	block blocks[WORLD_CHUNK_WIDTH][WORLD_CHUNK_HEIGHT][WORLD_CHUNK_WIDTH];
+	chunk_face* faces;
+	/* Faces are sorted by direction, then by section, set with
+	 * the mesh: faces of direction d in section s are
+	 * [face_start[b], face_start[b + 1]) with b = chunk_face_bucket(d, s).
+	 */
+	unsigned int face_start[CHUNK_FACE_BUCKET_COUNT + 1];
+	/* Which faces of each section can see each other through
+	 * air, set with the mesh: bit b of section_visibility[s][a]
+	 * is set if air connects face a to face b of section s
+	 * (chunk_face_direction). See chunk_section_build_visibility.
+	 */
+	unsigned char section_visibility[CHUNK_SECTION_COUNT][6];
+	// sections the camera can see into, only valid while cave_frame is the frame being rendered
+	uint16_t cave_visible;
+	unsigned long cave_frame;
+	// world space y extent of the faces, set with the mesh
+	float mesh_min_y;
+	float mesh_max_y;
+	unsigned long last_visible_frame; // for least recently viewed eviction, see world_update_residency
+	// faces in the face arena (see face_arena.h), only valid while chunk_is_drawable
+	unsigned int arena_offset;
+	unsigned int face_capacity; // 0 when the chunk has no faces there
+	chunk_section sections[CHUNK_SECTION_COUNT]; // use chunk_get_block/chunk_set_block
+
+	/* Generated terrain height of every column, plus a one
+	 * column ring around the chunk so the mesher knows the
+	 * neighbouring terrain without the neighbours being loaded.
+	 * Filled by chunk_generate_heightmap, use chunk_get_height.
+	 * This is the terrain as generated, edits do not change it.
+	 */
+	unsigned short heightmap[WORLD_CHUNK_WIDTH + 2][WORLD_CHUNK_WIDTH + 2];
 } chunk;
 
+/* The chunks touching a chunk's sides, indexed by
+ * FACE_DIR_FRONT to FACE_DIR_RIGHT. NULL if not loaded.
+ */
+typedef struct {
+	const chunk* sides[4];
+} chunk_neighbours;
+
+/* Generated terrain height of column (x, z) relative to the chunk,
+ * the column's top (grass) block is at this y.
+ * x and z may be one outside the chunk, -1 to WORLD_CHUNK_WIDTH.
+ */
+static inline unsigned int chunk_get_height(const chunk* chunk, int x, int z) {
+	return chunk->heightmap[x + 1][z + 1];
+}
+
+static inline bool chunk_section_is_air(const chunk_section* section) {
+	return block_storage_is_uniform(&section->blocks) && section->blocks.uniform_id == 0;
+}
+
+// index of a block inside its section's storage
+static inline unsigned int chunk_section_block_index(unsigned int x, unsigned int y, unsigned int z) {
+	return (x * CHUNK_SECTION_HEIGHT + y % CHUNK_SECTION_HEIGHT) * WORLD_CHUNK_WIDTH + z;
+}
+
+/* Rebuild a section's solid masks from its blocks, freeing them
+ * if the section is uniform.
+ * Returns false if memory could not be allocated, the section
+ * falls back to reading its blocks.
+ */
+bool chunk_section_update_solid(chunk_section* section);
+
+/* chunk_section_update_solid for every section. Call after
+ * replacing a chunk's blocks other than through chunk_set_block.
+ */
+bool chunk_update_solid(chunk* chunk);
+
+/* Solid bits of column (x, z) of a section, bit y for the
+ * section's y-th block.
+ */
+static inline uint16_t chunk_section_solid_column(const chunk_section* section, unsigned int x, unsigned int z) {
+	if (section->solid != NULL)
+		return section->solid[x * WORLD_CHUNK_WIDTH + z];
+
+	if (block_storage_is_uniform(&section->blocks))
+		return section->blocks.uniform_id != 0 ? 0xffff : 0;
+
+	// the masks could not be allocated, fall back to the blocks
+	uint16_t bits = 0;
+	for (unsigned int y = 0; y < CHUNK_SECTION_HEIGHT; y++)
+		if (block_storage_get(&section->blocks, chunk_section_block_index(x, y, z)) != 0)
+			bits |= 1u << y;
+
+	return bits;
+}
+
+static inline bool chunk_is_solid(const chunk* chunk, unsigned int x, unsigned int y, unsigned int z) {
+	const chunk_section* section = &chunk->sections[y / CHUNK_SECTION_HEIGHT];
+
+	return (chunk_section_solid_column(section, x, z) >> (y % CHUNK_SECTION_HEIGHT)) & 1;
+}
+
+/* Get the block at (x, y, z) relative to the chunk.
+ * Coordinates must be inside the chunk.
+ */
+static inline block chunk_get_block(const chunk* chunk, unsigned int x, unsigned int y, unsigned int z) {
+	const block_storage* bs = &chunk->sections[y / CHUNK_SECTION_HEIGHT].blocks;
+
+	return (block){ .id = block_storage_get(bs, chunk_section_block_index(x, y, z)) };
+}
+
+/* Set the block at (x, y, z) relative to the chunk.
+ * Coordinates must be inside the chunk.
+ * Returns false if the block storage could not grow to fit a new id.
+ */
+static inline bool chunk_set_block(chunk* chunk, unsigned int x, unsigned int y, unsigned int z, block b) {
+	chunk_section* section = &chunk->sections[y / CHUNK_SECTION_HEIGHT];
+
+	if (!block_storage_set(&section->blocks, chunk_section_block_index(x, y, z), b.id))
+		return false;
+
+	if (section->solid != NULL) {
+		const uint16_t bit = 1u << (y % CHUNK_SECTION_HEIGHT);
+
+		if (b.id != 0)
+			section->solid[x * WORLD_CHUNK_WIDTH + z] |= bit;
+		else
+			section->solid[x * WORLD_CHUNK_WIDTH + z] &= ~bit;
+	} else if (!block_storage_is_uniform(&section->blocks))
+		chunk_section_update_solid(section); // the section stopped being uniform
+
+	return true;
+}
+
+typedef enum {
+	CHUNK_MESHER_NAIVE = 0, // one quad per visible block face
+	CHUNK_MESHER_GREEDY,    // coplanar faces of the same block merged into larger quads
+} chunk_mesher;
+
 typedef struct {
 	unsigned int seed;
 	float perlin_amplitude;
 	float perlin_frequency;
 	unsigned int octaves;
+	chunk_mesher mesher;
 } chunk_generation_options;
 
-typedef struct chunk_dict_entry chunk_dict_entry;
-struct chunk_dict_entry {
+typedef struct {
 	world_chunk_pos key;
-	chunk* value;
-	chunk_dict_entry* next;
-};
+	chunk* value; // NULL marks an empty slot
+} chunk_dict_entry;
 
-/* Ideally should be more than the number of chunks
- * loaded at one time to avoid collisions 
+/* Open addressing hash map with linear probing, keyed on the
+ * packed chunk position. The table doubles once it is half full
+ * and deletion shifts entries back instead of leaving tombstones.
+ * A zeroed chunk_dictionary is a valid empty dictionary.
  */
-#define CHUNK_DICT_ENTRIES 128
 typedef struct {
-	chunk_dict_entry* entries[CHUNK_DICT_ENTRIES];
+	chunk_dict_entry* entries;
+	unsigned int capacity; // always 0 or a power of two
 	unsigned int count;
 } chunk_dictionary;
 
 // DICTIONARY FUNCTIONS
 
-/* Lookup an entry with the key
+/* Lookup an entry with the key.
+ * The returned pointer is only valid until the next insert or delete.
  */
 chunk_dict_entry* chunk_dict_lookup(chunk_dictionary* chunk_dict, world_chunk_pos key);
 
+/* Remove an entry from the dictionary without freeing the chunk.
+ * Returns the chunk that was stored, or NULL if there was none.
+ */
+chunk* chunk_dict_remove(chunk_dictionary* chunk_dict, world_chunk_pos key);
+
 /* Free an entry from the dictionary, along with the chunk
  * data itself.
  */
 void chunk_dict_delete(chunk_dictionary* chunk_dict, world_chunk_pos key);
 
 /* Free the entire dictionary, along with the chunks
- * themselves
+ * themselves. The dictionary is left empty and can be reused.
  */
 void chunk_dict_delete_all(chunk_dictionary* chunk_dict);
 
-/* Make an entry into the chunk dictionary
+/* Make an entry into the chunk dictionary, replacing the value
+ * if the key already exists. value must not be NULL.
  */
 void chunk_dict_insert(chunk_dictionary* chunk_dict, world_chunk_pos key, chunk* value);
 
+/* Step through every entry in no particular order.
+ * Start with *iterator = 0, returns NULL after the last entry:
+ *
+ *   size_t it = 0;
+ *   chunk_dict_entry* entry;
+ *   while ((entry = chunk_dict_next(chunk_dict, &it)) != NULL) { ... }
+ *
+ * Do not insert or delete while iterating.
+ */
+chunk_dict_entry* chunk_dict_next(chunk_dictionary* chunk_dict, size_t* iterator);
+
 /* Runs func for each loaded chunk in no particular order.
  */
 void for_each_chunk(chunk_dictionary* chunk_dict, void (*func)(world_chunk_pos pos, chunk* chunk, void* args), void* args);
 
-/* Runs func for each block in the chunk
+/* Runs func for each block in the chunk.
+ * Changes func makes to the block are written back.
+ * Sections that are entirely air are skipped.
  */
 void for_each_block(chunk* chunk, void (*func)(block* block, void* args), void* args);
 
 // GENERATION FUNCITONS
+
+/* Allocate an empty chunk in CHUNK_STATE_REQUESTED.
+ * Returns NULL if allocation failed.
+ */
+chunk* chunk_create(world_chunk_pos pos);
+
+/* Free a chunk and everything it owns. The GPU mesh is only
+ * unloaded if the chunk has one in the face arena, so this must
+ * be called from the main thread in that case.
+ */
+void chunk_free(chunk* chunk);
+
+/* Bytes of memory held by a chunk, CPU and GPU side.
+ * Only read from the main thread, or once workers are done with it.
+ */
+size_t chunk_memory_usage(const chunk* chunk);
+
+static inline chunk_state chunk_get_state(chunk* chunk) {
+	return atomic_load_explicit(&chunk->state, memory_order_acquire);
+}
+
+static inline void chunk_set_state(chunk* chunk, chunk_state state) {
+	atomic_store_explicit(&chunk->state, state, memory_order_release);
+}
+
+/* Whether the chunk's faces are in the face arena and can be
+ * drawn, which stays true while a worker meshes it at a new
+ * level of detail. MAIN THREAD ONLY.
+ */
+static inline bool chunk_is_drawable(chunk* chunk) {
+	return chunk->remeshing || chunk_get_state(chunk) == CHUNK_STATE_UPLOADED;
+}
+
+/* Fill the chunk's heightmap from noise.
+ * Thread safe, only touches the chunk and the (read only) perlin table.
+ */
+void chunk_generate_heightmap(chunk_generation_options* chunk_opts, chunk* chunk);
+
+/* Fill the chunk's heightmap and block data from noise.
+ * Thread safe, only touches the chunk and the (read only) perlin table.
+ * Returns false if memory could not be allocated, the blocks are
+ * then incomplete and the chunk stays in CHUNK_STATE_REQUESTED.
+ */
+bool chunk_generate_blocks(chunk_generation_options* chunk_opts, chunk* chunk);
+
+/* Build the packed faces from the chunk's block data, at the
+ * chunk's level of detail (chunk.lod).
+ * At full detail neighbours give the blocks across the chunk's
+ * borders. The heightmap stands in for any that are NULL, or for
+ * all of them if neighbours is NULL, so it must be filled.
+ * Coarser levels ignore neighbours and keep every face on the
+ * chunk's sides, so there are no gaps against neighbours meshed
+ * at a different level.
+ * Thread safe as long as nothing writes to the chunk or its
+ * neighbours meanwhile.
+ * Returns false if memory could not be allocated.
+ */
+bool chunk_build_mesh(chunk_generation_options* chunk_opts, chunk* chunk, const chunk_neighbours* neighbours);
+
+/* What chunk_build_mesh does at level of detail lod, into mesh
+ * instead of the chunk, so the chunk's own mesh can still be
+ * drawn meanwhile. Only reads the chunk.
+ * Returns false if memory could not be allocated.
+ */
+bool chunk_mesh_build(chunk_generation_options* chunk_opts, const chunk* chunk, unsigned int lod, const chunk_neighbours* neighbours, chunk_mesh* mesh);
+
+/* Replace the chunk's mesh and level of detail with mesh, which
+ * is left empty, and move the chunk to CHUNK_STATE_MESHED ready
+ * for chunk_upload_mesh.
+ */
+void chunk_mesh_apply(chunk* chunk, chunk_mesh* mesh);
+
+/* Send the chunk's faces to the face arena. A chunk that was
+ * meshed again keeps its range if the new faces fit, otherwise
+ * it moves to a new one. MAIN THREAD ONLY.
+ */
+void chunk_upload_mesh(chunk* chunk);
+
+/* Bytes of faces chunk_upload_mesh has sent to the GPU since the
+ * last call, nothing once every chunk is uploaded and unchanged.
+ * MAIN THREAD ONLY.
+ */
+size_t chunk_take_uploaded_bytes(void);
+
+/* Synchronously generate, mesh and upload a chunk and insert it into
+ * chunk_dict. Unless you intend to re-generate the chunk, use world_load_chunk.
+ */
 chunk* chunk_generate_chunk(chunk_generation_options* chunk_opts, chunk_dictionary* chunk_dict, world_chunk_pos pos);
-void chunk_render_chunk(world_chunk_pos pos, chunk* chunk, Camera3D* camera, Shader shader);
 
-/* Initialize perlin noise with an integer seed.
- * This is required before getting a value from
- * the perlin noise functions.
- * There is no corresponding destroy function.
+/* Which faces of a section air connects, one row per face as in
+ * chunk.section_visibility. Every face of an air section sees
+ * every other, no face of a solid section sees anything.
+ */
+void chunk_section_build_visibility(const chunk_section* section, unsigned char visibility[6]);
+
+/* Bind the chunk shader and set its uniforms for this frame.
+ * Chunks are queued with chunk_render_chunk and all drawn
+ * together by chunk_render_end.
  */
-void perlin_noise_init(unsigned int seed);
+void chunk_render_begin(Camera3D* camera, Shader shader);
 
-/* Get the value of perlin noise at (x, y, z)
+/* Queue an uploaded chunk's faces in the sections set in
+ * sections (bit s for section s). Faces pointing away from the
+ * camera everywhere in the chunk's bounds are left out, other
+ * culling is up to the caller, world_render_chunks only calls
+ * this for visible chunks.
  */
-float perlin_noise_3D(float x, float y, float z);
+void chunk_render_chunk(world_chunk_pos pos, chunk* chunk, uint16_t sections);
 
-/* Get the value of perlin noise at (x, y)
+/* Draw every queued chunk, see face_arena_draw
  */
-float perlin_noise_2D(float x, float y);
+void chunk_render_end(void);
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <raylib.h>
+#include <raymath.h>
+
+#include "culling.h"
+
+// at most this many chunks are tested one by one
+#define CULL_LEAF_SIZE 16
+
+frustum frustum_from_matrix(Matrix m) {
+	frustum f = {
+		.planes = {
+			{ m.m3 + m.m0, m.m7 + m.m4, m.m11 + m.m8,  m.m15 + m.m12 }, // left
+			{ m.m3 - m.m0, m.m7 - m.m4, m.m11 - m.m8,  m.m15 - m.m12 }, // right
+			{ m.m3 - m.m1, m.m7 - m.m5, m.m11 - m.m9,  m.m15 - m.m13 }, // top
+			{ m.m3 + m.m1, m.m7 + m.m5, m.m11 + m.m9,  m.m15 + m.m13 }, // bottom
+			{ m.m3 + m.m2, m.m7 + m.m6, m.m11 + m.m10, m.m15 + m.m14 }, // near
+			{ m.m3 - m.m2, m.m7 - m.m6, m.m11 - m.m10, m.m15 - m.m14 }, // far
+		},
+	};
+
+	for (unsigned int i = 0; i < 6; i++) {
+		Vector4 p = f.planes[i];
+		float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+
+		if (length > 0)
+			f.planes[i] = (Vector4){ p.x / length, p.y / length, p.z / length, p.w / length };
+	}
+
+	return f;
+}
+
+frustum_result frustum_test_box(const frustum* f, Vector3 min, Vector3 max) {
+	frustum_result result = FRUSTUM_INSIDE;
+
+	for (unsigned int i = 0; i < 6; i++) {
+		const Vector4 p = f->planes[i];
+
+		// the corners furthest along and against the plane normal
+		const Vector3 positive = {
+			(p.x >= 0) ? max.x : min.x,
+			(p.y >= 0) ? max.y : min.y,
+			(p.z >= 0) ? max.z : min.z,
+		};
+		const Vector3 negative = {
+			(p.x >= 0) ? min.x : max.x,
+			(p.y >= 0) ? min.y : max.y,
+			(p.z >= 0) ? min.z : max.z,
+		};
+
+		if (p.x * positive.x + p.y * positive.y + p.z * positive.z + p.w < 0)
+			return FRUSTUM_OUTSIDE;
+
+		if (p.x * negative.x + p.y * negative.y + p.z * negative.z + p.w < 0)
+			result = FRUSTUM_INTERSECTS;
+	}
+
+	return result;
+}
+
+// spread the low 16 bits of v out to the even bits
+static uint32_t cull_part_bits(uint32_t v) {
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+typedef struct {
+	uint32_t key;
+	chunk* chunk;
+} cull_sort_entry;
+
+static int cull_sort_compare(const void* a, const void* b) {
+	const uint32_t ka = ((const cull_sort_entry*)a)->key;
+	const uint32_t kb = ((const cull_sort_entry*)b)->key;
+
+	return (ka > kb) - (ka < kb);
+}
+
+static bool cull_tree_reserve(chunk_cull_tree* tree, size_t count) {
+	if (count <= tree->capacity)
+		return true;
+
+	size_t capacity = tree->capacity ? tree->capacity : 64;
+	while (capacity < count)
+		capacity *= 2;
+
+	void** arrays[] = {
+		(void**)&tree->chunks, (void**)&tree->visible,
+		(void**)&tree->min_x, (void**)&tree->min_y, (void**)&tree->min_z,
+		(void**)&tree->max_x, (void**)&tree->max_y, (void**)&tree->max_z,
+	};
+	const size_t sizes[] = {
+		sizeof(chunk*), sizeof(chunk*),
+		sizeof(float), sizeof(float), sizeof(float),
+		sizeof(float), sizeof(float), sizeof(float),
+	};
+
+	for (unsigned int i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+		void* array = realloc(*arrays[i], sizes[i] * capacity);
+
+		if (array == NULL) {
+			fputs("Failed to allocate memory for the chunk cull tree\n", stderr);
+			return false;
+		}
+
+		*arrays[i] = array;
+	}
+
+	tree->capacity = capacity;
+	tree->visible_capacity = capacity;
+
+	return true;
+}
+
+static uint32_t cull_tree_push_node(chunk_cull_tree* tree) {
+	if (tree->node_count == tree->node_capacity) {
+		size_t capacity = tree->node_capacity ? tree->node_capacity * 2 : 64;
+		chunk_cull_node* nodes = realloc(tree->nodes, sizeof(chunk_cull_node) * capacity);
+
+		if (nodes == NULL)
+			return UINT32_MAX;
+
+		tree->nodes = nodes;
+		tree->node_capacity = capacity;
+	}
+
+	return tree->node_count++;
+}
+
+/* Build the subtree over chunks [first, first + count), which all
+ * share the Morton key bits above shift. Returns false if memory
+ * could not be allocated.
+ */
+static bool cull_tree_build_node(chunk_cull_tree* tree, const uint32_t* keys, uint32_t first, uint32_t count, int shift) {
+	const uint32_t index = cull_tree_push_node(tree);
+	if (index == UINT32_MAX)
+		return false;
+
+	const bool leaf = count <= CULL_LEAF_SIZE || shift < 0;
+
+	if (!leaf) {
+		// every child is a run of chunks with the same two key bits at shift
+		uint32_t start = first;
+
+		while (start < first + count) {
+			const uint32_t quadrant = (keys[start] >> shift) & 3;
+			uint32_t end = start + 1;
+
+			while (end < first + count && ((keys[end] >> shift) & 3) == quadrant)
+				end++;
+
+			if (!cull_tree_build_node(tree, keys, start, end - start, shift - 2))
+				return false;
+
+			start = end;
+		}
+	}
+
+	// the bounds are the union of the chunks below, children were pushed after index
+	Vector3 min = { tree->min_x[first], tree->min_y[first], tree->min_z[first] };
+	Vector3 max = { tree->max_x[first], tree->max_y[first], tree->max_z[first] };
+
+	for (uint32_t i = first + 1; i < first + count; i++) {
+		min = Vector3Min(min, (Vector3){ tree->min_x[i], tree->min_y[i], tree->min_z[i] });
+		max = Vector3Max(max, (Vector3){ tree->max_x[i], tree->max_y[i], tree->max_z[i] });
+	}
+
+	tree->nodes[index] = (chunk_cull_node){
+		.min = min,
+		.max = max,
+		.first = first,
+		.count = count,
+		.skip = tree->node_count,
+		.leaf = leaf,
+	};
+
+	return true;
+}
+
+bool chunk_cull_tree_build(chunk_cull_tree* tree, chunk_dictionary* dict) {
+	tree->count = 0;
+	tree->node_count = 0;
+	tree->visible_count = 0;
+
+	// gather the chunks that can be drawn
+	size_t it = 0, count = 0;
+	chunk_dict_entry* entry;
+	int min_x = 0, min_z = 0;
+
+	while ((entry = chunk_dict_next(dict, &it)) != NULL) {
+		chunk* c = entry->value;
+
+		if (!chunk_is_drawable(c) || c->face_count == 0)
+			continue;
+
+		// keys are taken relative to the lowest position so they are never negative
+		min_x = count == 0 || c->position.x < min_x ? c->position.x : min_x;
+		min_z = count == 0 || c->position.z < min_z ? c->position.z : min_z;
+
+		count++;
+	}
+
+	if (count == 0)
+		return true;
+
+	cull_sort_entry* sorted = malloc(sizeof(cull_sort_entry) * count);
+	uint32_t* keys = malloc(sizeof(uint32_t) * count);
+
+	if (sorted == NULL || keys == NULL || !cull_tree_reserve(tree, count)) {
+		fputs("Failed to allocate memory for the chunk cull tree\n", stderr);
+		free(sorted);
+		free(keys);
+		return false;
+	}
+
+	it = 0;
+	size_t n = 0;
+
+	while ((entry = chunk_dict_next(dict, &it)) != NULL) {
+		chunk* c = entry->value;
+
+		if (!chunk_is_drawable(c) || c->face_count == 0)
+			continue;
+
+		const uint32_t x = c->position.x - min_x;
+		const uint32_t z = c->position.z - min_z;
+
+		sorted[n++] = (cull_sort_entry){
+			.key = cull_part_bits(x) | (cull_part_bits(z) << 1),
+			.chunk = c,
+		};
+	}
+
+	qsort(sorted, count, sizeof(cull_sort_entry), cull_sort_compare);
+
+	for (size_t i = 0; i < count; i++) {
+		const chunk* c = sorted[i].chunk;
+
+		keys[i] = sorted[i].key;
+		tree->chunks[i] = sorted[i].chunk;
+		tree->min_x[i] = c->position.x * WORLD_CHUNK_WIDTH;
+		tree->min_z[i] = c->position.z * WORLD_CHUNK_WIDTH;
+		tree->max_x[i] = tree->min_x[i] + WORLD_CHUNK_WIDTH;
+		tree->max_z[i] = tree->min_z[i] + WORLD_CHUNK_WIDTH;
+		tree->min_y[i] = c->mesh_min_y;
+		tree->max_y[i] = c->mesh_max_y;
+	}
+
+	tree->count = count;
+
+	// the top two key bits are 30 and 31
+	const bool built = cull_tree_build_node(tree, keys, 0, count, 30);
+
+	free(sorted);
+	free(keys);
+
+	if (!built) {
+		fputs("Failed to allocate memory for the chunk cull tree\n", stderr);
+		tree->count = 0;
+		tree->node_count = 0;
+	}
+
+	return built;
+}
+
+// test every chunk of a leaf, one plane at a time over all of them
+static void cull_tree_test_leaf(chunk_cull_tree* tree, const frustum* f, uint32_t first, uint32_t count) {
+	unsigned char inside[CULL_LEAF_SIZE];
+	memset(inside, 1, sizeof(inside));
+
+	for (unsigned int i = 0; i < 6; i++) {
+		const Vector4 p = f->planes[i];
+
+		// pick the corner furthest along the normal per axis, the same for every box
+		const float* xs = (p.x >= 0 ? tree->max_x : tree->min_x) + first;
+		const float* ys = (p.y >= 0 ? tree->max_y : tree->min_y) + first;
+		const float* zs = (p.z >= 0 ? tree->max_z : tree->min_z) + first;
+
+		for (uint32_t j = 0; j < count; j++)
+			inside[j] &= p.x * xs[j] + p.y * ys[j] + p.z * zs[j] + p.w >= 0;
+	}
+
+	for (uint32_t j = 0; j < count; j++)
+		if (inside[j])
+			tree->visible[tree->visible_count++] = tree->chunks[first + j];
+}
+
+size_t chunk_cull_tree_query(chunk_cull_tree* tree, const frustum* f) {
+	tree->visible_count = 0;
+
+	size_t i = 0;
+
+	while (i < tree->node_count) {
+		const chunk_cull_node* node = &tree->nodes[i];
+
+		switch (frustum_test_box(f, node->min, node->max)) {
+			case (FRUSTUM_OUTSIDE):
+				i = node->skip;
+				break;
+
+			case (FRUSTUM_INSIDE):
+				memcpy(tree->visible + tree->visible_count, tree->chunks + node->first, sizeof(chunk*) * node->count);
+				tree->visible_count += node->count;
+				i = node->skip;
+				break;
+
+			default:
+				if (node->leaf) {
+					cull_tree_test_leaf(tree, f, node->first, node->count);
+					i = node->skip;
+				} else
+					i++;
+		}
+	}
+
+	return tree->visible_count;
+}
+
+void chunk_cull_tree_free(chunk_cull_tree* tree) {
+	free(tree->chunks);
+	free(tree->visible);
+	free(tree->min_x);
+	free(tree->min_y);
+	free(tree->min_z);
+	free(tree->max_x);
+	free(tree->max_y);
+	free(tree->max_z);
+	free(tree->nodes);
+
+	*tree = (chunk_cull_tree){0};
+}
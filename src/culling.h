@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <raylib.h>
+
+#include "chunk.h"
+
+/* Six normalised planes (left, right, top, bottom, near, far)
+ * with normals pointing into the frustum.
+ */
+typedef struct {
+	Vector4 planes[6];
+} frustum;
+
+typedef enum {
+	FRUSTUM_OUTSIDE = 0,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE,
+} frustum_result;
+
+/* Extract the planes from a combined view-projection matrix
+ */
+frustum frustum_from_matrix(Matrix view_projection);
+
+frustum_result frustum_test_box(const frustum* f, Vector3 min, Vector3 max);
+
+/* A node of the chunk quadtree. Nodes are stored depth first,
+ * so a node's children directly follow it and skip is the index
+ * of the next node that is not inside it.
+ */
+typedef struct {
+	Vector3 min;
+	Vector3 max;
+	uint32_t first; // range of chunks below this node
+	uint32_t count;
+	uint32_t skip;
+	bool leaf;
+} chunk_cull_node;
+
+/* Quadtree over a set of chunks for frustum culling.
+ * The chunks are sorted along a Z-order curve so every node
+ * covers a contiguous range of them, and their boxes are kept
+ * as separate arrays (SoA) so the per chunk test vectorizes.
+ * Whole nodes that are outside (or inside) the frustum are
+ * rejected (or accepted) without looking at their chunks.
+ */
+typedef struct {
+	size_t count;
+	size_t capacity;
+	chunk** chunks;
+	float* min_x;
+	float* min_y;
+	float* min_z;
+	float* max_x;
+	float* max_y;
+	float* max_z;
+
+	chunk_cull_node* nodes;
+	size_t node_count;
+	size_t node_capacity;
+
+	// output of chunk_cull_tree_query
+	chunk** visible;
+	size_t visible_count;
+	size_t visible_capacity;
+} chunk_cull_tree;
+
+/* Rebuild the tree from every uploaded chunk in dict that
+ * has faces. Chunks that are freed afterwards must not be
+ * queried for, rebuild whenever the set of uploaded chunks
+ * changes.
+ * Returns false if memory could not be allocated, the tree is
+ * left empty.
+ */
+bool chunk_cull_tree_build(chunk_cull_tree* tree, chunk_dictionary* dict);
+
+/* Fill tree->visible with the chunks that intersect f.
+ * Returns the number of visible chunks.
+ */
+size_t chunk_cull_tree_query(chunk_cull_tree* tree, const frustum* f);
+
+void chunk_cull_tree_free(chunk_cull_tree* tree);
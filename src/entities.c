@@ -0,0 +1,742 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <raylib.h>
+#include <raymath.h>
+
+#include "entities.h"
+#include "entity.h"
+#include "occupancy.h"
+#include "trace.h"
+#include "worker.h"
+
+#define ENTITY_GRAVITY -45.0f
+#define ENTITY_GROUND_FRICTION 15.0f
+#define ENTITY_AIR_FRICTION 0.5f
+#define ENTITY_PUSH 600.0f // acceleration per block of overlap with another solid entity
+
+// side of the spatial hash's cells, in blocks
+#define ENTITY_HASH_CELL 4.0f
+
+// entities a batch has at least, before it is given to a worker
+#define ENTITY_BATCH_SIZE 512
+
+// neighbours looked at per entity when pushing apart
+#define ENTITY_MAX_NEIGHBOURS 32
+
+// handles that are free have this bit set in their slot, with the next free handle below it
+#define ENTITY_SLOT_FREE 0x80000000u
+#define ENTITY_SLOT_LAST 0x7fffffffu // no next free handle
+
+entity_manager ENTITIES = {0};
+
+// the entities in one chunk, a run of indices in ENTITIES
+typedef struct {
+	world_chunk_pos chunk;
+	uint32_t first;
+	uint32_t count;
+} entity_partition;
+
+typedef struct {
+	world_chunk_pos chunk;
+	uint32_t partition; // UINT32_MAX if the entry is empty
+} entity_partition_entry;
+
+// an entity in the spatial hash, with a copy of its cell and box so lookups stay in the hash
+typedef struct {
+	uint32_t entity;
+	int x, y, z;
+	Vector3 min, max;
+} entity_hash_entry;
+
+static struct {
+	// handle -> index in ENTITIES, free handles are chained through it
+	uint32_t* slots;
+	size_t slot_capacity;
+	uint32_t free_handle;
+
+	// arrays entities are sorted into, swapped with ENTITIES after
+	entity_manager back;
+	uint32_t* partition_of;
+
+	// chunk -> partition, rebuilt every update
+	entity_partition_entry* partition_table;
+	size_t partition_table_size;
+
+	entity_partition* partitions;
+	size_t partition_count;
+	size_t partition_capacity;
+
+	// partition each batch starts at, the last entry is partition_count
+	uint32_t* batch_start;
+	size_t batch_count;
+
+	// entities bucketed by the hash cell their center is in
+	uint32_t* bucket_start; // bucket_count + 1 entries
+	entity_hash_entry* bucket_entries;
+	size_t bucket_count;
+	Vector3 largest; // biggest size of any entity in the hash
+	bool hash_dirty;
+} MANAGER = {
+	.free_handle = ENTITY_HANDLE_NONE,
+	.hash_dirty = true,
+};
+
+/* One phase of an update run over every batch, by the main thread
+ * and whichever workers pick it up. next packs the phase's
+ * generation (high 32 bits), batch count and the next batch to
+ * run, so a worker that starts after its phase ended cannot take
+ * a batch from the next one.
+ */
+typedef void (*entity_batch_func)(uint32_t first_partition, uint32_t end_partition, float delta_t);
+
+static struct {
+	_Atomic uint64_t next;
+	atomic_uint done;
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+
+	entity_batch_func func;
+	float delta_t;
+	uint32_t generation;
+} PHASE = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.finished = PTHREAD_COND_INITIALIZER,
+};
+
+// HANDLES AND STORAGE
+
+static bool entities_grow_array(void** array, size_t element_size, size_t capacity) {
+	void* grown = realloc(*array, element_size * capacity);
+	if (grown == NULL)
+		return false;
+
+	*array = grown;
+	return true;
+}
+
+static bool entities_grow_manager(entity_manager* m, size_t capacity) {
+	return entities_grow_array((void**)&m->position, sizeof(Vector3), capacity)
+		&& entities_grow_array((void**)&m->previous_position, sizeof(Vector3), capacity)
+		&& entities_grow_array((void**)&m->velocity, sizeof(Vector3), capacity)
+		&& entities_grow_array((void**)&m->size, sizeof(Vector3), capacity)
+		&& entities_grow_array((void**)&m->kind, sizeof(uint8_t), capacity)
+		&& entities_grow_array((void**)&m->flags, sizeof(uint8_t), capacity)
+		&& entities_grow_array((void**)&m->handle, sizeof(entity_handle), capacity);
+}
+
+static bool entities_reserve(size_t count) {
+	if (count <= ENTITIES.capacity)
+		return true;
+
+	size_t capacity = ENTITIES.capacity ? ENTITIES.capacity * 2 : 256;
+	while (capacity < count)
+		capacity *= 2;
+
+	if (!entities_grow_manager(&ENTITIES, capacity)
+			|| !entities_grow_manager(&MANAGER.back, capacity)
+			|| !entities_grow_array((void**)&MANAGER.partition_of, sizeof(uint32_t), capacity)
+			|| !entities_grow_array((void**)&MANAGER.bucket_entries, sizeof(entity_hash_entry), capacity)) {
+		fputs("ERROR: Failed to allocate memory for entities\n", stderr);
+		return false;
+	}
+
+	ENTITIES.capacity = capacity;
+	MANAGER.back.capacity = capacity;
+
+	return true;
+}
+
+static entity_handle entities_new_handle(void) {
+	if (MANAGER.free_handle != ENTITY_HANDLE_NONE) {
+		const entity_handle handle = MANAGER.free_handle;
+		const uint32_t next = MANAGER.slots[handle] & ~ENTITY_SLOT_FREE;
+
+		MANAGER.free_handle = next == ENTITY_SLOT_LAST ? ENTITY_HANDLE_NONE : next;
+		return handle;
+	}
+
+	if (MANAGER.slot_capacity >= ENTITY_SLOT_LAST)
+		return ENTITY_HANDLE_NONE;
+
+	const size_t capacity = MANAGER.slot_capacity ? MANAGER.slot_capacity * 2 : 256;
+	if (!entities_grow_array((void**)&MANAGER.slots, sizeof(uint32_t), capacity))
+		return ENTITY_HANDLE_NONE;
+
+	// chain the new handles onto the free list, lowest first
+	for (size_t h = MANAGER.slot_capacity; h < capacity; h++)
+		MANAGER.slots[h] = ENTITY_SLOT_FREE | (h + 1 < capacity ? h + 1 : ENTITY_SLOT_LAST);
+
+	MANAGER.free_handle = MANAGER.slot_capacity;
+	MANAGER.slot_capacity = capacity;
+
+	return entities_new_handle();
+}
+
+entity_handle entities_spawn(entity_kind kind, Vector3 position, Vector3 size, Vector3 velocity, uint8_t flags) {
+	if (!entities_reserve(ENTITIES.count + 1))
+		return ENTITY_HANDLE_NONE;
+
+	const entity_handle handle = entities_new_handle();
+	if (handle == ENTITY_HANDLE_NONE) {
+		fputs("ERROR: Failed to allocate memory for entity handles\n", stderr);
+		return ENTITY_HANDLE_NONE;
+	}
+
+	const size_t i = ENTITIES.count++;
+
+	ENTITIES.position[i] = position;
+	ENTITIES.previous_position[i] = position;
+	ENTITIES.velocity[i] = velocity;
+	ENTITIES.size[i] = size;
+	ENTITIES.kind[i] = kind;
+	ENTITIES.flags[i] = flags & ~ENTITY_FLAG_ON_GROUND;
+	ENTITIES.handle[i] = handle;
+
+	MANAGER.slots[handle] = i;
+	MANAGER.hash_dirty = true;
+
+	return handle;
+}
+
+void entities_despawn(entity_handle handle) {
+	const size_t i = entities_index(handle);
+	if (i == SIZE_MAX)
+		return;
+
+	// move the last entity into the hole
+	const size_t last = --ENTITIES.count;
+
+	if (i != last) {
+		ENTITIES.position[i] = ENTITIES.position[last];
+		ENTITIES.previous_position[i] = ENTITIES.previous_position[last];
+		ENTITIES.velocity[i] = ENTITIES.velocity[last];
+		ENTITIES.size[i] = ENTITIES.size[last];
+		ENTITIES.kind[i] = ENTITIES.kind[last];
+		ENTITIES.flags[i] = ENTITIES.flags[last];
+		ENTITIES.handle[i] = ENTITIES.handle[last];
+
+		MANAGER.slots[ENTITIES.handle[i]] = i;
+	}
+
+	MANAGER.slots[handle] = ENTITY_SLOT_FREE | (MANAGER.free_handle == ENTITY_HANDLE_NONE ? ENTITY_SLOT_LAST : MANAGER.free_handle);
+	MANAGER.free_handle = handle;
+	MANAGER.hash_dirty = true;
+}
+
+size_t entities_index(entity_handle handle) {
+	if (handle >= MANAGER.slot_capacity || (MANAGER.slots[handle] & ENTITY_SLOT_FREE))
+		return SIZE_MAX;
+
+	return MANAGER.slots[handle];
+}
+
+// PARTITIONS
+
+static world_chunk_pos entities_chunk_of(Vector3 position) {
+	return (world_chunk_pos){
+		floorf(position.x / WORLD_CHUNK_WIDTH),
+		floorf(position.z / WORLD_CHUNK_WIDTH),
+	};
+}
+
+static inline uint32_t entities_hash(int x, int y, int z) {
+	return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+}
+
+static size_t entities_pow2_at_least(size_t n) {
+	size_t size = 64;
+	while (size < n)
+		size *= 2;
+	return size;
+}
+
+// partition holding chunk, made empty if this is its first entity
+static uint32_t entities_partition_for(world_chunk_pos chunk) {
+	const size_t mask = MANAGER.partition_table_size - 1;
+	size_t slot = entities_hash(chunk.x, 0, chunk.z) & mask;
+
+	for (;;) {
+		entity_partition_entry* entry = &MANAGER.partition_table[slot];
+
+		if (entry->partition == UINT32_MAX) {
+			entry->chunk = chunk;
+			entry->partition = MANAGER.partition_count;
+
+			MANAGER.partitions[MANAGER.partition_count++] = (entity_partition){ .chunk = chunk };
+			return entry->partition;
+		}
+
+		if (entry->chunk.x == chunk.x && entry->chunk.z == chunk.z)
+			return entry->partition;
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+/* Sort the entities by chunk into MANAGER.back and swap it with
+ * ENTITIES. Entities keep their order within a chunk, and chunks
+ * keep the order of their first entity, so the arrays stay mostly
+ * in place from one update to the next.
+ */
+static bool entities_partition(void) {
+	TRACE_ZONE("entities_partition");
+
+	const size_t count = ENTITIES.count;
+
+	// at most one partition per entity, the table is kept at most half full
+	const size_t table_size = entities_pow2_at_least(count * 2);
+
+	if (table_size > MANAGER.partition_table_size) {
+		if (!entities_grow_array((void**)&MANAGER.partition_table, sizeof(entity_partition_entry), table_size)) {
+			fputs("ERROR: Failed to allocate memory for entity partitions\n", stderr);
+			return false;
+		}
+		MANAGER.partition_table_size = table_size;
+	}
+
+	if (count > MANAGER.partition_capacity) {
+		if (!entities_grow_array((void**)&MANAGER.partitions, sizeof(entity_partition), count)
+				|| !entities_grow_array((void**)&MANAGER.batch_start, sizeof(uint32_t), count + 1)) {
+			fputs("ERROR: Failed to allocate memory for entity partitions\n", stderr);
+			return false;
+		}
+		MANAGER.partition_capacity = count;
+	}
+
+	for (size_t i = 0; i < MANAGER.partition_table_size; i++)
+		MANAGER.partition_table[i].partition = UINT32_MAX;
+	MANAGER.partition_count = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t p = entities_partition_for(entities_chunk_of(ENTITIES.position[i]));
+
+		MANAGER.partition_of[i] = p;
+		MANAGER.partitions[p].count++;
+	}
+
+	uint32_t first = 0;
+	for (size_t p = 0; p < MANAGER.partition_count; p++) {
+		MANAGER.partitions[p].first = first;
+		first += MANAGER.partitions[p].count;
+		MANAGER.partitions[p].count = 0;
+	}
+
+	entity_manager* back = &MANAGER.back;
+
+	for (size_t i = 0; i < count; i++) {
+		entity_partition* partition = &MANAGER.partitions[MANAGER.partition_of[i]];
+		const size_t j = partition->first + partition->count++;
+
+		back->position[j] = ENTITIES.position[i];
+		back->previous_position[j] = ENTITIES.previous_position[i];
+		back->velocity[j] = ENTITIES.velocity[i];
+		back->size[j] = ENTITIES.size[i];
+		back->kind[j] = ENTITIES.kind[i];
+		back->flags[j] = ENTITIES.flags[i];
+		back->handle[j] = ENTITIES.handle[i];
+
+		MANAGER.slots[back->handle[j]] = j;
+	}
+
+	back->count = count;
+
+	const entity_manager front = ENTITIES;
+	ENTITIES = *back;
+	*back = front;
+
+	// cut the partitions into batches of whole chunks
+	MANAGER.batch_count = 0;
+	uint32_t in_batch = ENTITY_BATCH_SIZE;
+
+	for (size_t p = 0; p < MANAGER.partition_count; p++) {
+		if (in_batch >= ENTITY_BATCH_SIZE) {
+			MANAGER.batch_start[MANAGER.batch_count++] = p;
+			in_batch = 0;
+		}
+		in_batch += MANAGER.partitions[p].count;
+	}
+	MANAGER.batch_start[MANAGER.batch_count] = MANAGER.partition_count;
+
+	return true;
+}
+
+// SPATIAL HASH
+
+static inline Vector3 entities_center(size_t i) {
+	return (Vector3){
+		ENTITIES.position[i].x,
+		ENTITIES.position[i].y + ENTITIES.size[i].y * 0.5f,
+		ENTITIES.position[i].z,
+	};
+}
+
+static inline void entities_box(size_t i, Vector3* min, Vector3* max) {
+	const Vector3 p = ENTITIES.position[i];
+	const Vector3 s = ENTITIES.size[i];
+
+	*min = (Vector3){ p.x - s.x * 0.5f, p.y, p.z - s.z * 0.5f };
+	*max = (Vector3){ p.x + s.x * 0.5f, p.y + s.y, p.z + s.z * 0.5f };
+}
+
+static inline bool entities_boxes_overlap(Vector3 a_min, Vector3 a_max, Vector3 b_min, Vector3 b_max) {
+	return a_min.x < b_max.x && a_max.x > b_min.x
+		&& a_min.y < b_max.y && a_max.y > b_min.y
+		&& a_min.z < b_max.z && a_max.z > b_min.z;
+}
+
+static inline int entities_cell(float v) {
+	return (int)floorf(v * (1.0f / ENTITY_HASH_CELL));
+}
+
+static bool entities_build_hash(void) {
+	TRACE_ZONE("entities_build_hash");
+
+	const size_t count = ENTITIES.count;
+	const size_t bucket_count = entities_pow2_at_least(count);
+
+	if (bucket_count > MANAGER.bucket_count) {
+		if (!entities_grow_array((void**)&MANAGER.bucket_start, sizeof(uint32_t), bucket_count + 1)) {
+			fputs("ERROR: Failed to allocate memory for the entity hash\n", stderr);
+			return false;
+		}
+	}
+	MANAGER.bucket_count = bucket_count;
+
+	const uint32_t mask = bucket_count - 1;
+	memset(MANAGER.bucket_start, 0, sizeof(uint32_t) * (bucket_count + 1));
+
+	MANAGER.largest = Vector3Zero();
+
+	// count, then turn the counts into the end of each bucket and fill backwards
+	for (size_t i = 0; i < count; i++) {
+		const Vector3 c = entities_center(i);
+		const uint32_t b = entities_hash(entities_cell(c.x), entities_cell(c.y), entities_cell(c.z)) & mask;
+
+		MANAGER.partition_of[i] = b;
+		MANAGER.bucket_start[b + 1]++;
+		MANAGER.largest = Vector3Max(MANAGER.largest, ENTITIES.size[i]);
+	}
+
+	for (size_t b = 0; b < bucket_count; b++)
+		MANAGER.bucket_start[b + 1] += MANAGER.bucket_start[b];
+
+	for (size_t i = count; i-- > 0;) {
+		const uint32_t b = MANAGER.partition_of[i];
+		const Vector3 c = entities_center(i);
+		entity_hash_entry* entry = &MANAGER.bucket_entries[--MANAGER.bucket_start[b + 1]];
+
+		*entry = (entity_hash_entry){
+			.entity = i,
+			.x = entities_cell(c.x),
+			.y = entities_cell(c.y),
+			.z = entities_cell(c.z),
+		};
+		entities_box(i, &entry->min, &entry->max);
+	}
+
+	// bucket_start[b + 1] now holds where bucket b starts, shift it down
+	memmove(MANAGER.bucket_start, MANAGER.bucket_start + 1, sizeof(uint32_t) * bucket_count);
+	MANAGER.bucket_start[bucket_count] = count;
+
+	MANAGER.hash_dirty = false;
+
+	return true;
+}
+
+
+// entities_query against the hash as it is, safe to run on several threads
+static size_t entities_query_hash(Vector3 min, Vector3 max, uint32_t* results, size_t max_results) {
+	const Vector3 half = Vector3Scale(MANAGER.largest, 0.5f);
+	const int x0 = entities_cell(min.x - half.x), x1 = entities_cell(max.x + half.x);
+	const int y0 = entities_cell(min.y - half.y), y1 = entities_cell(max.y + half.y);
+	const int z0 = entities_cell(min.z - half.z), z1 = entities_cell(max.z + half.z);
+
+	size_t found = 0;
+
+	// a box covering more cells than there are entities is quicker to check one by one
+	if ((double)(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1) > ENTITIES.count) {
+		for (size_t i = 0; i < ENTITIES.count; i++) {
+			Vector3 entity_min, entity_max;
+			entities_box(i, &entity_min, &entity_max);
+
+			if (!entities_boxes_overlap(entity_min, entity_max, min, max))
+				continue;
+			if (found < max_results)
+				results[found] = i;
+			found++;
+		}
+		return found;
+	}
+
+	const uint32_t mask = MANAGER.bucket_count - 1;
+
+	for (int x = x0; x <= x1; x++) {
+		for (int y = y0; y <= y1; y++) {
+			for (int z = z0; z <= z1; z++) {
+				const uint32_t b = entities_hash(x, y, z) & mask;
+
+				for (uint32_t k = MANAGER.bucket_start[b]; k < MANAGER.bucket_start[b + 1]; k++) {
+					const entity_hash_entry* entry = &MANAGER.bucket_entries[k];
+
+					// other cells share buckets, only take this cell's entities once
+					if (entry->x != x || entry->y != y || entry->z != z)
+						continue;
+					if (!entities_boxes_overlap(entry->min, entry->max, min, max))
+						continue;
+
+					if (found < max_results)
+						results[found] = entry->entity;
+					found++;
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+size_t entities_query(Vector3 min, Vector3 max, uint32_t* results, size_t max_results) {
+	if (MANAGER.hash_dirty && !entities_build_hash())
+		return 0;
+
+	return entities_query_hash(min, max, results, max_results);
+}
+
+// BATCHES
+
+static void entities_run_phase_batches(uint32_t generation) {
+	for (;;) {
+		uint64_t next = atomic_load_explicit(&PHASE.next, memory_order_acquire);
+		uint32_t batch, count;
+
+		do {
+			count = (next >> 16) & 0xffff;
+			batch = next & 0xffff;
+
+			if ((uint32_t)(next >> 32) != generation || batch >= count)
+				return;
+		} while (!atomic_compare_exchange_weak_explicit(&PHASE.next, &next, next + 1,
+				memory_order_acq_rel, memory_order_acquire));
+
+		PHASE.func(MANAGER.batch_start[batch], MANAGER.batch_start[batch + 1], PHASE.delta_t);
+
+		// the main thread may start the next phase as soon as this is counted, touch nothing shared after
+		if (atomic_fetch_add_explicit(&PHASE.done, 1, memory_order_acq_rel) + 1 == count) {
+			pthread_mutex_lock(&PHASE.lock);
+			pthread_cond_broadcast(&PHASE.finished);
+			pthread_mutex_unlock(&PHASE.lock);
+		}
+	}
+}
+
+static void entities_phase_job(void* args) {
+	entities_run_phase_batches((uint32_t)(uintptr_t)args);
+}
+
+/* Run func over every batch and wait for all of them. The main
+ * thread takes batches too, so a phase finishes even while every
+ * worker is busy generating chunks.
+ */
+static void entities_run_phase(entity_batch_func func, float delta_t) {
+	if (MANAGER.batch_count == 0)
+		return;
+
+	// too few entities to be worth waking anyone up
+	if (MANAGER.batch_count == 1 || MANAGER.batch_count > 0xffff) {
+		func(0, MANAGER.partition_count, delta_t);
+		return;
+	}
+
+	const uint32_t generation = ++PHASE.generation;
+
+	PHASE.func = func;
+	PHASE.delta_t = delta_t;
+	atomic_store_explicit(&PHASE.done, 0, memory_order_relaxed);
+	atomic_store_explicit(&PHASE.next, (uint64_t)generation << 32 | (uint64_t)MANAGER.batch_count << 16, memory_order_release);
+
+	unsigned int helpers = worker_pool_thread_count();
+	if (helpers > MANAGER.batch_count - 1)
+		helpers = MANAGER.batch_count - 1;
+
+	for (unsigned int i = 0; i < helpers; i++)
+		worker_pool_submit_urgent(entities_phase_job, (void*)(uintptr_t)generation);
+
+	entities_run_phase_batches(generation);
+
+	pthread_mutex_lock(&PHASE.lock);
+	while (atomic_load_explicit(&PHASE.done, memory_order_acquire) < MANAGER.batch_count)
+		pthread_cond_wait(&PHASE.finished, &PHASE.lock);
+	pthread_mutex_unlock(&PHASE.lock);
+}
+
+// UPDATE
+
+// push solid entities out of each other, only writes the velocity of the batch's entities
+static void entities_push_batch(uint32_t first_partition, uint32_t end_partition, float delta_t) {
+	TRACE_ZONE("entities_push_batch");
+
+	const size_t first = MANAGER.partitions[first_partition].first;
+	const size_t end = MANAGER.partitions[end_partition - 1].first + MANAGER.partitions[end_partition - 1].count;
+
+	uint32_t neighbours[ENTITY_MAX_NEIGHBOURS];
+
+	for (size_t i = first; i < end; i++) {
+		if (!(ENTITIES.flags[i] & ENTITY_FLAG_SOLID))
+			continue;
+
+		const Vector3 p = ENTITIES.position[i];
+		const Vector3 s = ENTITIES.size[i];
+
+		Vector3 min, max;
+		entities_box(i, &min, &max);
+
+		size_t found = entities_query_hash(min, max, neighbours, ENTITY_MAX_NEIGHBOURS);
+		if (found > ENTITY_MAX_NEIGHBOURS)
+			found = ENTITY_MAX_NEIGHBOURS;
+
+		Vector3 push = {0};
+
+		for (size_t k = 0; k < found; k++) {
+			const uint32_t j = neighbours[k];
+			if (j == i || !(ENTITIES.flags[j] & ENTITY_FLAG_SOLID))
+				continue;
+
+			const Vector3 q = ENTITIES.position[j];
+			const Vector3 t = ENTITIES.size[j];
+
+			// sideways only, along whichever axis overlaps least
+			const float overlap_x = (s.x + t.x) * 0.5f - fabsf(p.x - q.x);
+			const float overlap_z = (s.z + t.z) * 0.5f - fabsf(p.z - q.z);
+
+			// entities at the same spot are split by handle
+			const float away = ENTITIES.handle[i] < ENTITIES.handle[j] ? -1.0f : 1.0f;
+
+			if (overlap_x < overlap_z)
+				push.x += (p.x != q.x ? (p.x > q.x ? 1.0f : -1.0f) : away) * overlap_x;
+			else
+				push.z += (p.z != q.z ? (p.z > q.z ? 1.0f : -1.0f) : away) * overlap_z;
+		}
+
+		ENTITIES.velocity[i] = Vector3Add(ENTITIES.velocity[i], Vector3Scale(push, ENTITY_PUSH * delta_t));
+	}
+}
+
+// forces and block collision, each chunk's entities share one occupancy cache
+static void entities_move_batch(uint32_t first_partition, uint32_t end_partition, float delta_t) {
+	TRACE_ZONE("entities_move_batch");
+
+	for (uint32_t p = first_partition; p < end_partition; p++) {
+		const entity_partition* partition = &MANAGER.partitions[p];
+		const size_t first = partition->first;
+		const size_t end = first + partition->count;
+
+		occupancy_cache cache;
+		occupancy_cache_init(&cache, partition->chunk);
+
+		// hold everyone still until the chunk under them has been generated
+		if (occupancy_resolve(&cache, 0, 0) == NULL) {
+			for (size_t i = first; i < end; i++)
+				ENTITIES.previous_position[i] = ENTITIES.position[i];
+			continue;
+		}
+
+		for (size_t i = first; i < end; i++) {
+			Vector3* velocity = &ENTITIES.velocity[i];
+			uint8_t* flags = &ENTITIES.flags[i];
+
+			ENTITIES.previous_position[i] = ENTITIES.position[i];
+
+			if (ENTITIES.kind[i] != ENTITY_KIND_PROJECTILE) {
+				const float friction = (*flags & ENTITY_FLAG_ON_GROUND) ? ENTITY_GROUND_FRICTION : ENTITY_AIR_FRICTION;
+				const float keep = fmaxf(0, 1 - friction * delta_t);
+
+				velocity->x *= keep;
+				velocity->z *= keep;
+			}
+
+			if (!(*flags & ENTITY_FLAG_NO_GRAVITY))
+				velocity->y += ENTITY_GRAVITY * delta_t;
+
+			if (entity_sweep(&cache, &ENTITIES.position[i], ENTITIES.size[i], velocity, delta_t))
+				*flags |= ENTITY_FLAG_ON_GROUND;
+			else
+				*flags &= ~ENTITY_FLAG_ON_GROUND;
+		}
+	}
+}
+
+void entities_update(float delta_t) {
+	TRACE_ZONE("entities_update");
+
+	if (ENTITIES.count == 0)
+		return;
+
+	if (!entities_partition() || !entities_build_hash())
+		return;
+
+	entities_run_phase(entities_push_batch, delta_t);
+	entities_run_phase(entities_move_batch, delta_t);
+
+	// everyone moved
+	MANAGER.hash_dirty = true;
+}
+
+void entities_draw(float alpha) {
+	const Color kind_colors[] = {
+		[ENTITY_KIND_MOB] = RED,
+		[ENTITY_KIND_ITEM] = YELLOW,
+		[ENTITY_KIND_PROJECTILE] = WHITE,
+	};
+
+	for (size_t i = 0; i < ENTITIES.count; i++) {
+		const Vector3 p = Vector3Lerp(ENTITIES.previous_position[i], ENTITIES.position[i], alpha);
+		const Vector3 s = ENTITIES.size[i];
+
+		DrawCubeWires((Vector3){ p.x, p.y + s.y * 0.5f, p.z }, s.x, s.y, s.z, kind_colors[ENTITIES.kind[i]]);
+	}
+}
+
+static void entities_free_manager(entity_manager* m) {
+	free(m->position);
+	free(m->previous_position);
+	free(m->velocity);
+	free(m->size);
+	free(m->kind);
+	free(m->flags);
+	free(m->handle);
+
+	*m = (entity_manager){0};
+}
+
+void entities_destroy(void) {
+	entities_free_manager(&ENTITIES);
+	entities_free_manager(&MANAGER.back);
+
+	free(MANAGER.slots);
+	free(MANAGER.partition_of);
+	free(MANAGER.partition_table);
+	free(MANAGER.partitions);
+	free(MANAGER.batch_start);
+	free(MANAGER.bucket_start);
+	free(MANAGER.bucket_entries);
+
+	MANAGER.slots = NULL;
+	MANAGER.slot_capacity = 0;
+	MANAGER.free_handle = ENTITY_HANDLE_NONE;
+	MANAGER.partition_of = NULL;
+	MANAGER.partition_table = NULL;
+	MANAGER.partition_table_size = 0;
+	MANAGER.partitions = NULL;
+	MANAGER.partition_count = 0;
+	MANAGER.partition_capacity = 0;
+	MANAGER.batch_start = NULL;
+	MANAGER.batch_count = 0;
+	MANAGER.bucket_start = NULL;
+	MANAGER.bucket_entries = NULL;
+	MANAGER.bucket_count = 0;
+	MANAGER.hash_dirty = true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <raylib.h>
+
+/* Every simulated entity other than the player: mobs, dropped
+ * items and projectiles.
+ *
+ * Entities are stored as structure of arrays in ENTITIES, index i
+ * of every array is the same entity. entities_update keeps them
+ * sorted by the chunk they are in, so each chunk's entities are
+ * next to each other in memory and are simulated together, with
+ * chunks split across the worker pool.
+ *
+ * Indices change whenever entities are updated, spawned or
+ * despawned. Keep an entity_handle to refer to one entity for
+ * longer and look its index up with entities_index.
+ *
+ * Main thread only. entities_update hands batches to the worker
+ * pool and waits for them, the workers only write their own
+ * batch's entities and look chunks up, see world_chunk_lookup.
+ */
+
+typedef uint32_t entity_handle;
+
+#define ENTITY_HANDLE_NONE UINT32_MAX
+
+typedef enum {
+	ENTITY_KIND_MOB,
+	ENTITY_KIND_ITEM,
+	ENTITY_KIND_PROJECTILE,
+} entity_kind;
+
+typedef enum {
+	ENTITY_FLAG_ON_GROUND  = 1 << 0, // set by entities_update
+	ENTITY_FLAG_NO_GRAVITY = 1 << 1,
+	ENTITY_FLAG_SOLID      = 1 << 2, // pushed apart from other solid entities
+} entity_flag;
+
+typedef struct {
+	size_t count;
+	size_t capacity;
+
+	// position is at the center of the bottom face, like entity
+	Vector3* position;
+	Vector3* previous_position; // before the last update, for drawing between ticks
+	Vector3* velocity;
+	Vector3* size;
+	uint8_t* kind;  // entity_kind
+	uint8_t* flags; // entity_flag bits
+	entity_handle* handle;
+} entity_manager;
+
+extern entity_manager ENTITIES;
+
+/* Add an entity. Returns ENTITY_HANDLE_NONE if there is no memory
+ * for it.
+ */
+entity_handle entities_spawn(entity_kind kind, Vector3 position, Vector3 size, Vector3 velocity, uint8_t flags);
+
+/* Remove an entity. Its handle may be given to a later spawn.
+ */
+void entities_despawn(entity_handle handle);
+
+/* Current index of an entity in ENTITIES, or SIZE_MAX if the
+ * handle is not in use.
+ */
+size_t entities_index(entity_handle handle);
+
+/* Simulate every entity for delta_t seconds: gravity, friction,
+ * pushing solid entities apart and moving through the blocks
+ * with entity_sweep.
+ */
+void entities_update(float delta_t);
+
+/* Find the entities whose boxes overlap the box from min to max,
+ * writing up to max_results indices to results. Returns how many
+ * overlap, which may be more than max_results.
+ */
+size_t entities_query(Vector3 min, Vector3 max, uint32_t* results, size_t max_results);
+
+/* Draw every entity's box alpha of the way from its last update
+ * to its next. Call between BeginMode3D and EndMode3D.
+ */
+void entities_draw(float alpha);
+
+/* Remove every entity and free the manager's memory
+ */
+void entities_destroy(void);
@@ -5,6 +5,8 @@
 #include <raymath.h>
 
 #include "entity.h"
+#include "occupancy.h"
+#include "trace.h"
 #include "world.h"
 
 bool entity_aabb(entity* e, Vector3 block_pos, Vector3* collision_depth) {
@@ -64,202 +66,166 @@ bool entity_aabb(entity* e, Vector3 block_pos, Vector3* collision_depth) {
 	return true;
 }
 
-/* Swept aabb collision detection
+// how far touching boxes may overlap from float rounding
+#define ENTITY_SKIN 1e-4f
+
+/* Block indices of the layers the entity's box covers along axis,
+ * min inclusive, max exclusive. Boxes just touching a layer do not
+ * cover it. y block indices are one above the world coordinate,
+ * see occupancy.h.
  */
-RayCollision entity_aabb_swept(entity e, BoundingBox b) {
-	// add entity size to box size
-	b.max.x += e.size.x * 0.5f;
-	b.max.y += e.size.y * 0.5f;
-	b.max.z += e.size.z * 0.5f;
-
-	b.min.x -= e.size.x * 0.5f;
-	b.min.y -= e.size.y * 0.5f;
-	b.min.z -= e.size.z * 0.5f;
-
-	// point ray in direction of movement
-	Ray ray = {
-		.position = Vector3Add(e.position, (Vector3){.y = e.size.y * 0.5f}),
-		.direction = Vector3Normalize(e.velocity),
-	};
+static void entity_box_cells(const Vector3* min, const Vector3* max, int axis, int* lo, int* hi) {
+	const int offset = axis == 1;
 
-	// let raylib do the rest
-	return GetRayCollisionBox(ray, b);
+	*lo = (int)floorf((&min->x)[axis] + ENTITY_SKIN) + offset;
+	*hi = (int)ceilf((&max->x)[axis] - ENTITY_SKIN) + offset;
 }
 
-void entity_block_collision(entity* e) {
-	e->is_on_ground = 0;
+/* Move the box along one axis by d, stopping at the first solid
+ * layer of blocks in the way. Only the layers the box's leading
+ * face moves into are scanned, so a box already inside a block
+ * can still move out of it.
+ * Returns how far the box actually moved.
+ */
+static float entity_sweep_axis(occupancy_cache* cache, Vector3* min, Vector3* max, int axis, float d) {
+	if (d == 0)
+		return 0;
+
+	int lo[3], hi[3];
+	for (int a = 0; a < 3; a++)
+		entity_box_cells(min, max, a, &lo[a], &hi[a]);
+
+	const int offset = axis == 1;
+	int first, last, step;
+
+	// layers by the world coordinate they start at, nearest first
+	if (d > 0) {
+		const float face = (&max->x)[axis];
+		first = (int)ceilf(face - ENTITY_SKIN);
+		last = (int)ceilf(face + d) - 1;
+		step = 1;
+	} else {
+		const float face = (&min->x)[axis];
+		first = (int)floorf(face + ENTITY_SKIN) - 1;
+		last = (int)floorf(face + d);
+		step = -1;
+	}
 
-	// collision has to be checked 3 times
-	// once for each axis
-	for (unsigned int axis = 0; axis < 3; axis++) {
+	for (int c = first; c != last + step; c += step) {
+		lo[axis] = c + offset;
+		hi[axis] = c + offset + 1;
 
-		// chunk that the player is inside
-		world_chunk_pos player_chunk_pos = { 
-			floorf(e->position.x / WORLD_CHUNK_WIDTH),
-			floorf(e->position.z / WORLD_CHUNK_WIDTH),
-		};
+		if (!occupancy_any_solid(cache, lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]))
+			continue;
 
-		chunk* player_chunk = world_chunk_lookup(player_chunk_pos);
-		
-		if (player_chunk == NULL) {
-			fprintf(stderr, "WARNING: Player is inside an unloded chunk\n");
-			return;
-		}
+		// stop against the layer, never move backwards
+		if (d > 0)
+			d = fmaxf(0, c - (&max->x)[axis]);
+		else
+			d = fminf(0, c + 1 - (&min->x)[axis]);
+		break;
+	}
 
-		float delta_t = GetFrameTime();
-
-		RayCollision nearest_collision = {
-			.distance = INFINITY,
-			.hit = 0,
-		};
-		// ------- broadphase calculation -------
-		Vector3 frame_travel = Vector3Scale(e->velocity, delta_t);
-
-		// broadphase box
-		BoundingBox bphase = {
-			.max = Vector3Add(e->position, frame_travel),
-			.min = e->position,
-		};
-
-		const float padding = 0.0f;
-
-		// adjustments to include entire entity in
-		// current and next frame
-		if (e->velocity.x > 0) {
-			bphase.min.x -= (e->size.x + padding) * 0.5f;
-			bphase.max.x += (e->size.x + padding) * 0.5f;
-		} else {
-			bphase.min.x += (e->size.x + padding) * 0.5f;
-			bphase.max.x -= (e->size.x + padding) * 0.5f;
-		}
+	(&min->x)[axis] += d;
+	(&max->x)[axis] += d;
 
-		if (e->velocity.y > 0) {
-			bphase.max.y += (e->size.y + padding);
-		} else {
-			bphase.min.y += (e->size.y + padding);
-		}
+	return d;
+}
 
-		if (e->velocity.z > 0) {
-			bphase.min.z -= (e->size.z + padding) * 0.5f;
-			bphase.max.z += (e->size.z + padding) * 0.5f;
-		} else {
-			bphase.min.z += (e->size.z + padding) * 0.5f;
-			bphase.max.z -= (e->size.z + padding) * 0.5f;
-		}
+// make sure the cache is around the chunk holding (x, z)
+static void entity_cache_follow(occupancy_cache* cache, float x, float z) {
+	const world_chunk_pos pos = {
+		floorf(x / WORLD_CHUNK_WIDTH),
+		floorf(z / WORLD_CHUNK_WIDTH),
+	};
 
-		int start_x, start_y, start_z;
-		int end_x, end_y, end_z;
+	if (pos.x != cache->center.x || pos.z != cache->center.z)
+		occupancy_cache_init(cache, pos);
+}
 
-		if (bphase.min.x > bphase.max.x) {
-			start_x = floorf(bphase.max.x);
-			end_x = ceilf(bphase.min.x);
-		} else {
-			start_x = floorf(bphase.min.x);
-			end_x = ceilf(bphase.max.x); 
-		}
+bool entity_sweep(occupancy_cache* cache, Vector3* position, Vector3 size, Vector3* velocity, float delta_t) {
+	const Vector3 travel = Vector3Scale(*velocity, delta_t);
 
-		if (bphase.min.y > bphase.max.y) {
-			start_y = floorf(bphase.max.y);
-			end_y = ceilf(bphase.min.y);
-		} else {
-			start_y = floorf(bphase.min.y);
-			end_y = ceilf(bphase.max.y); 
-		}
+	entity_cache_follow(cache, position->x, position->z);
 
-		if (bphase.min.z > bphase.max.z) {
-			start_z = floorf(bphase.max.z);
-			end_z = ceilf(bphase.min.z);
-		} else {
-			start_z = floorf(bphase.min.z);
-			end_z = ceilf(bphase.max.z); 
-		}
+	// nothing to collide with until the chunk is generated
+	if (occupancy_resolve(cache, 0, 0) == NULL) {
+		*position = Vector3Add(*position, travel);
+		return false;
+	}
+
+	Vector3 min = {
+		position->x - size.x * 0.5f,
+		position->y,
+		position->z - size.z * 0.5f,
+	};
+	Vector3 max = {
+		position->x + size.x * 0.5f,
+		position->y + size.y,
+		position->z + size.z * 0.5f,
+	};
 
-		for (int x = start_x; x < end_x; x++) {
-		for (int y = start_y; y < end_y; y++) {
-		for (int z = start_z; z < end_z; z++) {
+	/* Moving each axis the whole way in one go would turn a
+	 * diagonal into an L, so fast movers go in steps of at most
+	 * a block. Each step only scans the layers it moves into,
+	 * the cost follows the distance travelled.
+	 */
+	const float longest = fmaxf(fabsf(travel.x), fmaxf(fabsf(travel.y), fabsf(travel.z)));
+	const int steps = longest > 1 ? (int)ceilf(longest) : 1;
+	const Vector3 step = Vector3Scale(travel, 1.0f / steps);
 
-			chunk* chunk = player_chunk;
-			world_chunk_pos chunk_pos;
+	Vector3 moved = {0};
+	bool blocked[3] = {0};
 
-			// dont check collision outside of block range
-			if (y < 0 || y > WORLD_CHUNK_HEIGHT)
-				continue;
+	for (int i = 0; i < steps; i++) {
+		// the cache only reaches a chunk past the one the entity is in
+		if (i > 0)
+			entity_cache_follow(cache, (min.x + max.x) * 0.5f, (min.z + max.z) * 0.5f);
 
-			if (x - player_chunk_pos.x * WORLD_CHUNK_WIDTH >= WORLD_CHUNK_WIDTH)
-				chunk_pos.x = player_chunk_pos.x + 1;
-			else if (x - player_chunk_pos.x * WORLD_CHUNK_WIDTH < 0)
-				chunk_pos.x = player_chunk_pos.x - 1;
-			else
-				chunk_pos.x = player_chunk_pos.x;
-
-			if (z - player_chunk_pos.z * WORLD_CHUNK_WIDTH >= WORLD_CHUNK_WIDTH)
-				chunk_pos.z = player_chunk_pos.z + 1;
-			else if (z - player_chunk_pos.z * WORLD_CHUNK_WIDTH < 0)
-				chunk_pos.z = player_chunk_pos.z - 1;
-			else
-				chunk_pos.z = player_chunk_pos.z;
-
-			if (
-					chunk_pos.x != player_chunk_pos.x ||
-					chunk_pos.z != player_chunk_pos.z
-			   ) {
-
-				// check adjacent chunk
-				chunk = world_chunk_lookup(chunk_pos);
-
-				// dont check empty chunks for collision
-				if (chunk == NULL) {
-					fprintf(stderr, "WARNING: Player is entering an unloded chunk\n");
-					continue;
-				}
-			}
-
-			// adjust xyz to be relative to chunk
-			// done this way due to how % handles negative numbers
-			// this is otherwise the same as `x % WORLD_CHUNK_WIDTH`
-			int cx = ((x % WORLD_CHUNK_WIDTH) + WORLD_CHUNK_WIDTH) % WORLD_CHUNK_WIDTH;
-			int cy = y;
-			int cz = ((z % WORLD_CHUNK_WIDTH) + WORLD_CHUNK_WIDTH) % WORLD_CHUNK_WIDTH;
-
-			Vector3 block_pos = get_block_real_pos(chunk_pos, cx, cy, cz);
-
-			// dont check air blocks
-			if (chunk->blocks[cx][cy][cz].id == 0)
+		for (int axis = 0; axis < 3; axis++) {
+			if (blocked[axis])
 				continue;
 
-			BoundingBox box = {
-				.max = block_pos,
-				.min = (Vector3){
-					block_pos.x - 1,
-					block_pos.y - 1,
-					block_pos.z - 1,
-				},
-			};
-
-			RayCollision collision = entity_aabb_swept(*e, box);
-
-			if (collision.hit && collision.distance < nearest_collision.distance)
-				nearest_collision = collision;
-		}}}
-
-		// collision response
-		if (nearest_collision.hit && nearest_collision.distance <= Vector3Length(e->velocity) * delta_t) {
-			// slide
-			Vector3 norm = nearest_collision.normal;
-			norm.x = norm.x == 0;
-			norm.y = norm.y == 0;
-			norm.z = norm.z == 0;
-
-			e->velocity = Vector3Multiply(e->velocity, norm);
-
-			if (nearest_collision.normal.y == 1)
-				e->is_on_ground = 1;
+			const float d = (&step.x)[axis];
+			const float done = entity_sweep_axis(cache, &min, &max, axis, d);
+
+			(&moved.x)[axis] += done;
+			if (done != d)
+				blocked[axis] = true;
 		}
 	}
+
+	*position = Vector3Add(*position, moved);
+
+	// slide along whatever was hit
+	if (blocked[0])
+		velocity->x = 0;
+	if (blocked[1])
+		velocity->y = 0;
+	if (blocked[2])
+		velocity->z = 0;
+
+	return blocked[1] && travel.y < 0;
+}
+
+void entity_move(entity* e, float delta_t) {
+	TRACE_ZONE("entity_move");
+
+	occupancy_cache cache;
+	occupancy_cache_init(&cache, (world_chunk_pos){
+		floorf(e->position.x / WORLD_CHUNK_WIDTH),
+		floorf(e->position.z / WORLD_CHUNK_WIDTH),
+	});
+
+	e->is_on_ground = entity_sweep(&cache, &e->position, e->size, &e->velocity, delta_t);
+}
+
+Vector3 entity_interpolate_position(const entity* e, float alpha) {
+	return Vector3Lerp(e->previous_position, e->position, alpha);
 }
 
-void entity_add_force(entity* e, Vector3 force) {
-	e->velocity = Vector3Add(e->velocity, Vector3Scale(force, GetFrameTime()));
+void entity_add_force(entity* e, Vector3 force, float delta_t) {
+	e->velocity = Vector3Add(e->velocity, Vector3Scale(force, delta_t));
 }
 
 void entity_add_impulse(entity* e, Vector3 force) {
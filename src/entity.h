@@ -1,12 +1,14 @@
 #pragma once
 
 #include <raylib.h>
+#include "occupancy.h"
 #include "world.h"
 
 // entities are moveable objects/characters with an aabb collider 
 typedef struct {
 	int id;
 	Vector3 position; // location at the center of the bottom face
+	Vector3 previous_position; // position before the last tick, for drawing between ticks
 	Vector3 velocity;
 	Vector3 size;
 	float mass;
@@ -22,17 +24,30 @@ typedef struct {
  */
 bool entity_aabb(entity* e, Vector3 block_pos, Vector3* collision_depth);
 
-RayCollision entity_aabb_swept(entity e, BoundingBox b);
+/* Move an entity by its velocity for delta_t seconds, sliding
+ * along the blocks in its way. x, y and z are moved in turn,
+ * in steps of at most a block so fast entities cannot pass
+ * through walls. Velocity along a blocked axis is zeroed.
+ */
+void entity_move(entity* e, float delta_t);
 
-/* Handler for entity/block collision in world
+/* What entity_move does, for a box that is not an entity struct.
+ * cache is moved to follow the box, so one cache can be shared by
+ * many boxes near each other. Returns whether the box landed on
+ * the ground.
  */
-void entity_block_collision(entity* e);
+bool entity_sweep(occupancy_cache* cache, Vector3* position, Vector3 size, Vector3* velocity, float delta_t);
 
 // PHYSICS
 
-/* called per-frame to add a force vector
+/* Where to draw e when alpha of the way from its last tick to
+ * its next one
+ */
+Vector3 entity_interpolate_position(const entity* e, float alpha);
+
+/* called every tick to add a force vector over delta_t seconds
  */
-void entity_add_force(entity* e, Vector3 force);
+void entity_add_force(entity* e, Vector3 force, float delta_t);
 
 /* called once to add an impulse (instantaneous force)
  */
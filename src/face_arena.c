@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+
+#include <raylib.h>
+#include <rlgl.h>
+
+// rlgl has no indirect draws or buffer to buffer copies
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "face_arena.h"
+#include "trace.h"
+
+// faces the buffer starts with, it doubles from there
+#define FACE_ARENA_INITIAL_CAPACITY (1u << 16)
+
+// faces converted at a time by face_arena_write
+#define FACE_ARENA_WRITE_BATCH 1024
+
+// layout of glMultiDrawArraysIndirect's commands
+typedef struct {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first;
+	GLuint base_instance;
+} face_arena_command;
+
+static struct {
+	unsigned int vao_id;
+	unsigned int quad_vbo_id;
+	unsigned int face_vbo_id;
+	unsigned int capacity; // faces face_vbo_id has room for
+	unsigned int face_offset; // first face the instance attributes point at
+
+	// unused ranges sorted by first, neighbours are always merged
+	face_arena_range* free;
+	size_t free_count;
+	size_t free_capacity;
+
+	int indirect; // -1 until the GL version is checked
+	GLuint command_buffer_id;
+	size_t command_buffer_capacity; // in commands
+	face_arena_command* commands;
+	size_t commands_capacity;
+
+	unsigned int draw_calls;
+} FACE_ARENA = { .indirect = -1 };
+
+// corners of the unit quad every face is expanded from, see chunk_vert.glsl
+static const float FACE_ARENA_QUAD_VERTICES[] = {
+	0, 0, 0,
+	1, 0, 0,
+	1, 0, 1,
+	0, 0, 0,
+	1, 0, 1,
+	0, 0, 1,
+};
+
+// point the instance attributes of the bound VAO at face first onwards
+static void face_arena_set_attributes(unsigned int first) {
+	const int offset = first * sizeof(face_arena_face);
+
+	rlEnableVertexBuffer(FACE_ARENA.face_vbo_id);
+	rlSetVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_POSITION, 4, RL_UNSIGNED_BYTE, false, sizeof(face_arena_face), offset);
+	rlSetVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_INFO, 4, RL_UNSIGNED_BYTE, false, sizeof(face_arena_face), offset + 4);
+	rlSetVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_CHUNK, 2, GL_SHORT, false, sizeof(face_arena_face), offset + 8);
+	rlDisableVertexBuffer();
+
+	FACE_ARENA.face_offset = first;
+}
+
+static bool face_arena_insert_free(size_t index, face_arena_range range) {
+	if (FACE_ARENA.free_count == FACE_ARENA.free_capacity) {
+		size_t new_capacity = FACE_ARENA.free_capacity ? FACE_ARENA.free_capacity * 2 : 64;
+		face_arena_range* ranges = realloc(FACE_ARENA.free, sizeof(*ranges) * new_capacity);
+
+		if (ranges == NULL) {
+			fputs("Failed to allocate memory for the face arena free list\n", stderr);
+			return false;
+		}
+
+		FACE_ARENA.free = ranges;
+		FACE_ARENA.free_capacity = new_capacity;
+	}
+
+	memmove(&FACE_ARENA.free[index + 1], &FACE_ARENA.free[index], sizeof(face_arena_range) * (FACE_ARENA.free_count - index));
+	FACE_ARENA.free[index] = range;
+	FACE_ARENA.free_count++;
+
+	return true;
+}
+
+static void face_arena_remove_free(size_t index) {
+	FACE_ARENA.free_count--;
+	memmove(&FACE_ARENA.free[index], &FACE_ARENA.free[index + 1], sizeof(face_arena_range) * (FACE_ARENA.free_count - index));
+}
+
+static bool face_arena_create(void) {
+	if (!face_arena_insert_free(0, (face_arena_range){ 0, FACE_ARENA_INITIAL_CAPACITY }))
+		return false;
+
+	FACE_ARENA.quad_vbo_id = rlLoadVertexBuffer(FACE_ARENA_QUAD_VERTICES, sizeof(FACE_ARENA_QUAD_VERTICES), false);
+	FACE_ARENA.face_vbo_id = rlLoadVertexBuffer(NULL, FACE_ARENA_INITIAL_CAPACITY * sizeof(face_arena_face), true);
+	FACE_ARENA.capacity = FACE_ARENA_INITIAL_CAPACITY;
+
+	FACE_ARENA.vao_id = rlLoadVertexArray();
+	rlEnableVertexArray(FACE_ARENA.vao_id);
+
+	rlEnableVertexBuffer(FACE_ARENA.quad_vbo_id);
+	rlSetVertexAttribute(CHUNK_ATTRIB_LOCATION_VERTEX, 3, RL_FLOAT, false, 0, 0);
+	rlEnableVertexAttribute(CHUNK_ATTRIB_LOCATION_VERTEX);
+
+	// per instance face data, the shader reads the bytes as floats
+	face_arena_set_attributes(0);
+	rlSetVertexAttributeDivisor(CHUNK_ATTRIB_LOCATION_FACE_POSITION, 1);
+	rlEnableVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_POSITION);
+	rlSetVertexAttributeDivisor(CHUNK_ATTRIB_LOCATION_FACE_INFO, 1);
+	rlEnableVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_INFO);
+	rlSetVertexAttributeDivisor(CHUNK_ATTRIB_LOCATION_FACE_CHUNK, 1);
+	rlEnableVertexAttribute(CHUNK_ATTRIB_LOCATION_FACE_CHUNK);
+
+	rlDisableVertexArray();
+
+	return true;
+}
+
+// make room for at least needed faces, keeping every face where it is
+static bool face_arena_grow(unsigned int needed) {
+	TRACE_ZONE("face_arena_grow");
+
+	const unsigned int max_capacity = INT_MAX / sizeof(face_arena_face);
+	if (needed > max_capacity)
+		return false;
+
+	unsigned int new_capacity = FACE_ARENA.capacity;
+	while (new_capacity < needed)
+		new_capacity = new_capacity > max_capacity / 2 ? max_capacity : new_capacity * 2;
+
+	const unsigned int old_capacity = FACE_ARENA.capacity;
+
+	// the new space joins the free range at the end if there is one
+	const size_t last = FACE_ARENA.free_count;
+	if (last > 0 && FACE_ARENA.free[last - 1].first + FACE_ARENA.free[last - 1].count == old_capacity)
+		FACE_ARENA.free[last - 1].count += new_capacity - old_capacity;
+	else if (!face_arena_insert_free(last, (face_arena_range){ old_capacity, new_capacity - old_capacity }))
+		return false;
+
+	const unsigned int new_vbo_id = rlLoadVertexBuffer(NULL, new_capacity * sizeof(face_arena_face), true);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, FACE_ARENA.face_vbo_id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo_id);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)old_capacity * sizeof(face_arena_face));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	rlUnloadVertexBuffer(FACE_ARENA.face_vbo_id);
+	FACE_ARENA.face_vbo_id = new_vbo_id;
+	FACE_ARENA.capacity = new_capacity;
+
+	rlEnableVertexArray(FACE_ARENA.vao_id);
+	face_arena_set_attributes(FACE_ARENA.face_offset);
+	rlDisableVertexArray();
+
+	return true;
+}
+
+bool face_arena_alloc(unsigned int count, unsigned int* offset) {
+	if (count == 0) {
+		*offset = 0;
+		return true;
+	}
+
+	if (FACE_ARENA.vao_id == 0 && !face_arena_create())
+		return false;
+
+	for (;;) {
+		// first fit keeps the faces packed towards the start
+		for (size_t i = 0; i < FACE_ARENA.free_count; i++) {
+			face_arena_range* range = &FACE_ARENA.free[i];
+
+			if (range->count < count)
+				continue;
+
+			*offset = range->first;
+			range->first += count;
+			range->count -= count;
+
+			if (range->count == 0)
+				face_arena_remove_free(i);
+
+			return true;
+		}
+
+		// at worst the free range at the end and the new space together fit
+		const face_arena_range* last = FACE_ARENA.free_count > 0 ? &FACE_ARENA.free[FACE_ARENA.free_count - 1] : NULL;
+		const unsigned int at_end = last != NULL && last->first + last->count == FACE_ARENA.capacity ? last->count : 0;
+
+		if ((unsigned long long)FACE_ARENA.capacity + count - at_end > UINT_MAX
+				|| !face_arena_grow(FACE_ARENA.capacity + count - at_end)) {
+			fprintf(stderr, "Failed to grow the face arena to fit %u more faces\n", count);
+			return false;
+		}
+	}
+}
+
+void face_arena_free(unsigned int offset, unsigned int count) {
+	if (count == 0)
+		return;
+
+	// first free range after this one
+	size_t lo = 0, hi = FACE_ARENA.free_count;
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+
+		if (FACE_ARENA.free[mid].first < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	face_arena_range* prev = lo > 0 ? &FACE_ARENA.free[lo - 1] : NULL;
+	face_arena_range* next = lo < FACE_ARENA.free_count ? &FACE_ARENA.free[lo] : NULL;
+	const bool joins_prev = prev != NULL && prev->first + prev->count == offset;
+	const bool joins_next = next != NULL && offset + count == next->first;
+
+	if (joins_prev && joins_next) {
+		prev->count += count + next->count;
+		face_arena_remove_free(lo);
+	} else if (joins_prev)
+		prev->count += count;
+	else if (joins_next) {
+		next->first = offset;
+		next->count += count;
+	} else if (!face_arena_insert_free(lo, (face_arena_range){ offset, count }))
+		fprintf(stderr, "Leaking %u faces of the face arena\n", count);
+}
+
+void face_arena_write(unsigned int offset, world_chunk_pos pos, const chunk_face* faces, unsigned int count) {
+	face_arena_face batch[FACE_ARENA_WRITE_BATCH];
+
+	for (unsigned int done = 0; done < count;) {
+		const unsigned int n = count - done < FACE_ARENA_WRITE_BATCH ? count - done : FACE_ARENA_WRITE_BATCH;
+
+		for (unsigned int i = 0; i < n; i++)
+			batch[i] = (face_arena_face){ faces[done + i], pos.x, pos.z };
+
+		rlUpdateVertexBuffer(FACE_ARENA.face_vbo_id, batch, n * sizeof(face_arena_face), (offset + done) * sizeof(face_arena_face));
+		done += n;
+	}
+}
+
+static int face_arena_range_compare(const void* a, const void* b) {
+	const unsigned int first_a = ((const face_arena_range*)a)->first;
+	const unsigned int first_b = ((const face_arena_range*)b)->first;
+
+	return (first_a > first_b) - (first_a < first_b);
+}
+
+// one glMultiDrawArraysIndirect for every range
+static void face_arena_draw_indirect(const face_arena_range* ranges, size_t count) {
+	if (count > FACE_ARENA.commands_capacity) {
+		face_arena_command* commands = realloc(FACE_ARENA.commands, sizeof(*commands) * count);
+
+		if (commands == NULL) {
+			fputs("Failed to allocate memory for the face arena draw commands\n", stderr);
+			return;
+		}
+
+		FACE_ARENA.commands = commands;
+		FACE_ARENA.commands_capacity = count;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		FACE_ARENA.commands[i] = (face_arena_command){ 6, ranges[i].count, 0, ranges[i].first };
+
+	if (FACE_ARENA.command_buffer_id == 0)
+		glGenBuffers(1, &FACE_ARENA.command_buffer_id);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, FACE_ARENA.command_buffer_id);
+
+	// orphan last frame's commands instead of waiting for the GPU to be done with them
+	if (count > FACE_ARENA.command_buffer_capacity)
+		FACE_ARENA.command_buffer_capacity = count * 2;
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(face_arena_command) * FACE_ARENA.command_buffer_capacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(face_arena_command) * count, FACE_ARENA.commands);
+
+	glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, (GLsizei)count, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	FACE_ARENA.draw_calls = 1;
+}
+
+void face_arena_draw(face_arena_range* ranges, size_t count) {
+	TRACE_ZONE("face_arena_draw");
+
+	FACE_ARENA.draw_calls = 0;
+
+	if (FACE_ARENA.vao_id == 0 || count == 0)
+		return;
+
+	// base instances need OpenGL 4.2 and indirect draws 4.3, raylib only asks for 3.3
+	if (FACE_ARENA.indirect < 0) {
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+		FACE_ARENA.indirect = major > 4 || (major == 4 && minor >= 3);
+	}
+
+	// ranges next to each other in the buffer become one
+	qsort(ranges, count, sizeof(*ranges), face_arena_range_compare);
+
+	size_t merged = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (ranges[i].count == 0)
+			continue;
+
+		if (merged > 0 && ranges[merged - 1].first + ranges[merged - 1].count == ranges[i].first)
+			ranges[merged - 1].count += ranges[i].count;
+		else
+			ranges[merged++] = ranges[i];
+	}
+
+	rlEnableVertexArray(FACE_ARENA.vao_id);
+
+	if (FACE_ARENA.indirect) {
+		// baseInstance does the offsetting, the attributes start at the first face
+		if (FACE_ARENA.face_offset != 0)
+			face_arena_set_attributes(0);
+
+		face_arena_draw_indirect(ranges, merged);
+	} else {
+		// without base instances the attributes are moved to each range instead
+		for (size_t i = 0; i < merged; i++) {
+			face_arena_set_attributes(ranges[i].first);
+			rlDrawVertexArrayInstanced(0, 6, ranges[i].count);
+		}
+
+		FACE_ARENA.draw_calls = (unsigned int)merged;
+	}
+
+	rlDisableVertexArray();
+}
+
+unsigned int face_arena_draw_calls(void) {
+	return FACE_ARENA.draw_calls;
+}
+
+void face_arena_destroy(void) {
+	if (FACE_ARENA.vao_id != 0) {
+		rlUnloadVertexArray(FACE_ARENA.vao_id);
+		rlUnloadVertexBuffer(FACE_ARENA.quad_vbo_id);
+		rlUnloadVertexBuffer(FACE_ARENA.face_vbo_id);
+	}
+
+	if (FACE_ARENA.command_buffer_id != 0)
+		glDeleteBuffers(1, &FACE_ARENA.command_buffer_id);
+
+	free(FACE_ARENA.free);
+	free(FACE_ARENA.commands);
+
+	FACE_ARENA.vao_id = 0;
+	FACE_ARENA.quad_vbo_id = 0;
+	FACE_ARENA.face_vbo_id = 0;
+	FACE_ARENA.capacity = 0;
+	FACE_ARENA.face_offset = 0;
+	FACE_ARENA.free = NULL;
+	FACE_ARENA.free_count = 0;
+	FACE_ARENA.free_capacity = 0;
+	FACE_ARENA.indirect = -1;
+	FACE_ARENA.command_buffer_id = 0;
+	FACE_ARENA.command_buffer_capacity = 0;
+	FACE_ARENA.commands = NULL;
+	FACE_ARENA.commands_capacity = 0;
+	FACE_ARENA.draw_calls = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chunk.h"
+
+/* One GPU buffer holding the faces of every uploaded chunk, so
+ * all visible chunks are drawn with a constant number of draw
+ * calls instead of one per chunk.
+ *
+ * Chunks get a range of faces with face_arena_alloc and write
+ * their faces into it with face_arena_write. Free ranges are
+ * kept in a list sorted by offset, an allocation takes the first
+ * one that fits and freed ranges merge with their neighbours.
+ * When nothing fits the buffer doubles and the faces are copied
+ * across on the GPU, offsets stay the same.
+ *
+ * face_arena_draw uses one glMultiDrawArraysIndirect when the
+ * context has OpenGL 4.3, otherwise one instanced draw per run
+ * of consecutive faces.
+ *
+ * Offsets and counts are in faces. MAIN THREAD ONLY, and only
+ * with a GL context.
+ */
+
+typedef struct {
+	unsigned int first;
+	unsigned int count;
+} face_arena_range;
+
+/* A chunk_face as the arena stores it, with the position of its
+ * chunk so one draw can cover many chunks. Chunk positions past
+ * a short's range wrap around.
+ */
+typedef struct {
+	chunk_face face;
+	short chunk_x, chunk_z;
+} face_arena_face;
+
+_Static_assert(sizeof(face_arena_face) == 12, "face_arena_face must stay tightly packed");
+
+/* Reserve count faces, setting offset to the first.
+ * Returns false if the arena could not grow to fit them.
+ */
+bool face_arena_alloc(unsigned int count, unsigned int* offset);
+
+/* Give back a range from face_arena_alloc
+ */
+void face_arena_free(unsigned int offset, unsigned int count);
+
+/* Send count faces of the chunk at pos to the arena from offset
+ * onwards
+ */
+void face_arena_write(unsigned int offset, world_chunk_pos pos, const chunk_face* faces, unsigned int count);
+
+/* Draw the faces in ranges with the shader that is bound, six
+ * vertices per face. ranges may be reordered.
+ */
+void face_arena_draw(face_arena_range* ranges, size_t count);
+
+/* Draw calls made by the last face_arena_draw
+ */
+unsigned int face_arena_draw_calls(void);
+
+/* Free the GPU buffers. Every range must have been freed.
+ */
+void face_arena_destroy(void);
@@ -12,10 +12,17 @@ void globals_init(void) {
 	};
 
 	SETTINGS = (settings){
-		.render_distance = 4,
+		.render_distance = 32,
 		.display_resolution = screen_resolution,
 		.gui_scale = screen_resolution.y / 100,
 		.show_chunk_borders = true,
+		.chunk_uploads_per_frame = 16,
+		.chunk_unload_margin = 2,
+		.chunk_memory_budget = 512 * 1024 * 1024,
+		.tick_rate = 60,
+		.cave_culling = true,
+		.lod_distances = { 4, 8, 16 },
+		.chunk_lod_remeshes_per_frame = 8,
 	};
 
 	DEFAULT_MATERIAL = LoadMaterialDefault();
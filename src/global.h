@@ -1,12 +1,24 @@
 #pragma once
 
+#include <stddef.h>
+
 #include <raylib.h>
 
+#include "chunk.h"
+
 typedef struct {
 	unsigned int render_distance;
 	int gui_scale;
 	Vector2 display_resolution;
 	bool show_chunk_borders;
+	unsigned int chunk_uploads_per_frame; // meshed chunks sent to the GPU each frame
+	unsigned int chunk_unload_margin; // chunks are kept this many chunks past render distance
+	size_t chunk_memory_budget; // bytes, chunks outside render distance are evicted past this
+	unsigned int tick_rate; // simulation ticks per second, independent of the frame rate
+	bool cave_culling; // skip chunk sections the camera cannot see into through air
+	// chunks at least lod_distances[n - 1] chunks away are meshed at level of detail n, 0 turns the ring off
+	unsigned int lod_distances[CHUNK_LOD_COUNT - 1];
+	unsigned int chunk_lod_remeshes_per_frame; // chunks remeshed each frame after crossing a ring
 } settings;
 
 extern settings SETTINGS;
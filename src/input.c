@@ -0,0 +1,61 @@
+#include <raylib.h>
+
+#include "input.h"
+
+// raylib key for every input_action bit, in bit order
+static const int INPUT_KEYS[] = {
+	KEY_W,
+	KEY_S,
+	KEY_A,
+	KEY_D,
+	KEY_SPACE,
+	KEY_LEFT_SHIFT,
+	KEY_LEFT_CONTROL,
+	KEY_F,
+	KEY_ESCAPE,
+	KEY_E,
+	KEY_ONE,
+	KEY_TWO,
+	KEY_THREE,
+	KEY_F5,
+};
+
+// raylib mouse button for every input_action bit after the keys
+static const int INPUT_MOUSE_BUTTONS[] = {
+	MOUSE_BUTTON_LEFT,
+	MOUSE_BUTTON_RIGHT,
+};
+
+#define INPUT_KEY_COUNT (sizeof(INPUT_KEYS) / sizeof(INPUT_KEYS[0]))
+
+input_state input_poll(void) {
+	input_state in = {
+		.delta_t = GetFrameTime(),
+		.mouse_delta = GetMouseDelta(),
+	};
+
+	for (unsigned int i = 0; i < INPUT_KEY_COUNT; i++) {
+		if (IsKeyDown(INPUT_KEYS[i]))
+			in.down |= 1u << i;
+		if (IsKeyPressed(INPUT_KEYS[i]))
+			in.pressed |= 1u << i;
+	}
+
+	for (unsigned int i = 0; i < sizeof(INPUT_MOUSE_BUTTONS) / sizeof(INPUT_MOUSE_BUTTONS[0]); i++) {
+		if (IsMouseButtonDown(INPUT_MOUSE_BUTTONS[i]))
+			in.down |= 1u << (INPUT_KEY_COUNT + i);
+		if (IsMouseButtonPressed(INPUT_MOUSE_BUTTONS[i]))
+			in.pressed |= 1u << (INPUT_KEY_COUNT + i);
+	}
+
+	return in;
+}
+
+void input_accumulate(input_state* pending, const input_state* frame) {
+	pending->down = frame->down;
+	pending->pressed |= frame->pressed;
+}
+
+void input_consume(input_state* pending) {
+	pending->pressed = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <raylib.h>
+
+/* Game actions, one bit each in input_state
+ */
+typedef enum {
+	INPUT_FORWARD     = 1 << 0,  // W
+	INPUT_BACK        = 1 << 1,  // S
+	INPUT_LEFT        = 1 << 2,  // A
+	INPUT_RIGHT       = 1 << 3,  // D
+	INPUT_JUMP        = 1 << 4,  // space, also fly up
+	INPUT_SNEAK       = 1 << 5,  // left shift, fly down
+	INPUT_SPRINT      = 1 << 6,  // left control
+	INPUT_FLY         = 1 << 7,  // F
+	INPUT_PAUSE       = 1 << 8,  // escape
+	INPUT_MENU        = 1 << 9,  // E
+	INPUT_SURVIVAL    = 1 << 10, // 1
+	INPUT_CREATIVE    = 1 << 11, // 2
+	INPUT_SPECTATOR   = 1 << 12, // 3
+	INPUT_CAMERA_MODE = 1 << 13, // F5
+	INPUT_BREAK       = 1 << 14, // left mouse button
+	INPUT_PLACE       = 1 << 15, // right mouse button
+} input_action;
+
+/* Everything the player simulation reads for one tick. The
+ * simulation must not look at the keyboard, mouse or clock
+ * itself, so a tick replayed from the same input_state (and
+ * the same world) gives the same result.
+ */
+typedef struct {
+	float delta_t;       // seconds this tick covers
+	Vector2 mouse_delta; // the frame's, not the tick's, see player_look
+	Vector3 look;        // direction the camera faced when the tick ran
+	uint32_t down;       // input_action bits held this tick
+	uint32_t pressed;    // input_action bits that went down this tick
+	bool world_ready;    // the chunk under the player was loaded
+} input_state;
+
+/* Read the keyboard, mouse and frame time for this frame.
+ * world_ready is left false, the caller knows where the player is.
+ */
+input_state input_poll(void);
+
+/* Add a frame's input to the input waiting for the next tick,
+ * so presses between ticks are not lost. down is the latest
+ * frame's, delta_t and look are left for the tick to set.
+ */
+void input_accumulate(input_state* pending, const input_state* frame);
+
+/* Forget what a tick has used up: presses.
+ * Held actions carry over to the next tick.
+ */
+void input_consume(input_state* pending);
+
+static inline bool input_down(const input_state* in, input_action action) {
+	return (in->down & action) != 0;
+}
+
+static inline bool input_pressed(const input_state* in, input_action action) {
+	return (in->pressed & action) != 0;
+}
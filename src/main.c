@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <raylib.h>
 #include <raymath.h>
@@ -8,11 +9,79 @@
 #include <rlights.h>
 
 #include "player.h"
+#include "entities.h"
 #include "global.h"
 #include "world.h"
 #include "chunk.h"
- 
-int main(void) {
+#include "face_arena.h"
+#include "worker.h"
+#include "region.h"
+#include "replay.h"
+#include "trace.h"
+
+// longest frame the simulation catches up on, so a long stall
+// does not turn into hundreds of ticks in one frame
+#define MAX_FRAME_TIME 0.25f
+
+static replay PLAYBACK = {0};
+static replay RECORDING = {0};
+static bool REPLAY_DIVERGED = false;
+
+/* Run one simulation tick of length tick_length, taking the
+ * input from the replay being played back, if there is one.
+ */
+static void simulate_tick(player* player, input_state* pending, float tick_length) {
+	input_state input;
+	Vector3 expected_position;
+	const bool replaying = PLAYBACK.file != NULL && replay_play_tick(&PLAYBACK, &input, &expected_position);
+
+	if (replaying)
+		replay_wait_for_world(&input, player);
+	else {
+		if (PLAYBACK.file != NULL) {
+			printf("Replay finished after %lu ticks%s\n", PLAYBACK.tick, REPLAY_DIVERGED ? "" : ", every tick matched");
+			replay_close(&PLAYBACK);
+		}
+
+		input = *pending;
+		input.delta_t = tick_length;
+		// the camera turns every frame, the tick only sees where it ended up
+		input.look = Vector3Normalize(Vector3Subtract(player->camera->target, player->camera->position));
+		input.world_ready = world_chunk_lookup(player_chunk_pos(player)) != NULL;
+	}
+
+	input_consume(pending);
+
+	player_update(player, &input);
+	replay_record_tick(&RECORDING, &input, player);
+
+	entities_update(tick_length);
+
+	if (replaying && !REPLAY_DIVERGED && memcmp(&player->e.position, &expected_position, sizeof(Vector3)) != 0) {
+		fprintf(stderr, "WARNING: Replay diverged from the recording at tick %lu\n", PLAYBACK.tick - 1);
+		REPLAY_DIVERGED = true;
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [--record FILE] [--replay FILE]\n", name);
+}
+
+int main(int argc, char** argv) {
+	const char* record_path = NULL;
+	const char* replay_path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record_path = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay_path = argv[++i];
+		else {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
 	// Window opts
 	InitWindow(1920, 1080, "Tinycraft");
 	SetTargetFPS(256);
@@ -31,10 +100,19 @@ int main(void) {
 	globals_init();
 	world_init(NULL);
 
+	player player = player_init();
+
+	// a replay brings its own world seed and starting position
+	if (replay_path != NULL && !replay_play_begin(&PLAYBACK, replay_path, &WORLD.chunk_opts, &player))
+		return -1;
+
+	if (record_path != NULL && !replay_record_begin(&RECORDING, record_path, &WORLD.chunk_opts, &player))
+		return -1;
+
 	// initialize seed value
 	perlin_noise_init(WORLD.chunk_opts.seed);
 
-	player player = player_init();
+	TRACE_THREAD_NAME("main");
 
 	// shader stuff
 	Shader chunk_shader = LoadShader("./shaders/chunk_vert.glsl", "./shaders/chunk_frag.glsl");
@@ -46,7 +124,6 @@ int main(void) {
 	// Get shader locations
     chunk_shader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(chunk_shader, "mvp");
     chunk_shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(chunk_shader, "viewPos");
-    chunk_shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(chunk_shader, "instanceTransform");
 
     // Set shader ambient light level
     int ambient_loc = GetShaderLocation(chunk_shader, "ambient");
@@ -55,58 +132,98 @@ int main(void) {
 	// sunlight
 	CreateLight(LIGHT_DIRECTIONAL, (Vector3){30,30,30}, Vector3Zero(), WHITE, chunk_shader);
 
+	bool cursor_enabled = false;
+
+	// the simulation runs at a fixed rate however fast frames are drawn
+	const float tick_length = 1.0f / SETTINGS.tick_rate;
+	float tick_accumulator = 0;
+	input_state pending_input = {0};
+
 	// ----- GAME LOOP ----- //
 	while (!WindowShouldClose()) {
 
 		ClearBackground(BLACK);
 
+		// dump recent trace zones, see trace.h
+		if (IsKeyPressed(KEY_F3))
+			trace_dump("trace.json", TRACE_DUMP_SECONDS);
+
 		// CHUNK GENERATION
-		world_chunk_pos player_chunk_pos = {
-			// use of floor() is required since truncation rounds
-			// in th opposite direction for negative numbers.
-			.x = floorf(player.e.position.x / WORLD_CHUNK_WIDTH),
-			.z = floorf(player.e.position.z / WORLD_CHUNK_WIDTH),
-		};
+		world_chunk_pos player_chunk = player_chunk_pos(&player);
 
 		/* // TEST
-		world_load_chunk((world_chunk_pos){0}); */
+		world_load_chunk((world_chunk_pos){0}, 0); */
+
+		world_load_chunks_around(player_chunk, SETTINGS.render_distance);
+		world_update_residency(player_chunk, SETTINGS.render_distance);
+		world_update_lod(player_chunk, SETTINGS.chunk_lod_remeshes_per_frame);
+		world_upload_chunks(SETTINGS.chunk_uploads_per_frame);
+
+		// SIMULATION
+		const input_state frame_input = input_poll();
+		input_accumulate(&pending_input, &frame_input);
+
+		// a replay turns the camera itself, tick by tick
+		if (PLAYBACK.file == NULL)
+			player_look(&player, frame_input.mouse_delta);
 
-		int rd = SETTINGS.render_distance;
+		tick_accumulator += fminf(frame_input.delta_t, MAX_FRAME_TIME);
 
-		for (int i = -rd + 1; i < rd; i++) {
-			for (int j = -rd + 1; j < rd; j++) {
-				world_chunk_pos chunk_pos = {
-					.x = i + player_chunk_pos.x,
-					.z = j + player_chunk_pos.z,
-				};
+		while (tick_accumulator >= tick_length) {
+			simulate_tick(&player, &pending_input, tick_length);
+			tick_accumulator -= tick_length;
+		}
 
-				world_load_chunk(chunk_pos);
-			}
+		// draw the player part of the way to the next tick
+		const float tick_alpha = tick_accumulator / tick_length;
+		const Vector3 player_draw_pos = entity_interpolate_position(&player.e, tick_alpha);
+		const Vector3 draw_offset = Vector3Subtract(player_draw_pos, player.e.position);
+
+		Camera3D view = *player.camera;
+		view.position = Vector3Add(view.position, draw_offset);
+		view.target = Vector3Add(view.target, draw_offset);
+
+		// the cursor is free in menus
+		const bool in_menu = player.gamemode == MODE_MENU || player.gamemode == MODE_PAUSED;
+		if (in_menu != cursor_enabled) {
+			if (in_menu)
+				EnableCursor();
+			else
+				DisableCursor();
+			cursor_enabled = in_menu;
 		}
 
-		player_update(&player);
+		world_remesh_dirty_chunks();
 
 		// RENDER
 		BeginDrawing();
 	
-		BeginMode3D(*player.camera);
+		BeginMode3D(view);
 
 		// draw player hitbox
 		DrawCubeWiresV((Vector3){
-					.x = player.e.position.x,
-					.y = player.e.position.y + (player.e.size.y / 2),
-					.z = player.e.position.z,
+					.x = player_draw_pos.x,
+					.y = player_draw_pos.y + (player.e.size.y / 2),
+					.z = player_draw_pos.z,
 				}, player.e.size, WHITE);
 
 		DrawCube((Vector3){ // player pos box
-				.x = player.e.position.x,
-				.y = player.e.position.y + .05,
-				.z = player.e.position.z
+				.x = player_draw_pos.x,
+				.y = player_draw_pos.y + .05,
+				.z = player_draw_pos.z
 				}, player.e.size.x, .1, player.e.size.z, PURPLE);
 
+		// outline the block the player is looking at
+		const world_raycast_result target = player_pick_block(&player);
+		if (target.hit) {
+			const Vector3 corner = get_block_real_pos(target.chunk_pos, target.bx, target.by, target.bz);
+			DrawCubeWires(Vector3SubtractValue(corner, 0.5f), 1.01f, 1.01f, 1.01f, BLACK);
+		}
+
 		// DrawGrid(32, 1);
 		DrawGrid(50, 16);
-		world_render_chunks(player.camera, chunk_shader);
+		world_render_chunks(&view, chunk_shader);
+		entities_draw(tick_alpha);
 
 		EndMode3D();
 
@@ -160,7 +277,7 @@ int main(void) {
 
 		DrawText(mode_str, 15, 30, 22, RED);
 
-		char buf[512];
+		char buf[1024];
 		snprintf(buf, sizeof(buf), 
 				"player.e.position: %f %f %f\n\n"
 				"player.e.velocity: %f %f %f\n\n"
@@ -171,24 +288,39 @@ int main(void) {
 				"Camera up: %f %f %f\n\n"
 				"Camera target: %f %f %f\n\n"
 				"Camera pos/target dist: %f\n\n"
+				"Loaded chunks: %u (%.1f MiB)\n\n"
+				"Entities: %zu\n\n"
+				"Chunk uploads: %zu bytes\n\n"
+				"Chunk draw calls: %u\n\n"
 				,
 				player.e.position.x, player.e.position.y, player.e.position.z,
 				player.e.velocity.x, player.e.velocity.y, player.e.velocity.z,
-				player_chunk_pos.x, player_chunk_pos.z,
+				player_chunk.x, player_chunk.z,
 				player.is_flying,
 				player.e.is_on_ground,
 				player.camera->position.x, player.camera->position.y, player.camera->position.z,
 				player.camera->up.x, player.camera->up.y, player.camera->up.z,
 				player.camera->target.x, player.camera->target.y, player.camera->target.z,
-				Vector3Distance(player.camera->position, player.camera->target)
+				Vector3Distance(player.camera->position, player.camera->target),
+				WORLD.chunk_dict.count, world_chunk_memory_usage() / (1024.0 * 1024.0),
+				ENTITIES.count,
+				chunk_take_uploaded_bytes(),
+				face_arena_draw_calls()
 				);
 		DrawText(buf, 15, 50, 22, ORANGE);
 	
 		EndDrawing();
 	}
 
+	replay_close(&PLAYBACK);
+	replay_close(&RECORDING);
+
 	UnloadShader(chunk_shader);
 	world_unload_all_chunks();
+	face_arena_destroy();
+	worker_pool_destroy();
+	region_close_all();
+	entities_destroy();
 	player_destroy(&player);
 	CloseWindow();
 
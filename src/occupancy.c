@@ -0,0 +1,96 @@
+#include "occupancy.h"
+#include "world.h"
+
+void occupancy_cache_init(occupancy_cache* cache, world_chunk_pos center) {
+	cache->center = center;
+	cache->resolved = 0;
+}
+
+const chunk* occupancy_resolve(occupancy_cache* cache, int dx, int dz) {
+	const chunk* c = world_chunk_lookup((world_chunk_pos){ cache->center.x + dx, cache->center.z + dz });
+
+	cache->chunks[dx + 1][dz + 1] = c;
+	cache->resolved |= 1u << ((dx + 1) * 3 + dz + 1);
+
+	return c;
+}
+
+// solid bits of section s in the current column, limited to the box
+static uint32_t occupancy_iter_section_bits(const occupancy_iter* it, int s) {
+	const int lx = it->x - it->chunk->position.x * WORLD_CHUNK_WIDTH;
+	const int lz = it->z - it->chunk->position.z * WORLD_CHUNK_WIDTH;
+	uint32_t bits = chunk_section_solid_column(&it->chunk->sections[s], lx, lz);
+
+	const int section_y = s * CHUNK_SECTION_HEIGHT;
+
+	if (it->min_y > section_y)
+		bits &= ~0u << (it->min_y - section_y);
+	if (it->max_y < section_y + CHUNK_SECTION_HEIGHT)
+		bits &= (1u << (it->max_y - section_y)) - 1;
+
+	return bits;
+}
+
+void occupancy_iter_begin(occupancy_iter* it, occupancy_cache* cache,
+		int min_x, int min_y, int min_z, int max_x, int max_y, int max_z) {
+	*it = (occupancy_iter){
+		.cache = cache,
+		.min_y = min_y < 0 ? 0 : min_y,
+		.max_y = max_y > WORLD_CHUNK_HEIGHT ? WORLD_CHUNK_HEIGHT : max_y,
+		.min_z = min_z,
+		.max_z = max_z,
+		.max_x = max_x,
+		// start one column before the box, the first next moves into it
+		.x = min_x,
+		.z = min_z - 1,
+		.section = CHUNK_SECTION_COUNT,
+	};
+
+	// nothing to walk
+	if (it->min_y >= it->max_y || min_z >= max_z)
+		it->x = max_x;
+}
+
+bool occupancy_iter_next(occupancy_iter* it, int* x, int* y, int* z) {
+	for (;;) {
+		if (it->bits != 0) {
+			const int bit = __builtin_ctz(it->bits);
+			it->bits &= it->bits - 1;
+
+			*x = it->x;
+			*y = it->section * CHUNK_SECTION_HEIGHT + bit;
+			*z = it->z;
+			return true;
+		}
+
+		// next section of this column
+		if (it->chunk != NULL && (it->section + 1) * CHUNK_SECTION_HEIGHT < it->max_y) {
+			it->section++;
+			it->bits = occupancy_iter_section_bits(it, it->section);
+			continue;
+		}
+
+		// next column
+		if (++it->z >= it->max_z) {
+			it->z = it->min_z;
+			it->x++;
+		}
+
+		if (it->x >= it->max_x)
+			return false;
+
+		it->chunk = occupancy_chunk(it->cache, it->x, it->z);
+		it->section = it->min_y / CHUNK_SECTION_HEIGHT;
+		it->bits = it->chunk != NULL ? occupancy_iter_section_bits(it, it->section) : 0;
+	}
+}
+
+bool occupancy_any_solid(occupancy_cache* cache,
+		int min_x, int min_y, int min_z, int max_x, int max_y, int max_z) {
+	occupancy_iter it;
+	int x, y, z;
+
+	occupancy_iter_begin(&it, cache, min_x, min_y, min_z, max_x, max_y, max_z);
+
+	return occupancy_iter_next(&it, &x, &y, &z);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chunk.h"
+
+/* Solidity queries around one spot in the world, for collision.
+ *
+ * Each of the 3x3 chunks around a chunk is looked up the first
+ * time it is needed and remembered, after that asking whether a
+ * block is solid is a couple of array reads and a bit test on the
+ * section's solid masks (see chunk_section), with no hash lookups.
+ *
+ * Positions are world block coordinates: x and z are the world
+ * column, y is the block index, so block (x, y, z) fills
+ * [x, x + 1] x [y - 1, y] x [z, z + 1].
+ * Blocks outside the world's height, outside the 3x3 chunks or
+ * in chunks that are not loaded count as not solid.
+ */
+typedef struct {
+	world_chunk_pos center;
+	const chunk* chunks[3][3]; // [dx + 1][dz + 1] from center, NULL if not loaded
+	uint16_t resolved;         // bit (dx + 1) * 3 + dz + 1 is set once chunks[dx + 1][dz + 1] is looked up
+} occupancy_cache;
+
+/* Set up an empty cache around center. Chunks that are still being
+ * generated count as not loaded.
+ * Resolving chunks has the same rule as world_chunk_lookup: the
+ * main thread, or a worker while the main thread waits for it and
+ * no chunk is loaded or unloaded. Start a new cache whenever
+ * chunks may have been unloaded.
+ */
+void occupancy_cache_init(occupancy_cache* cache, world_chunk_pos center);
+
+// look up and remember chunks[dx + 1][dz + 1]
+const chunk* occupancy_resolve(occupancy_cache* cache, int dx, int dz);
+
+static inline int occupancy_floor_div(int a, int b) {
+	return a >= 0 ? a / b : (a - b + 1) / b;
+}
+
+/* Chunk holding world column (x, z), NULL if it is outside the
+ * cache or not loaded.
+ */
+static inline const chunk* occupancy_chunk(occupancy_cache* cache, int x, int z) {
+	const int dx = occupancy_floor_div(x, WORLD_CHUNK_WIDTH) - cache->center.x;
+	const int dz = occupancy_floor_div(z, WORLD_CHUNK_WIDTH) - cache->center.z;
+
+	if (dx < -1 || dx > 1 || dz < -1 || dz > 1)
+		return NULL;
+
+	if (!(cache->resolved & (1u << ((dx + 1) * 3 + dz + 1))))
+		return occupancy_resolve(cache, dx, dz);
+
+	return cache->chunks[dx + 1][dz + 1];
+}
+
+static inline bool occupancy_is_solid(occupancy_cache* cache, int x, int y, int z) {
+	if (y < 0 || y >= WORLD_CHUNK_HEIGHT)
+		return false;
+
+	const chunk* c = occupancy_chunk(cache, x, z);
+	if (c == NULL)
+		return false;
+
+	return chunk_is_solid(c, x - c->position.x * WORLD_CHUNK_WIDTH, y, z - c->position.z * WORLD_CHUNK_WIDTH);
+}
+
+/* Walks the solid blocks in a box a section of a column at a time,
+ * skipping air with bit scans.
+ *
+ *   occupancy_iter it;
+ *   occupancy_iter_begin(&it, &cache, min_x, min_y, min_z, max_x, max_y, max_z);
+ *   while (occupancy_iter_next(&it, &x, &y, &z)) { ... }
+ *
+ * Blocks come in x, then z, then y order.
+ */
+typedef struct {
+	occupancy_cache* cache;
+	int min_y, max_y;   // clamped to the world, max exclusive
+	int min_z, max_z, max_x;
+	int x, z;           // current column
+	const chunk* chunk; // holding the current column
+	int section;        // current section of the column
+	uint32_t bits;      // solid blocks of the section not returned yet
+} occupancy_iter;
+
+/* Set it up to walk the box from (min_x, min_y, min_z) up to but
+ * not including (max_x, max_y, max_z).
+ */
+void occupancy_iter_begin(occupancy_iter* it, occupancy_cache* cache,
+		int min_x, int min_y, int min_z, int max_x, int max_y, int max_z);
+
+/* Get the next solid block. Returns false when there are none left.
+ */
+bool occupancy_iter_next(occupancy_iter* it, int* x, int* y, int* z);
+
+/* Whether any block in the box (max exclusive) is solid
+ */
+bool occupancy_any_solid(occupancy_cache* cache,
+		int min_x, int min_y, int min_z, int max_x, int max_y, int max_z);
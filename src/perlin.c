@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "perlin.h"
+
+// permutation table for perlin noise
+static int ptable[512];
+
+static void perlin_noise_select_kernel(void);
+
+void perlin_noise_init(unsigned int seed) {
+	int permutation[] = { 151,160,137,91,90,15,
+				131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
+				190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
+				88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
+				77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
+				102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
+				135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
+				5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
+				223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
+				129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
+				251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
+				49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
+				138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
+
+	srand(seed);
+
+	// shuffle permutation array with seed
+	for (int i = 255; i > 0; i--) {
+		int j = rand() % (i + 1);
+		int temp = permutation[i];
+		permutation[i] = permutation[j];
+		permutation[j] = temp;
+	}
+
+	// fill ptable with permutation values repeated twice
+	for (int i = 0; i < 256; i++)
+		ptable[256+i] = ptable[i] = permutation[i];
+
+	perlin_noise_select_kernel();
+}
+
+static inline float perlin_fade(float t) {
+	return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline float perlin_lerp(float t, float a, float b) {
+	return a + t * (b - a);
+}
+
+static inline float perlin_grad(int hash, float x, float y, float z) {
+	int h = hash & 15;
+	float u = h < 8 ? x : y;
+	float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+	return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+float perlin_noise_3D(float x, float y, float z) {
+	int X = (int)floor(x) & 255;
+	int Y = (int)floor(y) & 255;
+	int Z = (int)floor(z) & 255;
+
+	x -= floor(x);
+	y -= floor(y);
+	z -= floor(z);
+
+	float u = perlin_fade(x);
+	float v = perlin_fade(y);
+	float w = perlin_fade(z);
+
+	int A = ptable[X] + Y;
+	int AA = ptable[A] + Z;
+	int AB = ptable[A + 1] + Z;
+	int B = ptable[X + 1] + Y;
+	int BA = ptable[B] + Z;
+	int BB = ptable[B + 1] + Z;
+
+	return perlin_lerp(w, 
+			perlin_lerp(v,
+				perlin_lerp(u, perlin_grad(ptable[AA], x, y, z), perlin_grad(ptable[BA], x - 1, y, z)),
+			perlin_lerp(u, perlin_grad(ptable[AB], x, y - 1, z), perlin_grad(ptable[BB], x - 1, y - 1, z))),
+			perlin_lerp(v,
+				perlin_lerp(u, perlin_grad(ptable[AA + 1], x, y, z - 1), perlin_grad(ptable[BA + 1], x - 1, y, z - 1)),
+				perlin_lerp(u, perlin_grad(ptable[AB + 1], x, y - 1, z - 1), perlin_grad(ptable[BB + 1], x - 1, y - 1, z - 1))));
+}
+
+inline float perlin_noise_2D(float x, float y) {
+	return perlin_noise_3D(x, y, 0.0f);
+}
+
+/* BATCHED NOISE
+ *
+ * perlin_noise_2D_grid evaluates one x at a time against a run of
+ * ys. Everything that only depends on x (the lattice cell, the
+ * fractional part and its fade) is worked out once per x, the
+ * kernels then do the per y work several lanes at a time.
+ * With z fixed at 0 the far z layer of the 3D noise is weighted by
+ * fade(0) == 0, so only the near layer is evaluated.
+ *
+ * Every kernel does exactly the same float operations in the same
+ * order (no fused multiply-add), so they all give the same results.
+ */
+
+typedef struct {
+	int X;     // lattice cell & 255
+	float fx;  // position inside the cell
+	float u;   // fade(fx)
+} perlin_axis;
+
+static inline perlin_axis perlin_make_axis(float x) {
+	const float fl = floorf(x);
+
+	return (perlin_axis){
+		.X = (int)fl & 255,
+		.fx = x - fl,
+		.u = perlin_fade(x - fl),
+	};
+}
+
+// gradient of perlin_grad with z == 0
+static inline float perlin_grad_2D(int hash, float x, float y) {
+	int h = hash & 15;
+	float u = h < 8 ? x : y;
+	float v = h < 4 ? y : (h == 12 || h == 14 ? x : 0.0f);
+	return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+static inline float perlin_noise_2D_axes(perlin_axis x, perlin_axis y) {
+	const int A = ptable[x.X] + y.X;
+	const int B = ptable[x.X + 1] + y.X;
+
+	return perlin_lerp(y.u,
+			perlin_lerp(x.u, perlin_grad_2D(ptable[ptable[A]], x.fx, y.fx), perlin_grad_2D(ptable[ptable[B]], x.fx - 1, y.fx)),
+			perlin_lerp(x.u, perlin_grad_2D(ptable[ptable[A + 1]], x.fx, y.fx - 1), perlin_grad_2D(ptable[ptable[B + 1]], x.fx - 1, y.fx - 1)));
+}
+
+// ys are worked on in blocks of this many
+#define PERLIN_GRID_BLOCK 64
+
+// a block of perlin_axis split into arrays so kernels can load lanes directly
+typedef struct {
+	int X[PERLIN_GRID_BLOCK];
+	float fx[PERLIN_GRID_BLOCK];
+	float u[PERLIN_GRID_BLOCK];
+} perlin_axes;
+
+// a kernel fills out[0..count) for one x against ys[first..first + count)
+typedef void (*perlin_grid_kernel)(perlin_axis x, const perlin_axes* ys, unsigned int first, unsigned int count, float* out);
+
+static void perlin_grid_scalar(perlin_axis x, const perlin_axes* ys, unsigned int first, unsigned int count, float* out) {
+	for (unsigned int j = 0; j < count; j++) {
+		const perlin_axis y = {
+			.X = ys->X[first + j],
+			.fx = ys->fx[first + j],
+			.u = ys->u[first + j],
+		};
+
+		out[j] = perlin_noise_2D_axes(x, y);
+	}
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PERLIN_X86
+#include <immintrin.h>
+
+/* the SSE4.1 kernel has no gather, the hashes are looked up one lane
+ * at a time and the rest is done 4 wide
+ */
+__attribute__((target("sse4.1")))
+static inline __m128 perlin_grad_sse41(__m128i hash, __m128 x, __m128 y) {
+	const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+
+	const __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+	const __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+	const __m128 h12_14 = _mm_castsi128_ps(_mm_or_si128(
+				_mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+				_mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+	const __m128 u = _mm_blendv_ps(y, x, lt8);
+	const __m128 v = _mm_blendv_ps(_mm_and_ps(x, h12_14), y, lt4);
+
+	// negating is flipping the sign bit, bit 0 flips u and bit 1 flips v
+	const __m128 u_sign = _mm_castsi128_ps(_mm_slli_epi32(h, 31));
+	const __m128 v_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(h, 1), 31));
+
+	return _mm_add_ps(_mm_xor_ps(u, u_sign), _mm_xor_ps(v, v_sign));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 perlin_lerp_sse41(__m128 t, __m128 a, __m128 b) {
+	return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+__attribute__((target("sse4.1")))
+static void perlin_grid_sse41(perlin_axis x, const perlin_axes* ys, unsigned int first, unsigned int count, float* out) {
+	const __m128 fx = _mm_set1_ps(x.fx);
+	const __m128 fx1 = _mm_sub_ps(fx, _mm_set1_ps(1.0f));
+	const __m128 u = _mm_set1_ps(x.u);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	unsigned int j = 0;
+
+	for (; j + 4 <= count; j += 4) {
+		int h_aa[4], h_ba[4], h_ab[4], h_bb[4];
+
+		for (unsigned int l = 0; l < 4; l++) {
+			const int A = ptable[x.X] + ys->X[first + j + l];
+			const int B = ptable[x.X + 1] + ys->X[first + j + l];
+
+			h_aa[l] = ptable[ptable[A]];
+			h_ba[l] = ptable[ptable[B]];
+			h_ab[l] = ptable[ptable[A + 1]];
+			h_bb[l] = ptable[ptable[B + 1]];
+		}
+
+		const __m128 fy = _mm_loadu_ps(ys->fx + first + j);
+		const __m128 fy1 = _mm_sub_ps(fy, one);
+		const __m128 v = _mm_loadu_ps(ys->u + first + j);
+
+		const __m128 n = perlin_lerp_sse41(v,
+				perlin_lerp_sse41(u,
+					perlin_grad_sse41(_mm_loadu_si128((const __m128i*)h_aa), fx, fy),
+					perlin_grad_sse41(_mm_loadu_si128((const __m128i*)h_ba), fx1, fy)),
+				perlin_lerp_sse41(u,
+					perlin_grad_sse41(_mm_loadu_si128((const __m128i*)h_ab), fx, fy1),
+					perlin_grad_sse41(_mm_loadu_si128((const __m128i*)h_bb), fx1, fy1)));
+
+		_mm_storeu_ps(out + j, n);
+	}
+
+	perlin_grid_scalar(x, ys, first + j, count - j, out + j);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 perlin_grad_avx2(__m256i hash, __m256 x, __m256 y) {
+	const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+
+	const __m256 lt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+	const __m256 lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+	const __m256 h12_14 = _mm256_castsi256_ps(_mm256_or_si256(
+				_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+				_mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+
+	const __m256 u = _mm256_blendv_ps(y, x, lt8);
+	const __m256 v = _mm256_blendv_ps(_mm256_and_ps(x, h12_14), y, lt4);
+
+	const __m256 u_sign = _mm256_castsi256_ps(_mm256_slli_epi32(h, 31));
+	const __m256 v_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(h, 1), 31));
+
+	return _mm256_add_ps(_mm256_xor_ps(u, u_sign), _mm256_xor_ps(v, v_sign));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 perlin_lerp_avx2(__m256 t, __m256 a, __m256 b) {
+	return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+// the hashes are looked up with gathers, 8 wide throughout
+__attribute__((target("avx2")))
+static void perlin_grid_avx2(perlin_axis x, const perlin_axes* ys, unsigned int first, unsigned int count, float* out) {
+	const __m256 fx = _mm256_set1_ps(x.fx);
+	const __m256 fx1 = _mm256_sub_ps(fx, _mm256_set1_ps(1.0f));
+	const __m256 u = _mm256_set1_ps(x.u);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	const __m256i pa = _mm256_set1_epi32(ptable[x.X]);
+	const __m256i pb = _mm256_set1_epi32(ptable[x.X + 1]);
+	const __m256i inc = _mm256_set1_epi32(1);
+
+	unsigned int j = 0;
+
+	for (; j + 8 <= count; j += 8) {
+		const __m256i Y = _mm256_loadu_si256((const __m256i*)(ys->X + first + j));
+		const __m256 fy = _mm256_loadu_ps(ys->fx + first + j);
+		const __m256 v = _mm256_loadu_ps(ys->u + first + j);
+		const __m256 fy1 = _mm256_sub_ps(fy, one);
+
+		const __m256i A = _mm256_add_epi32(pa, Y);
+		const __m256i B = _mm256_add_epi32(pb, Y);
+
+		const __m256i h_aa = _mm256_i32gather_epi32(ptable, _mm256_i32gather_epi32(ptable, A, 4), 4);
+		const __m256i h_ba = _mm256_i32gather_epi32(ptable, _mm256_i32gather_epi32(ptable, B, 4), 4);
+		const __m256i h_ab = _mm256_i32gather_epi32(ptable, _mm256_i32gather_epi32(ptable, _mm256_add_epi32(A, inc), 4), 4);
+		const __m256i h_bb = _mm256_i32gather_epi32(ptable, _mm256_i32gather_epi32(ptable, _mm256_add_epi32(B, inc), 4), 4);
+
+		const __m256 n = perlin_lerp_avx2(v,
+				perlin_lerp_avx2(u, perlin_grad_avx2(h_aa, fx, fy), perlin_grad_avx2(h_ba, fx1, fy)),
+				perlin_lerp_avx2(u, perlin_grad_avx2(h_ab, fx, fy1), perlin_grad_avx2(h_bb, fx1, fy1)));
+
+		_mm256_storeu_ps(out + j, n);
+	}
+
+	perlin_grid_scalar(x, ys, first + j, count - j, out + j);
+}
+#endif
+
+static const perlin_grid_kernel PERLIN_KERNELS[] = {
+	[PERLIN_KERNEL_SCALAR] = perlin_grid_scalar,
+#ifdef PERLIN_X86
+	[PERLIN_KERNEL_SSE41] = perlin_grid_sse41,
+	[PERLIN_KERNEL_AVX2] = perlin_grid_avx2,
+#endif
+};
+
+static perlin_kernel PERLIN_KERNEL = PERLIN_KERNEL_SCALAR;
+
+bool perlin_noise_kernel_supported(perlin_kernel kernel) {
+	switch (kernel) {
+		case (PERLIN_KERNEL_SCALAR):
+			return true;
+#ifdef PERLIN_X86
+		case (PERLIN_KERNEL_SSE41):
+			return __builtin_cpu_supports("sse4.1");
+		case (PERLIN_KERNEL_AVX2):
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+bool perlin_noise_set_kernel(perlin_kernel kernel) {
+	if (!perlin_noise_kernel_supported(kernel))
+		return false;
+
+	PERLIN_KERNEL = kernel;
+	return true;
+}
+
+perlin_kernel perlin_noise_get_kernel(void) {
+	return PERLIN_KERNEL;
+}
+
+static void perlin_noise_select_kernel(void) {
+	if (perlin_noise_kernel_supported(PERLIN_KERNEL_AVX2))
+		PERLIN_KERNEL = PERLIN_KERNEL_AVX2;
+	else if (perlin_noise_kernel_supported(PERLIN_KERNEL_SSE41))
+		PERLIN_KERNEL = PERLIN_KERNEL_SSE41;
+	else
+		PERLIN_KERNEL = PERLIN_KERNEL_SCALAR;
+}
+
+void perlin_noise_2D_grid(const float* xs, unsigned int x_count, const float* ys, unsigned int y_count, float* out) {
+	const perlin_grid_kernel kernel = PERLIN_KERNELS[PERLIN_KERNEL];
+	perlin_axes y_axes;
+
+	for (unsigned int first = 0; first < y_count; first += PERLIN_GRID_BLOCK) {
+		const unsigned int count = y_count - first < PERLIN_GRID_BLOCK ? y_count - first : PERLIN_GRID_BLOCK;
+
+		for (unsigned int j = 0; j < count; j++) {
+			const perlin_axis y = perlin_make_axis(ys[first + j]);
+
+			y_axes.X[j] = y.X;
+			y_axes.fx[j] = y.fx;
+			y_axes.u[j] = y.u;
+		}
+
+		for (unsigned int i = 0; i < x_count; i++)
+			kernel(perlin_make_axis(xs[i]), &y_axes, 0, count, out + i * y_count + first);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* Initialize perlin noise with an integer seed.
+ * This is required before getting a value from
+ * the perlin noise functions.
+ * There is no corresponding destroy function.
+ */
+void perlin_noise_init(unsigned int seed);
+
+/* Get the value of perlin noise at (x, y, z)
+ */
+float perlin_noise_3D(float x, float y, float z);
+
+/* Get the value of perlin noise at (x, y)
+ */
+float perlin_noise_2D(float x, float y);
+
+typedef enum {
+	PERLIN_KERNEL_SCALAR = 0,
+	PERLIN_KERNEL_SSE41,
+	PERLIN_KERNEL_AVX2,
+} perlin_kernel;
+
+/* Fill a grid with 2D perlin noise, the same values as
+ * perlin_noise_2D(xs[i], ys[j]) written to out[i * y_count + j].
+ * The work is done by the fastest kernel the CPU supports, picked
+ * by perlin_noise_init. Every kernel gives identical results.
+ */
+void perlin_noise_2D_grid(const float* xs, unsigned int x_count, const float* ys, unsigned int y_count, float* out);
+
+/* Whether the CPU can run kernel
+ */
+bool perlin_noise_kernel_supported(perlin_kernel kernel);
+
+/* Force perlin_noise_2D_grid onto one kernel, mostly for comparing them.
+ * Returns false (and changes nothing) if the CPU does not support it.
+ */
+bool perlin_noise_set_kernel(perlin_kernel kernel);
+
+perlin_kernel perlin_noise_get_kernel(void);
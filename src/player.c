@@ -10,10 +10,12 @@
 #include "world.h"
 #include "entity.h"
 #include "player.h"
+#include "trace.h"
 
 #define DEFAULT_MOVEMENT_SPEED 100.0f
 #define GROUND_FRICTION 15.0f
 #define AIR_FRICTION 0.5f
+#define EYE_HEIGHT 1.6f
 
 player player_init(void) {
 
@@ -47,6 +49,7 @@ player player_init(void) {
 	};
 
 	p.camera = cam;
+	p.e.previous_position = p.e.position;
 
 	return p;
 }
@@ -55,8 +58,8 @@ void player_destroy(player* player) {
 	free(player->camera);
 }
 
-static void player_input(player* player) {
-	if (IsKeyPressed(KEY_ESCAPE)) {
+static void player_input(player* player, const input_state* in) {
+	if (input_pressed(in, INPUT_PAUSE)) {
 		switch (player->gamemode) {
 			case (MODE_MENU):
 			case (MODE_PAUSED):
@@ -67,7 +70,7 @@ static void player_input(player* player) {
 		}
 	}
 
-	if (IsKeyPressed(KEY_E)) {
+	if (input_pressed(in, INPUT_MENU)) {
 		switch (player->gamemode) {
 			case (MODE_MENU):
 			case (MODE_PAUSED):
@@ -78,11 +81,11 @@ static void player_input(player* player) {
 		}
 	}
 
-	if (IsKeyPressed(KEY_ONE))
+	if (input_pressed(in, INPUT_SURVIVAL))
 		player->gamemode = MODE_SURVIVAL;
-	if (IsKeyPressed(KEY_TWO))
+	if (input_pressed(in, INPUT_CREATIVE))
 		player->gamemode = MODE_CREATIVE;
-	if (IsKeyPressed(KEY_THREE)) {
+	if (input_pressed(in, INPUT_SPECTATOR)) {
 		player->gamemode = MODE_SPECTATOR;
 		player->is_flying = 1;
 		player->e.is_on_ground = 0;
@@ -90,7 +93,7 @@ static void player_input(player* player) {
 	}
 			
 	// Scroll through camera modes
-	if (IsKeyPressed(KEY_F5)) {
+	if (input_pressed(in, INPUT_CAMERA_MODE)) {
 		if (++player->camera_mode > THIRD_PERSON)
 			player->camera_mode = 0;
 
@@ -106,40 +109,42 @@ static void player_input(player* player) {
 	}
 }
 
-static void player_camera_movement(player* player) {
-	// Camera movement
-	const Vector2 mouse_delta = GetMouseDelta();
-	const float camera_sensitivity = 0.007f;
-	const float camera_y_offset = 1.6f;
+/* Put the camera at the player's head, facing forward: at the
+ * eyes in first person, behind the head in third person.
+ */
+static void player_place_camera(player* player, Vector3 forward) {
+	const Vector3 head_pos = Vector3Add(player->e.position, (Vector3){ .y = EYE_HEIGHT });
 
 	switch (player->camera_mode) {
 		default:
 		case (FIRST_PERSON):
-			{
-				CameraYaw(player->camera, camera_sensitivity * -mouse_delta.x, 0);
-				CameraPitch(player->camera, camera_sensitivity * -mouse_delta.y, 1, 0, 0);
-
-				Vector3 head_pos = Vector3Add(player->e.position, (Vector3){.y=camera_y_offset});
-				player->camera->target = Vector3Add(head_pos, Vector3Scale(Vector3Normalize(GetCameraForward(player->camera)), player->reach));
-				player->camera->position = head_pos;
-			}
+			player->camera->target = Vector3Add(head_pos, Vector3Scale(forward, player->reach));
+			player->camera->position = head_pos;
 			break;
 		case (THIRD_PERSON):
 			{
-				CameraYaw(player->camera, camera_sensitivity * -mouse_delta.x, 0);
-				CameraPitch(player->camera, camera_sensitivity * -mouse_delta.y, 1, 0, 0);
-
 				const float distance = 5; // distance of camera from player
 
-				Vector3 head_pos = Vector3Add(player->e.position, (Vector3){.y=camera_y_offset});
-				player->camera->position = Vector3Add(head_pos, Vector3Scale(Vector3Normalize(GetCameraForward(player->camera)), -distance));
+				player->camera->position = Vector3Add(head_pos, Vector3Scale(forward, -distance));
 				player->camera->target = head_pos;
 			}
 			break;
 	}
 }
 
-static void player_movement(player* player) {
+void player_look(player* player, Vector2 mouse_delta) {
+	const float camera_sensitivity = 0.007f;
+
+	if (player->gamemode == MODE_MENU || player->gamemode == MODE_PAUSED)
+		return;
+
+	CameraYaw(player->camera, camera_sensitivity * -mouse_delta.x, 0);
+	CameraPitch(player->camera, camera_sensitivity * -mouse_delta.y, 1, 0, 0);
+
+	player_place_camera(player, GetCameraForward(player->camera));
+}
+
+static void player_movement(player* player, const input_state* in) {
 	float speed_multiplier = 1;
 
 	if (player->gamemode == MODE_SPECTATOR)
@@ -147,30 +152,32 @@ static void player_movement(player* player) {
 	else
 		player->movement_speed = DEFAULT_MOVEMENT_SPEED;
 
-	Camera3D unrotated_cam = *player->camera;
-	unrotated_cam.target.y = unrotated_cam.position.y;
+	// along the ground whichever way the player is looking up or down
+	const Vector3 up = Vector3Normalize(player->camera->up);
+	const Vector3 forward = Vector3Normalize((Vector3){ in->look.x, 0, in->look.z });
+	const Vector3 right = Vector3Normalize(Vector3CrossProduct(forward, up));
 
 	Vector3 acceleration_delta = {0};
 
-	if (IsKeyDown(KEY_W))
-		acceleration_delta = Vector3Add(acceleration_delta, GetCameraForward(&unrotated_cam));
-	if (IsKeyDown(KEY_S))
-		acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(GetCameraForward(&unrotated_cam), -1));
-	if (IsKeyDown(KEY_A))
-		acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(GetCameraRight(&unrotated_cam), -1));
-	if (IsKeyDown(KEY_D))
-		acceleration_delta = Vector3Add(acceleration_delta, GetCameraRight(&unrotated_cam));
+	if (input_down(in, INPUT_FORWARD))
+		acceleration_delta = Vector3Add(acceleration_delta, forward);
+	if (input_down(in, INPUT_BACK))
+		acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(forward, -1));
+	if (input_down(in, INPUT_LEFT))
+		acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(right, -1));
+	if (input_down(in, INPUT_RIGHT))
+		acceleration_delta = Vector3Add(acceleration_delta, right);
 
 	if (player->is_flying) {
-		if (player->gamemode == MODE_SURVIVAL || (IsKeyPressed(KEY_F) && player->gamemode == MODE_CREATIVE))
+		if (player->gamemode == MODE_SURVIVAL || (input_pressed(in, INPUT_FLY) && player->gamemode == MODE_CREATIVE))
 			player->is_flying = 0;
 
-		if (IsKeyDown(KEY_SPACE))
-			acceleration_delta = Vector3Add(acceleration_delta, GetCameraUp(&unrotated_cam));
-		if (IsKeyDown(KEY_LEFT_SHIFT))
-			acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(GetCameraUp(&unrotated_cam), -1));
+		if (input_down(in, INPUT_JUMP))
+			acceleration_delta = Vector3Add(acceleration_delta, up);
+		if (input_down(in, INPUT_SNEAK))
+			acceleration_delta = Vector3Add(acceleration_delta, Vector3Scale(up, -1));
 	} else {
-		if (IsKeyPressed(KEY_F) && player->gamemode == MODE_CREATIVE) {
+		if (input_pressed(in, INPUT_FLY) && player->gamemode == MODE_CREATIVE) {
 			player->is_flying = 1;
 			player->e.velocity = Vector3Zero();
 		}
@@ -179,34 +186,38 @@ static void player_movement(player* player) {
 	// Jumping
 	if (player->e.is_on_ground) {
 		player->is_flying = 0;
-		if (IsKeyDown(KEY_SPACE)) {
+		if (input_down(in, INPUT_JUMP)) {
 			player->e.is_on_ground = 0;
-			entity_add_force(&player->e, (Vector3){.y=12});
+			entity_add_force(&player->e, (Vector3){.y=12}, in->delta_t);
 		}
 	} else if (!player->is_flying)
 		speed_multiplier *= 0.1;
 
 	// Sprint
-	if (IsKeyDown(KEY_LEFT_CONTROL))
+	if (input_down(in, INPUT_SPRINT))
 		speed_multiplier *= 1.4;
 	
 	acceleration_delta = Vector3Normalize(acceleration_delta);
 	acceleration_delta = Vector3Scale(acceleration_delta, player->movement_speed * speed_multiplier);
 
 	// apply movement
-	entity_add_force(&player->e, acceleration_delta);
+	entity_add_force(&player->e, acceleration_delta, in->delta_t);
 
 }
 
-static void player_physics(player* player) {
-	const float delta_t = GetFrameTime();
+static void player_physics(player* player, const input_state* in) {
+	const float delta_t = in->delta_t;
+
+	// hold the player still until the chunk below them has been generated
+	if (!in->world_ready)
+		return;
 
 	// Friction
 	if (!Vector3Equals(player->e.velocity, Vector3Zero())) {
 		if (player->e.is_on_ground)
-			entity_add_force(&player->e, Vector3Scale(player->e.velocity, -GROUND_FRICTION));
+			entity_add_force(&player->e, Vector3Scale(player->e.velocity, -GROUND_FRICTION), delta_t);
 		else
-			entity_add_force(&player->e, Vector3Scale(player->e.velocity, -AIR_FRICTION));
+			entity_add_force(&player->e, Vector3Scale(player->e.velocity, -AIR_FRICTION), delta_t);
 	}
 
 	if (FloatEquals(player->e.velocity.x, 0))
@@ -221,46 +232,109 @@ static void player_physics(player* player) {
 		if (!player->is_flying) {
 			// const float g = -9.81;
 			const float g = -45;
-			entity_add_force(&player->e, (Vector3){.y = g});
+			entity_add_force(&player->e, (Vector3){.y = g}, delta_t);
 		} 
 
-		// Collision
-		entity_block_collision(&player->e);
+		// apply velocity to position with collision, MUST BE LAST
+		entity_move(&player->e, delta_t);
+	} else {
+		// spectators fly through blocks
+		player->e.position = Vector3Add(player->e.position, Vector3Scale(player->e.velocity, delta_t));
 	}
+}
+
+/* Break the block the player is looking at, or place one
+ * against the face they are looking at. Sets edit_rejected if
+ * the chunk could not be edited.
+ */
+static void player_edit_blocks(player* player, const input_state* in) {
+	const bool breaking = input_pressed(in, INPUT_BREAK);
+	const bool placing = input_pressed(in, INPUT_PLACE);
 
-	// apply velocity to position, MUST BE LAST
-	player->e.position = Vector3Add(player->e.position, Vector3Scale(player->e.velocity, delta_t));
+	if ((!breaking && !placing) || player->gamemode == MODE_SPECTATOR)
+		return;
+
+	const Vector3 eye = Vector3Add(player->e.position, (Vector3){ .y = EYE_HEIGHT });
+	const world_raycast_result target = world_raycast(eye, in->look, player->reach);
+
+	if (!target.hit)
+		return;
+
+	if (breaking) {
+		player->edit_rejected = !world_set_block(target.chunk_pos, target.bx, target.by, target.bz, (block){0}); // AIR
+		return;
+	}
+
+	// the block in front of the face, which may be in the next chunk over
+	world_chunk_pos chunk_pos = target.chunk_pos;
+	int bx = target.bx + (int)target.normal.x;
+	int by = target.by + (int)target.normal.y;
+	int bz = target.bz + (int)target.normal.z;
+
+	if (bx < 0) {
+		bx += WORLD_CHUNK_WIDTH;
+		chunk_pos.x--;
+	} else if (bx >= WORLD_CHUNK_WIDTH) {
+		bx -= WORLD_CHUNK_WIDTH;
+		chunk_pos.x++;
+	}
+	if (bz < 0) {
+		bz += WORLD_CHUNK_WIDTH;
+		chunk_pos.z--;
+	} else if (bz >= WORLD_CHUNK_WIDTH) {
+		bz -= WORLD_CHUNK_WIDTH;
+		chunk_pos.z++;
+	}
+
+	if (by < 0 || by >= WORLD_CHUNK_HEIGHT)
+		return;
+
+	// not inside the player
+	Vector3 overlap;
+	if (entity_aabb(&player->e, get_block_real_pos(chunk_pos, bx, by, bz), &overlap))
+		return;
+
+	player->edit_rejected = !world_set_block(chunk_pos, bx, by, bz, (block){ .id = 2 }); // STONE
 }
 
 // update method for player
-void player_update(player* player) {
-	static bool is_cursor_enabled = 0;
+void player_update(player* player, const input_state* in) {
+	TRACE_ZONE("player_update");
+
+	player->e.previous_position = player->e.position;
+	player->edit_rejected = false;
 
 	// generic inputs (change gamemode camera mode etc.)
-	player_input(player);
+	player_input(player, in);
 
 	if (player->gamemode == MODE_MENU || player->gamemode == MODE_PAUSED) {
-		if (!is_cursor_enabled) {
-			EnableCursor();
-			is_cursor_enabled = 1;
-		}
-
 		if (player->gamemode == MODE_MENU) {
 			// TODO prevent player movement in menu mode
-			player_physics(player);
+			player_physics(player, in);
 		}
 
 	} else {
-		if (is_cursor_enabled) {
-			DisableCursor();
-			is_cursor_enabled = 0;
-		}
-
 		// handle player input movement
-		player_movement(player);
+		player_movement(player, in);
 		// apply physics (gravity, velocity etc.)
-		player_physics(player);
-		player_camera_movement(player);
-
+		player_physics(player, in);
+		// a played back tick turns the camera the way the recording did
+		player_place_camera(player, in->look);
+		player_edit_blocks(player, in);
 	}
 }
+
+world_raycast_result player_pick_block(const player* player) {
+	const Vector3 eye = Vector3Add(player->e.position, (Vector3){ .y = EYE_HEIGHT });
+
+	return world_raycast(eye, GetCameraForward(player->camera), player->reach);
+}
+
+world_chunk_pos player_chunk_pos(const player* player) {
+	// use of floor() is required since truncation rounds
+	// in th opposite direction for negative numbers.
+	return (world_chunk_pos){
+		.x = floorf(player->e.position.x / WORLD_CHUNK_WIDTH),
+		.z = floorf(player->e.position.z / WORLD_CHUNK_WIDTH),
+	};
+}
@@ -4,6 +4,7 @@
 
 #include "items.h"
 #include "entity.h"
+#include "input.h"
 
 
 typedef enum {
@@ -23,6 +24,7 @@ typedef struct {
 	float movement_speed;
 	float reach;
 	bool is_flying;
+	bool edit_rejected; // the last tick's break or place hit a chunk that was not ready
 	enum {
 		FIRST_PERSON = 0,
 		THIRD_PERSON,
@@ -35,5 +37,23 @@ typedef struct {
 player player_init(void);
 void player_destroy(player* p);
 
-// called every frame
-void player_update(player* player);
+/* Advance the player by one simulation tick of in. Everything the
+ * simulation reads comes from in, so the same inputs from the
+ * same starting state give the same result.
+ */
+void player_update(player* player, const input_state* in);
+
+/* Turn the camera by a frame's mouse movement. Called every frame
+ * rather than every tick so looking around is as smooth as the
+ * frame rate. The tick moves the player the way the camera faced
+ * when it ran, see input_state.look.
+ */
+void player_look(player* player, Vector2 mouse_delta);
+
+/* The block the player is looking at, within reach
+ */
+world_raycast_result player_pick_block(const player* player);
+
+/* Chunk the player is standing in
+ */
+world_chunk_pos player_chunk_pos(const player* player);
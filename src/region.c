@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "region.h"
+
+#define REGION_MAGIC "TCRG"
+#define REGION_VERSION 3
+#define REGION_SEED_OFFSET 8
+#define REGION_TABLE_OFFSET 12
+
+// records get rounded up to this so small edits can be written in place
+#define REGION_RECORD_ALIGN 512
+
+// how many region files are kept open at once
+#define REGION_CACHE_SIZE 8
+
+typedef struct {
+	bool open;
+	bool foreign; // written for another seed, kept open only so that is not reported again
+	int x, z;
+	int fd;
+
+	// read only view of the file, remapped when the file outgrows it
+	unsigned char* map;
+	size_t map_size;
+
+	region_entry table[REGION_CHUNK_COUNT];
+	unsigned long last_used;
+} region_file;
+
+/* Open region files, shared by the main thread (saving on unload)
+ * and the workers (loading). One lock covers everything, the
+ * work done while holding it is a memcpy or a pwrite.
+ */
+static struct {
+	pthread_mutex_t lock;
+	char directory[256];
+	uint32_t seed;
+	region_file files[REGION_CACHE_SIZE];
+	unsigned long clock;
+} REGIONS = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// floor division, so chunk -1 is in region -1 rather than 0
+static int region_coord(int chunk_coord) {
+	return chunk_coord >= 0 ? chunk_coord / REGION_WIDTH : (chunk_coord - REGION_WIDTH + 1) / REGION_WIDTH;
+}
+
+static unsigned int region_entry_index(world_chunk_pos pos) {
+	unsigned int x = pos.x - region_coord(pos.x) * REGION_WIDTH;
+	unsigned int z = pos.z - region_coord(pos.z) * REGION_WIDTH;
+
+	return z * REGION_WIDTH + x;
+}
+
+bool region_init(const char* directory, uint32_t seed) {
+	if (strlen(directory) >= sizeof(REGIONS.directory)) {
+		fprintf(stderr, "Region directory path is too long: %s\n", directory);
+		return false;
+	}
+
+	// create every component of the path
+	char path[sizeof(REGIONS.directory)];
+	strcpy(path, directory);
+
+	for (char* p = path + 1; ; p++) {
+		if (*p != '/' && *p != '\0')
+			continue;
+
+		char c = *p;
+		*p = '\0';
+
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Failed to create region directory %s: %s\n", path, strerror(errno));
+			return false;
+		}
+
+		*p = c;
+		if (c == '\0')
+			break;
+	}
+
+	pthread_mutex_lock(&REGIONS.lock);
+	strcpy(REGIONS.directory, directory);
+	REGIONS.seed = seed;
+	pthread_mutex_unlock(&REGIONS.lock);
+
+	return true;
+}
+
+static void region_file_close(region_file* rf) {
+	if (rf->map != NULL)
+		munmap(rf->map, rf->map_size);
+
+	close(rf->fd);
+
+	*rf = (region_file){0};
+}
+
+// the lock must be held
+static region_file* region_file_open(int x, int z, bool create) {
+	// region_init has not succeeded, nothing is persisted
+	if (REGIONS.directory[0] == '\0')
+		return NULL;
+
+	region_file* lru = &REGIONS.files[0];
+
+	for (unsigned int i = 0; i < REGION_CACHE_SIZE; i++) {
+		region_file* rf = &REGIONS.files[i];
+
+		if (rf->open && rf->x == x && rf->z == z) {
+			rf->last_used = ++REGIONS.clock;
+			return rf->foreign ? NULL : rf;
+		}
+
+		if (!rf->open || (lru->open && rf->last_used < lru->last_used))
+			lru = rf;
+	}
+
+	char path[sizeof(REGIONS.directory) + 32];
+	snprintf(path, sizeof(path), "%s/r.%d.%d.tcr", REGIONS.directory, x, z);
+
+	int fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Failed to open region file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (lru->open)
+		region_file_close(lru);
+
+	region_file* rf = lru;
+	*rf = (region_file){
+		.open = true,
+		.x = x,
+		.z = z,
+		.fd = fd,
+		.last_used = ++REGIONS.clock,
+	};
+
+	char magic[4];
+	uint32_t version, seed;
+
+	if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+			pread(fd, &version, sizeof(version), 4) == sizeof(version) &&
+			pread(fd, &seed, sizeof(seed), REGION_SEED_OFFSET) == sizeof(seed) &&
+			pread(fd, rf->table, sizeof(rf->table), REGION_TABLE_OFFSET) == sizeof(rf->table) &&
+			memcmp(magic, REGION_MAGIC, sizeof(magic)) == 0 &&
+			version == REGION_VERSION) {
+		if (seed == REGIONS.seed)
+			return rf;
+
+		fprintf(stderr, "Region file %s belongs to seed %u, not %u, ignoring it\n", path, seed, REGIONS.seed);
+		rf->foreign = true;
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size != 0) {
+		fprintf(stderr, "Region file %s is not a version %d region, ignoring it\n", path, REGION_VERSION);
+		region_file_close(rf);
+		return NULL;
+	}
+
+	if (!create) {
+		region_file_close(rf);
+		return NULL;
+	}
+
+	// new file, write an empty header
+	memset(rf->table, 0, sizeof(rf->table));
+	version = REGION_VERSION;
+	seed = REGIONS.seed;
+
+	if (pwrite(fd, REGION_MAGIC, 4, 0) != 4 ||
+			pwrite(fd, &version, sizeof(version), 4) != sizeof(version) ||
+			pwrite(fd, &seed, sizeof(seed), REGION_SEED_OFFSET) != sizeof(seed) ||
+			pwrite(fd, rf->table, sizeof(rf->table), REGION_TABLE_OFFSET) != sizeof(rf->table)) {
+		fprintf(stderr, "Failed to write region header %s: %s\n", path, strerror(errno));
+		region_file_close(rf);
+		return NULL;
+	}
+
+	return rf;
+}
+
+// make sure the mapping covers the first end bytes of the file
+static bool region_file_map(region_file* rf, size_t end) {
+	if (end <= rf->map_size)
+		return true;
+
+	struct stat st;
+	if (fstat(rf->fd, &st) != 0 || (size_t)st.st_size < end)
+		return false;
+
+	if (rf->map != NULL)
+		munmap(rf->map, rf->map_size);
+
+	rf->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, rf->fd, 0);
+	rf->map_size = st.st_size;
+
+	if (rf->map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map region file r.%d.%d.tcr: %s\n", rf->x, rf->z, strerror(errno));
+		rf->map = NULL;
+		rf->map_size = 0;
+		return false;
+	}
+
+	return true;
+}
+
+// decode a chunk record straight out of the mapping
+static bool region_read_record(chunk* chunk, const unsigned char* record, size_t size) {
+	uint32_t flags, section_count;
+
+	if (size < sizeof(flags) + sizeof(section_count))
+		return false;
+
+	memcpy(&flags, record, sizeof(flags));
+	memcpy(&section_count, record + sizeof(flags), sizeof(section_count));
+	if (section_count != CHUNK_SECTION_COUNT)
+		return false;
+
+	size_t read = sizeof(flags) + sizeof(section_count);
+	block_storage sections[CHUNK_SECTION_COUNT];
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		size_t n = block_storage_deserialize(&sections[s], CHUNK_SECTION_BLOCK_COUNT, record + read, size - read);
+
+		if (n == 0) {
+			for (unsigned int i = 0; i < s; i++)
+				block_storage_free(&sections[i]);
+			return false;
+		}
+
+		read += n;
+	}
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++) {
+		block_storage_free(&chunk->sections[s].blocks);
+		chunk->sections[s].blocks = sections[s];
+	}
+
+	chunk->edited = (flags & REGION_CHUNK_EDITED) != 0;
+
+	return true;
+}
+
+bool region_load_chunk(chunk* chunk) {
+	const world_chunk_pos pos = chunk->position;
+	bool loaded = false;
+
+	pthread_mutex_lock(&REGIONS.lock);
+
+	region_file* rf = region_file_open(region_coord(pos.x), region_coord(pos.z), false);
+
+	if (rf != NULL) {
+		const region_entry entry = rf->table[region_entry_index(pos)];
+
+		if (entry.offset != 0) {
+			loaded = region_file_map(rf, (size_t)entry.offset + entry.size) &&
+				region_read_record(chunk, rf->map + entry.offset, entry.size);
+
+			if (!loaded)
+				fprintf(stderr, "WARNING: Chunk (%d, %d) in r.%d.%d.tcr is corrupt, it will be regenerated\n",
+						pos.x, pos.z, rf->x, rf->z);
+		}
+	}
+
+	pthread_mutex_unlock(&REGIONS.lock);
+
+	// outside the lock, other workers may be waiting on it
+	if (loaded)
+		chunk_update_solid(chunk);
+
+	return loaded;
+}
+
+bool region_save_chunk(const chunk* chunk) {
+	const world_chunk_pos pos = chunk->position;
+
+	// build the record before taking the lock
+	const uint32_t flags = chunk->edited ? REGION_CHUNK_EDITED : 0;
+	const uint32_t section_count = CHUNK_SECTION_COUNT;
+	size_t size = sizeof(flags) + sizeof(section_count);
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++)
+		size += block_storage_serialized_size(&chunk->sections[s].blocks);
+
+	unsigned char* record = malloc(size);
+	if (record == NULL) {
+		fprintf(stderr, "Failed to allocate memory to save chunk (%d, %d)\n", pos.x, pos.z);
+		return false;
+	}
+
+	memcpy(record, &flags, sizeof(flags));
+	memcpy(record + sizeof(flags), &section_count, sizeof(section_count));
+	size_t written = sizeof(flags) + sizeof(section_count);
+
+	for (unsigned int s = 0; s < CHUNK_SECTION_COUNT; s++)
+		written += block_storage_serialize(&chunk->sections[s].blocks, record + written);
+
+	bool saved = false;
+
+	pthread_mutex_lock(&REGIONS.lock);
+
+	region_file* rf = region_file_open(region_coord(pos.x), region_coord(pos.z), true);
+
+	if (rf != NULL) {
+		const unsigned int index = region_entry_index(pos);
+		region_entry entry = rf->table[index];
+
+		// records that outgrow their space move to the end of the file,
+		// the old space is not reused
+		if (entry.offset == 0 || size > entry.capacity) {
+			struct stat st;
+
+			entry.offset = 0;
+			entry.capacity = (size + REGION_RECORD_ALIGN - 1) / REGION_RECORD_ALIGN * REGION_RECORD_ALIGN;
+
+			// reserve the whole capacity so the next record starts after it
+			if (fstat(rf->fd, &st) == 0 && ftruncate(rf->fd, st.st_size + entry.capacity) == 0)
+				entry.offset = st.st_size;
+		}
+
+		entry.size = size;
+
+		if (entry.offset != 0 &&
+				pwrite(rf->fd, record, size, entry.offset) == (ssize_t)size &&
+				pwrite(rf->fd, &entry, sizeof(entry), REGION_TABLE_OFFSET + sizeof(region_entry) * index) == sizeof(entry)) {
+			rf->table[index] = entry;
+			saved = true;
+		} else
+			fprintf(stderr, "Failed to save chunk (%d, %d) to r.%d.%d.tcr: %s\n", pos.x, pos.z, rf->x, rf->z, strerror(errno));
+	}
+
+	pthread_mutex_unlock(&REGIONS.lock);
+
+	free(record);
+
+	return saved;
+}
+
+void region_close_all(void) {
+	pthread_mutex_lock(&REGIONS.lock);
+
+	for (unsigned int i = 0; i < REGION_CACHE_SIZE; i++)
+		if (REGIONS.files[i].open)
+			region_file_close(&REGIONS.files[i]);
+
+	pthread_mutex_unlock(&REGIONS.lock);
+}
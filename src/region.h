@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chunk.h"
+
+// a region file holds REGION_WIDTH x REGION_WIDTH chunks
+#define REGION_WIDTH 32
+#define REGION_CHUNK_COUNT (REGION_WIDTH * REGION_WIDTH)
+
+/* Region files are named r.<x>.<z>.tcr and start with a header
+ * followed by the chunk records:
+ *
+ *   char     magic[4]  "TCRG"
+ *   uint32   version
+ *   uint32   seed      the world's chunk_generation_options.seed
+ *   region_entry table[REGION_CHUNK_COUNT]  indexed by local z * REGION_WIDTH + local x
+ *
+ * Files written for another seed are left alone, their chunks
+ * count as not stored and nothing is saved into them, so they
+ * never mix with chunks generated from this seed.
+ * A chunk record is a uint32 of REGION_CHUNK_* flags and a uint32
+ * section count, followed by each section's
+ * block_storage_serialize data. Records live at the
+ * byte offset in their table entry, with capacity bytes reserved
+ * so a chunk can grow a little without moving.
+ * Everything is stored in native byte order.
+ */
+// the chunk was edited, see chunk.edited
+#define REGION_CHUNK_EDITED 1u
+
+typedef struct {
+	uint32_t offset;   // 0 means the chunk is not stored
+	uint32_t size;
+	uint32_t capacity;
+} region_entry;
+
+/* Set the directory region files are kept in, creating it if
+ * needed, and the seed of the world they belong to. Until this
+ * succeeds chunks are neither loaded nor saved.
+ * Returns false if the directory could not be created.
+ */
+bool region_init(const char* directory, uint32_t seed);
+
+/* Fill chunk's blocks, and chunk.edited, from its region file.
+ * Returns false if the chunk is not stored, the chunk is left
+ * as it was in that case.
+ * Safe to call from worker threads.
+ */
+bool region_load_chunk(chunk* chunk);
+
+/* Write chunk's blocks to its region file.
+ * Returns false if the chunk could not be written.
+ * Safe to call from worker threads.
+ */
+bool region_save_chunk(const chunk* chunk);
+
+/* Unmap and close every open region file
+ */
+void region_close_all(void);
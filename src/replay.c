@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+#include "worker.h"
+#include "world.h"
+
+#define REPLAY_MAGIC "TCIR"
+#define REPLAY_VERSION 2
+
+bool replay_record_begin(replay* r, const char* path, const chunk_generation_options* opts, const player* p) {
+	*r = (replay){0};
+
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "Failed to create replay %s\n", path);
+		return false;
+	}
+
+	const uint32_t version = REPLAY_VERSION;
+	const replay_world world = {
+		.seed = opts->seed,
+		.perlin_amplitude = opts->perlin_amplitude,
+		.perlin_frequency = opts->perlin_frequency,
+		.octaves = opts->octaves,
+	};
+	const replay_player state = {
+		.position = p->e.position,
+		.velocity = p->e.velocity,
+		.camera_position = p->camera->position,
+		.camera_target = p->camera->target,
+		.camera_up = p->camera->up,
+		.gamemode = p->gamemode,
+		.camera_mode = p->camera_mode,
+		.is_flying = p->is_flying,
+		.is_on_ground = p->e.is_on_ground,
+	};
+
+	if (fwrite(REPLAY_MAGIC, 4, 1, f) != 1 ||
+			fwrite(&version, sizeof(version), 1, f) != 1 ||
+			fwrite(&world, sizeof(world), 1, f) != 1 ||
+			fwrite(&state, sizeof(state), 1, f) != 1) {
+		fprintf(stderr, "Failed to write replay header %s\n", path);
+		fclose(f);
+		return false;
+	}
+
+	r->file = f;
+	r->writing = true;
+
+	return true;
+}
+
+void replay_record_tick(replay* r, const input_state* in, const player* p) {
+	if (r->file == NULL || !r->writing)
+		return;
+
+	// an edit the world turned down is left out, so playback does not make it
+	const uint32_t rejected = p->edit_rejected ? INPUT_BREAK | INPUT_PLACE : 0;
+
+	const replay_tick tick = {
+		.delta_t = in->delta_t,
+		.look = in->look,
+		.down = in->down,
+		.pressed = in->pressed & ~rejected,
+		.world_ready = in->world_ready,
+		.position = p->e.position,
+	};
+
+	if (fwrite(&tick, sizeof(tick), 1, r->file) != 1) {
+		fprintf(stderr, "Failed to write replay tick %lu, recording stopped\n", r->tick);
+		replay_close(r);
+		return;
+	}
+
+	r->tick++;
+}
+
+bool replay_play_begin(replay* r, const char* path, chunk_generation_options* opts, player* p) {
+	*r = (replay){0};
+
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Failed to open replay %s\n", path);
+		return false;
+	}
+
+	char magic[4];
+	uint32_t version;
+	replay_world world;
+	replay_player state;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+			fread(&version, sizeof(version), 1, f) != 1 ||
+			memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 ||
+			version != REPLAY_VERSION ||
+			fread(&world, sizeof(world), 1, f) != 1 ||
+			fread(&state, sizeof(state), 1, f) != 1) {
+		fprintf(stderr, "%s is not a version %d replay\n", path, REPLAY_VERSION);
+		fclose(f);
+		return false;
+	}
+
+	opts->seed = world.seed;
+	opts->perlin_amplitude = world.perlin_amplitude;
+	opts->perlin_frequency = world.perlin_frequency;
+	opts->octaves = world.octaves;
+
+	p->e.position = state.position;
+	p->e.previous_position = state.position;
+	p->e.velocity = state.velocity;
+	p->e.is_on_ground = state.is_on_ground;
+	p->camera->position = state.camera_position;
+	p->camera->target = state.camera_target;
+	p->camera->up = state.camera_up;
+	p->gamemode = state.gamemode;
+	p->camera_mode = state.camera_mode;
+	p->is_flying = state.is_flying;
+
+	r->file = f;
+	r->writing = false;
+
+	return true;
+}
+
+bool replay_play_tick(replay* r, input_state* in, Vector3* expected_position) {
+	if (r->file == NULL || r->writing)
+		return false;
+
+	replay_tick tick;
+
+	if (fread(&tick, sizeof(tick), 1, r->file) != 1)
+		return false;
+
+	*in = (input_state){
+		.delta_t = tick.delta_t,
+		.look = tick.look,
+		.down = tick.down,
+		.pressed = tick.pressed,
+		.world_ready = tick.world_ready != 0,
+	};
+
+	if (expected_position != NULL)
+		*expected_position = tick.position;
+
+	r->tick++;
+
+	return true;
+}
+
+void replay_wait_for_world(const input_state* in, const player* p) {
+	if (!in->world_ready)
+		return;
+
+	// collision reads the chunks around the player too
+	const world_chunk_pos center = player_chunk_pos(p);
+
+	bool missing = false;
+
+	for (int x = -1; x <= 1; x++)
+		for (int z = -1; z <= 1; z++)
+			missing |= world_chunk_lookup((world_chunk_pos){ center.x + x, center.z + z }) == NULL;
+
+	if (missing)
+		world_wait_for_chunks_around(center, 2);
+
+	// the recording's edits all went through, so the chunks they hit must take edits
+	if (input_pressed(in, INPUT_BREAK) || input_pressed(in, INPUT_PLACE)) {
+		worker_pool_wait_idle();
+		world_upload_chunks((unsigned int)-1);
+	}
+}
+
+void replay_close(replay* r) {
+	if (r->file != NULL && fclose(r->file) != 0 && r->writing)
+		fputs("Failed to finish writing replay\n", stderr);
+
+	*r = (replay){0};
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chunk.h"
+#include "input.h"
+#include "player.h"
+
+/* Recordings of the player simulation's inputs, so a session
+ * can be played back tick for tick.
+ *
+ * A replay file starts with a header:
+ *
+ *   char     magic[4]  "TCIR"
+ *   uint32   version
+ *   replay_world   the terrain generation options
+ *   replay_player  the player's state before the first tick
+ *
+ * followed by one replay_tick per player_update until the end of
+ * the file. Everything is stored in native byte order, replays
+ * are only expected to match on the machine and build that made
+ * them.
+ *
+ * Every tick also stores where the player ended up, so playing a
+ * replay back tells you the first tick where the simulation no
+ * longer matches the recording. Terrain comes from the seed, so a
+ * replay only matches a world without edits saved in its region
+ * files.
+ */
+
+typedef struct {
+	uint32_t seed;
+	float perlin_amplitude;
+	float perlin_frequency;
+	uint32_t octaves;
+} replay_world;
+
+typedef struct {
+	Vector3 position;
+	Vector3 velocity;
+	Vector3 camera_position;
+	Vector3 camera_target;
+	Vector3 camera_up;
+	int32_t gamemode;
+	int32_t camera_mode;
+	uint8_t is_flying;
+	uint8_t is_on_ground;
+	uint8_t padding[2];
+} replay_player;
+
+typedef struct {
+	float delta_t;
+	Vector3 look; // where the camera faced, the mouse turns it between ticks
+	uint32_t down;
+	uint32_t pressed;
+	uint32_t world_ready;
+	Vector3 position; // player position after the tick
+} replay_tick;
+
+typedef struct {
+	FILE* file;
+	bool writing;
+	unsigned long tick; // ticks written or read so far
+} replay;
+
+/* Start recording to path, with p as it is before the first tick.
+ * Returns false if the file could not be created.
+ */
+bool replay_record_begin(replay* r, const char* path, const chunk_generation_options* opts, const player* p);
+
+/* Append the input of the tick that was just simulated, with p
+ * as it is after player_update.
+ */
+void replay_record_tick(replay* r, const input_state* in, const player* p);
+
+/* Open the replay at path, filling opts (the mesher is left as
+ * it was) and setting p to the recorded starting state.
+ * Returns false if the file cannot be read or is not a replay.
+ */
+bool replay_play_begin(replay* r, const char* path, chunk_generation_options* opts, player* p);
+
+/* Read the next tick's input, and where the player should be
+ * after it. Returns false at the end of the replay.
+ */
+bool replay_play_tick(replay* r, input_state* in, Vector3* expected_position);
+
+/* Generate the chunks around p that a played back tick expects
+ * to collide with, if the recording had them loaded. Without this
+ * a replay runs ahead of chunk generation and no longer matches.
+ * Before a tick that breaks or places a block every finished
+ * chunk is uploaded too, since only uploaded chunks take edits.
+ * Edits the world turned down while recording are not recorded.
+ */
+void replay_wait_for_world(const input_state* in, const player* p);
+
+void replay_close(replay* r);
@@ -0,0 +1,162 @@
+#include "trace.h"
+
+#ifdef TINYCRAFT_TRACE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+typedef struct {
+	const char* name;
+	uint64_t start_ns;
+	uint64_t end_ns;
+} trace_event;
+
+/* One thread's zones. Only the owning thread writes events and
+ * head, dumping reads them from another thread and throws away
+ * whatever the writer may have overwritten while it was reading.
+ */
+typedef struct {
+	_Atomic uint64_t head; // events ever written
+	const char* _Atomic name;
+	trace_event events[TRACE_BUFFER_SIZE];
+} trace_buffer;
+
+static struct {
+	trace_buffer* _Atomic buffers[TRACE_MAX_THREADS];
+	atomic_uint count;
+	atomic_bool warned;
+} TRACE = {0};
+
+static _Thread_local trace_buffer* THREAD_BUFFER = NULL;
+
+uint64_t trace_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// the calling thread's buffer, registered on first use
+static trace_buffer* trace_thread_buffer(void) {
+	if (THREAD_BUFFER != NULL)
+		return THREAD_BUFFER;
+
+	const unsigned int index = atomic_fetch_add(&TRACE.count, 1);
+
+	if (index >= TRACE_MAX_THREADS) {
+		atomic_store(&TRACE.count, TRACE_MAX_THREADS);
+		if (!atomic_exchange(&TRACE.warned, true))
+			fputs("WARNING: Too many threads to trace, the rest are ignored\n", stderr);
+		return NULL;
+	}
+
+	// kept until exit, a thread's zones are still wanted after it ends
+	trace_buffer* buffer = calloc(1, sizeof(trace_buffer));
+	if (buffer == NULL) {
+		fputs("WARNING: Failed to allocate memory for a trace buffer\n", stderr);
+		return NULL;
+	}
+
+	atomic_store(&TRACE.buffers[index], buffer);
+
+	return THREAD_BUFFER = buffer;
+}
+
+void trace_zone_end(trace_zone* zone) {
+	trace_buffer* buffer = trace_thread_buffer();
+	if (buffer == NULL)
+		return;
+
+	const uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+	buffer->events[head & (TRACE_BUFFER_SIZE - 1)] = (trace_event){
+		.name = zone->name,
+		.start_ns = zone->start_ns,
+		.end_ns = trace_now_ns(),
+	};
+
+	atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+void trace_thread_name(const char* name) {
+	trace_buffer* buffer = trace_thread_buffer();
+
+	if (buffer != NULL)
+		atomic_store(&buffer->name, name);
+}
+
+bool trace_dump(const char* path, double seconds) {
+	const uint64_t now = trace_now_ns();
+	const double window_ns = seconds * 1e9;
+	const uint64_t since = window_ns < (double)now ? now - (uint64_t)window_ns : 0;
+
+	trace_event* events = malloc(sizeof(trace_event) * TRACE_BUFFER_SIZE);
+	FILE* f = fopen(path, "w");
+
+	if (events == NULL || f == NULL) {
+		fprintf(stderr, "Failed to write trace to %s\n", path);
+		free(events);
+		if (f != NULL)
+			fclose(f);
+		return false;
+	}
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+
+	bool first = true;
+	size_t written = 0;
+	const unsigned int count = atomic_load(&TRACE.count);
+
+	for (unsigned int t = 0; t < count && t < TRACE_MAX_THREADS; t++) {
+		trace_buffer* buffer = atomic_load(&TRACE.buffers[t]);
+		if (buffer == NULL)
+			continue;
+
+		const char* name = atomic_load(&buffer->name);
+
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", t, name != NULL ? name : "thread");
+		first = false;
+
+		// copy first, then drop anything the thread lapped while we copied
+		const uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+		const uint64_t begin = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+
+		for (uint64_t i = begin; i < head; i++)
+			events[i - begin] = buffer->events[i & (TRACE_BUFFER_SIZE - 1)];
+
+		atomic_thread_fence(memory_order_acquire);
+		const uint64_t head_after = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+		const uint64_t valid = head_after > TRACE_BUFFER_SIZE ? head_after - TRACE_BUFFER_SIZE : 0;
+
+		for (uint64_t i = valid > begin ? valid : begin; i < head; i++) {
+			const trace_event* e = &events[i - begin];
+
+			if (e->end_ns < since)
+				continue;
+
+			// timestamps are in microseconds
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					e->name, t, e->start_ns / 1000.0, (e->end_ns - e->start_ns) / 1000.0);
+			written++;
+		}
+	}
+
+	fputs("\n]}\n", f);
+
+	const bool ok = !ferror(f);
+	if (fclose(f) != 0 || !ok) {
+		fprintf(stderr, "Failed to write trace to %s\n", path);
+		free(events);
+		return false;
+	}
+
+	free(events);
+
+	printf("Wrote %zu trace events to %s\n", written, path);
+
+	return true;
+}
+
+#endif
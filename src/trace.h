@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Scoped timing zones for finding hitches.
+ *
+ * Build with `make TRACE=1` (which defines TINYCRAFT_TRACE) to
+ * enable them. Otherwise every macro here expands to nothing, so
+ * instrumented code is exactly the code without them.
+ *
+ *   void chunk_do_something(void) {
+ *       TRACE_ZONE("chunk_do_something");
+ *       ...
+ *   }
+ *
+ * A zone ends when the enclosing block does. Each thread records
+ * its zones into its own ring buffer without taking any locks,
+ * the oldest zones are overwritten once a buffer is full.
+ * trace_dump writes what is in the buffers in the Chrome trace
+ * event format, which chrome://tracing and ui.perfetto.dev load.
+ */
+
+// how much history the dump hotkey writes out
+#define TRACE_DUMP_SECONDS 10.0
+
+#ifdef TINYCRAFT_TRACE
+
+// zones each thread remembers, must be a power of two
+#define TRACE_BUFFER_SIZE (1 << 15)
+
+// threads beyond this many are not traced
+#define TRACE_MAX_THREADS 64
+
+typedef struct {
+	const char* name;
+	uint64_t start_ns;
+} trace_zone;
+
+uint64_t trace_now_ns(void);
+
+void trace_zone_end(trace_zone* zone);
+
+/* Name the calling thread in dumps. name must outlive the
+ * thread, a string literal is best.
+ */
+void trace_thread_name(const char* name);
+
+/* Write every zone that ended in the last seconds seconds to
+ * path as a Chrome trace. Zone names are written as they are,
+ * they must not need escaping in JSON.
+ * Returns false if the file could not be written.
+ */
+bool trace_dump(const char* path, double seconds);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/* Time the rest of the enclosing block as name, which must be a
+ * string literal (or otherwise live forever).
+ */
+#define TRACE_ZONE(zone_name) \
+	trace_zone TRACE_CONCAT(trace_zone_, __LINE__) __attribute__((cleanup(trace_zone_end))) = \
+		{ .name = (zone_name), .start_ns = trace_now_ns() }
+
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+static inline bool trace_dump(const char* path, double seconds) {
+	(void)path;
+	(void)seconds;
+	fputs("Tracing is compiled out, rebuild with `make TRACE=1`\n", stderr);
+	return false;
+}
+
+#endif
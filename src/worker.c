@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "worker.h"
+
+typedef struct {
+	worker_job_func func;
+	void* args;
+} worker_job;
+
+// jobs are kept in a growable ring buffer
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t job_available;
+	pthread_cond_t idle;
+
+	worker_job* jobs;
+	size_t capacity;
+	size_t head; // next job to run
+	size_t count;
+
+	unsigned int running; // jobs currently being run
+	bool stopping;
+
+	pthread_t* threads;
+	unsigned int thread_count;
+} POOL = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.job_available = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+static void* worker_thread(void* args) {
+	(void)args;
+
+	TRACE_THREAD_NAME("worker");
+
+	pthread_mutex_lock(&POOL.lock);
+
+	for (;;) {
+		while (POOL.count == 0 && !POOL.stopping)
+			pthread_cond_wait(&POOL.job_available, &POOL.lock);
+
+		if (POOL.count == 0 && POOL.stopping)
+			break;
+
+		worker_job job = POOL.jobs[POOL.head];
+		POOL.head = (POOL.head + 1) % POOL.capacity;
+		POOL.count--;
+		POOL.running++;
+
+		pthread_mutex_unlock(&POOL.lock);
+		job.func(job.args);
+		pthread_mutex_lock(&POOL.lock);
+
+		POOL.running--;
+		if (POOL.count == 0 && POOL.running == 0)
+			pthread_cond_broadcast(&POOL.idle);
+	}
+
+	pthread_mutex_unlock(&POOL.lock);
+
+	return NULL;
+}
+
+void worker_pool_init(unsigned int thread_count) {
+	if (thread_count == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = cores > 0 ? cores : 1;
+	}
+
+	POOL.threads = malloc(sizeof(pthread_t) * thread_count);
+	if (POOL.threads == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate memory for worker threads\n");
+		exit(1);
+	}
+
+	POOL.stopping = false;
+	POOL.thread_count = 0;
+
+	for (unsigned int i = 0; i < thread_count; i++) {
+		if (pthread_create(&POOL.threads[i], NULL, worker_thread, NULL) != 0) {
+			fprintf(stderr, "WARNING: Failed to start worker thread %u\n", i);
+			break;
+		}
+		POOL.thread_count++;
+	}
+
+	if (POOL.thread_count == 0) {
+		fprintf(stderr, "ERROR: No worker threads could be started\n");
+		exit(1);
+	}
+}
+
+void worker_pool_destroy(void) {
+	pthread_mutex_lock(&POOL.lock);
+	POOL.stopping = true;
+	pthread_cond_broadcast(&POOL.job_available);
+	pthread_mutex_unlock(&POOL.lock);
+
+	for (unsigned int i = 0; i < POOL.thread_count; i++)
+		pthread_join(POOL.threads[i], NULL);
+
+	free(POOL.threads);
+	free(POOL.jobs);
+
+	POOL.threads = NULL;
+	POOL.thread_count = 0;
+	POOL.jobs = NULL;
+	POOL.capacity = 0;
+	POOL.head = 0;
+	POOL.count = 0;
+}
+
+// grow the ring buffer if it is full, call with the lock held
+static bool worker_pool_reserve(void) {
+	if (POOL.count < POOL.capacity)
+		return true;
+
+	size_t new_capacity = POOL.capacity ? POOL.capacity * 2 : 64;
+	worker_job* jobs = malloc(sizeof(worker_job) * new_capacity);
+
+	if (jobs == NULL) {
+		fputs("Failed to allocate memory for the job queue\n", stderr);
+		return false;
+	}
+
+	// unwrap the ring buffer into the new allocation
+	for (size_t i = 0; i < POOL.count; i++)
+		jobs[i] = POOL.jobs[(POOL.head + i) % POOL.capacity];
+
+	free(POOL.jobs);
+	POOL.jobs = jobs;
+	POOL.capacity = new_capacity;
+	POOL.head = 0;
+
+	return true;
+}
+
+bool worker_pool_submit(worker_job_func func, void* args) {
+	pthread_mutex_lock(&POOL.lock);
+
+	if (!worker_pool_reserve()) {
+		pthread_mutex_unlock(&POOL.lock);
+		return false;
+	}
+
+	POOL.jobs[(POOL.head + POOL.count) % POOL.capacity] = (worker_job){
+		.func = func,
+		.args = args,
+	};
+	POOL.count++;
+
+	pthread_cond_signal(&POOL.job_available);
+	pthread_mutex_unlock(&POOL.lock);
+
+	return true;
+}
+
+bool worker_pool_submit_urgent(worker_job_func func, void* args) {
+	pthread_mutex_lock(&POOL.lock);
+
+	if (!worker_pool_reserve()) {
+		pthread_mutex_unlock(&POOL.lock);
+		return false;
+	}
+
+	POOL.head = (POOL.head + POOL.capacity - 1) % POOL.capacity;
+	POOL.jobs[POOL.head] = (worker_job){
+		.func = func,
+		.args = args,
+	};
+	POOL.count++;
+
+	pthread_cond_signal(&POOL.job_available);
+	pthread_mutex_unlock(&POOL.lock);
+
+	return true;
+}
+
+void worker_pool_wait_idle(void) {
+	pthread_mutex_lock(&POOL.lock);
+
+	while (POOL.count != 0 || POOL.running != 0)
+		pthread_cond_wait(&POOL.idle, &POOL.lock);
+
+	pthread_mutex_unlock(&POOL.lock);
+}
+
+unsigned int worker_pool_thread_count(void) {
+	return POOL.thread_count;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* Function run on a worker thread. args is whatever was
+ * passed to worker_pool_submit.
+ */
+typedef void (*worker_job_func)(void* args);
+
+/* Start the worker threads. If thread_count is 0 one thread
+ * is started per online core.
+ * This must be called before worker_pool_submit.
+ */
+void worker_pool_init(unsigned int thread_count);
+
+/* Finish every queued job and join the worker threads.
+ */
+void worker_pool_destroy(void);
+
+/* Queue a job to run on a worker thread. Jobs are started in
+ * the order they are submitted.
+ * Returns false if the job could not be queued.
+ */
+bool worker_pool_submit(worker_job_func func, void* args);
+
+/* Queue a job ahead of every job already queued, for short jobs
+ * the caller is about to wait on.
+ * Returns false if the job could not be queued.
+ */
+bool worker_pool_submit_urgent(worker_job_func func, void* args);
+
+/* Block until the queue is empty and no job is running.
+ */
+void worker_pool_wait_idle(void);
+
+/* Number of running worker threads
+ */
+unsigned int worker_pool_thread_count(void);
@@ -1,15 +1,72 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
 
 #include "chunk.h"
+#include "culling.h"
 #include "global.h"
+#include "region.h"
+#include "trace.h"
 #include "world.h"
+#include "worker.h"
 
 world_data WORLD = {0};
 
+/* Chunks that workers have finished with, waiting for the
+ * main thread to upload (or free, if they were discarded).
+ */
+static struct {
+	pthread_mutex_t lock;
+	chunk** chunks;
+	size_t count;
+	size_t capacity;
+} COMPLETED_CHUNKS = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Uploaded chunks arranged for frustum culling. Rebuilt before
+ * the next render whenever a chunk is uploaded or unloaded.
+ */
+static chunk_cull_tree CULL_TREE = {0};
+static bool CULL_TREE_DIRTY = true;
+
+// counts rendered frames, chunks remember the last one they were visible in
+static unsigned long FRAME = 0;
+
+/* A chunk section reached by the cave culling flood fill, see
+ * world_cave_cull.
+ */
+typedef struct {
+	chunk* chunk;
+	unsigned char section;
+	unsigned char from;       // face it was entered through, WORLD_CAVE_START for the camera's section
+	unsigned char directions; // chunk_face_direction bits stepped along to get here
+} world_cave_node;
+
+#define WORLD_CAVE_START 6
+
+static struct {
+	world_cave_node* nodes;
+	size_t capacity;
+} CAVE_QUEUE = {0};
+
+static size_t CHUNK_MEMORY_USAGE = 0;
+
+/* Positions of chunks with chunk->dirty set, remeshed by
+ * world_remesh_dirty_chunks. Positions rather than pointers
+ * so unloading a dirty chunk needs no bookkeeping.
+ */
+static struct {
+	world_chunk_pos* positions;
+	size_t count;
+	size_t capacity;
+} DIRTY_CHUNKS = {0};
+
 void world_init(world_data* wd) {
 	if (wd == NULL) {
 		WORLD = (world_data){
@@ -18,11 +75,19 @@ void world_init(world_data* wd) {
 				.perlin_amplitude = 3.0f,
 				.perlin_frequency = 0.05f,
 				.octaves = 2,
+				.mesher = CHUNK_MESHER_GREEDY,
 			},
 			.chunk_dict = (chunk_dictionary){0},
+			.save_directory = "saves/world",
 		};
 	} else
 		WORLD = *wd;
+
+	// the world still works without saving, it is just regenerated every run
+	if (WORLD.save_directory != NULL && !region_init(WORLD.save_directory, WORLD.chunk_opts.seed))
+		fputs("WARNING: Chunks will not be saved\n", stderr);
+
+	worker_pool_init(0);
 }
 
 /* Get the real position of a block from chunk_pos and 
@@ -36,46 +101,747 @@ inline Vector3 get_block_real_pos(world_chunk_pos chunk_pos, int bx, int by, int
 	};
 }
 
-inline block* world_get_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz) {
+inline block world_get_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz) {
 	chunk* chunk = world_chunk_lookup(chunk_pos);
 
 	if (chunk == NULL)
+		return (block){0};
+
+	return chunk_get_block(chunk, bx, by, bz);
+}
+
+// floor division, for chunk coordinates of negative block positions
+static inline int world_floor_div(int a, int b) {
+	return a >= 0 ? a / b : (a - b + 1) / b;
+}
+
+world_raycast_result world_raycast(Vector3 origin, Vector3 direction, float max_distance) {
+	world_raycast_result result = { .distance = max_distance };
+
+	// block y covers [y - 1, y], so the grid is shifted up by one
+	int cell[3] = { floorf(origin.x), floorf(origin.y) + 1, floorf(origin.z) };
+	const float o[3] = { origin.x, origin.y, origin.z };
+	const float d[3] = { direction.x, direction.y, direction.z };
+
+	int step[3];
+	float t_max[3];   // distance to the next boundary on each axis
+	float t_delta[3]; // distance between boundaries on each axis
+
+	for (unsigned int i = 0; i < 3; i++) {
+		// cell i runs from lower to lower + 1
+		const float lower = i == 1 ? cell[i] - 1 : cell[i];
+
+		if (d[i] > 0) {
+			step[i] = 1;
+			t_delta[i] = 1.0f / d[i];
+			t_max[i] = (lower + 1 - o[i]) * t_delta[i];
+		} else if (d[i] < 0) {
+			step[i] = -1;
+			t_delta[i] = -1.0f / d[i];
+			t_max[i] = (o[i] - lower) * t_delta[i];
+		} else {
+			step[i] = 0;
+			t_delta[i] = INFINITY;
+			t_max[i] = INFINITY;
+		}
+	}
+
+	// faces entered when stepping forwards along each axis,
+	// stepping backwards enters the opposite face
+	static const chunk_face_direction entered_forwards[3] = { FACE_DIR_RIGHT, FACE_DIR_BOTTOM, FACE_DIR_BACK };
+	static const chunk_face_direction entered_backwards[3] = { FACE_DIR_LEFT, FACE_DIR_TOP, FACE_DIR_FRONT };
+
+	// a ray starting inside a block enters it against its largest component
+	unsigned int axis = fabsf(d[0]) >= fabsf(d[1]) && fabsf(d[0]) >= fabsf(d[2]) ? 0 : fabsf(d[1]) >= fabsf(d[2]) ? 1 : 2;
+	float t = 0;
+
+	world_chunk_pos chunk_pos = { world_floor_div(cell[0], WORLD_CHUNK_WIDTH), world_floor_div(cell[2], WORLD_CHUNK_WIDTH) };
+	const chunk* chunk = world_chunk_lookup(chunk_pos);
+
+	while (t <= max_distance) {
+		if (cell[1] >= 0 && cell[1] < WORLD_CHUNK_HEIGHT) {
+			const world_chunk_pos pos = { world_floor_div(cell[0], WORLD_CHUNK_WIDTH), world_floor_div(cell[2], WORLD_CHUNK_WIDTH) };
+
+			if (pos.x != chunk_pos.x || pos.z != chunk_pos.z) {
+				chunk_pos = pos;
+				chunk = world_chunk_lookup(chunk_pos);
+			}
+
+			if (chunk != NULL) {
+				const int bx = cell[0] - chunk_pos.x * WORLD_CHUNK_WIDTH;
+				const int bz = cell[2] - chunk_pos.z * WORLD_CHUNK_WIDTH;
+				const block b = chunk_get_block(chunk, bx, cell[1], bz);
+
+				if (b.id != 0) {
+					const chunk_face_direction face = step[axis] >= 0 ? entered_forwards[axis] : entered_backwards[axis];
+					float normal[3] = {0};
+					normal[axis] = step[axis] >= 0 ? -1 : 1;
+
+					return (world_raycast_result){
+						.hit = true,
+						.chunk_pos = chunk_pos,
+						.bx = bx,
+						.by = cell[1],
+						.bz = bz,
+						.face = face,
+						.normal = { normal[0], normal[1], normal[2] },
+						.distance = t,
+						.block = b,
+					};
+				}
+			}
+		} else if ((cell[1] < 0 && step[1] <= 0) || (cell[1] >= WORLD_CHUNK_HEIGHT && step[1] >= 0))
+			break; // outside the world and not coming back
+
+		// step to the closest boundary
+		axis = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+
+		if (step[axis] == 0)
+			break; // zero direction
+
+		t = t_max[axis];
+		t_max[axis] += t_delta[axis];
+		cell[axis] += step[axis];
+	}
+
+	return result;
+}
+
+static void world_mark_chunk_dirty(world_chunk_pos pos) {
+	chunk_dict_entry* entry = chunk_dict_lookup(&WORLD.chunk_dict, pos);
+
+	if (entry == NULL || entry->value->dirty)
+		return;
+
+	if (DIRTY_CHUNKS.count == DIRTY_CHUNKS.capacity) {
+		size_t new_capacity = DIRTY_CHUNKS.capacity ? DIRTY_CHUNKS.capacity * 2 : 16;
+		world_chunk_pos* positions = realloc(DIRTY_CHUNKS.positions, sizeof(*positions) * new_capacity);
+
+		if (positions == NULL) {
+			fputs("Failed to allocate memory for the dirty chunk list\n", stderr);
+			return;
+		}
+
+		DIRTY_CHUNKS.positions = positions;
+		DIRTY_CHUNKS.capacity = new_capacity;
+	}
+
+	entry->value->dirty = true;
+	DIRTY_CHUNKS.positions[DIRTY_CHUNKS.count++] = pos;
+}
+
+bool world_set_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz, block b) {
+	if (bx >= WORLD_CHUNK_WIDTH || by >= WORLD_CHUNK_HEIGHT || bz >= WORLD_CHUNK_WIDTH)
+		return false;
+
+	chunk_dict_entry* entry = chunk_dict_lookup(&WORLD.chunk_dict, chunk_pos);
+
+	// until a chunk is uploaded a worker may still be reading its blocks
+	if (entry == NULL || chunk_get_state(entry->value) != CHUNK_STATE_UPLOADED)
+		return false;
+
+	chunk* chunk = entry->value;
+
+	if (chunk_get_block(chunk, bx, by, bz).id == b.id)
+		return true;
+
+	if (!chunk_set_block(chunk, bx, by, bz, b))
+		return false;
+
+	chunk->modified = true;
+	chunk->edited = true;
+	world_mark_chunk_dirty(chunk_pos);
+
+	// the neighbour's face against this block may have appeared or gone
+	if (bx == 0)
+		world_mark_chunk_dirty((world_chunk_pos){ chunk_pos.x - 1, chunk_pos.z });
+	if (bx == WORLD_CHUNK_WIDTH - 1)
+		world_mark_chunk_dirty((world_chunk_pos){ chunk_pos.x + 1, chunk_pos.z });
+	if (bz == 0)
+		world_mark_chunk_dirty((world_chunk_pos){ chunk_pos.x, chunk_pos.z - 1 });
+	if (bz == WORLD_CHUNK_WIDTH - 1)
+		world_mark_chunk_dirty((world_chunk_pos){ chunk_pos.x, chunk_pos.z + 1 });
+
+	return true;
+}
+
+// neighbour blocks can only be read once no worker is writing them
+static const chunk* world_neighbour_for_meshing(world_chunk_pos pos) {
+	chunk_dict_entry* entry = chunk_dict_lookup(&WORLD.chunk_dict, pos);
+
+	if (entry == NULL || !chunk_is_drawable(entry->value))
 		return NULL;
 
-	return &chunk->blocks[bx][by][bz];
+	return entry->value;
+}
+
+/* Send a chunk's mesh to the face arena. Without a GL context
+ * the chunk is only marked uploaded, so it can still be edited
+ * and remeshed.
+ */
+static void world_upload_mesh(chunk* c) {
+	if (WORLD.headless)
+		chunk_set_state(c, CHUNK_STATE_UPLOADED);
+	else
+		chunk_upload_mesh(c);
+}
+
+/* Rebuild an uploaded chunk's mesh at its level of detail and
+ * upload it. On failure the old mesh stays.
+ */
+static bool world_remesh_chunk(chunk* c) {
+	const world_chunk_pos pos = c->position;
+
+	const chunk_neighbours neighbours = {
+		.sides = {
+			[FACE_DIR_FRONT] = world_neighbour_for_meshing((world_chunk_pos){ pos.x, pos.z + 1 }),
+			[FACE_DIR_BACK]  = world_neighbour_for_meshing((world_chunk_pos){ pos.x, pos.z - 1 }),
+			[FACE_DIR_LEFT]  = world_neighbour_for_meshing((world_chunk_pos){ pos.x + 1, pos.z }),
+			[FACE_DIR_RIGHT] = world_neighbour_for_meshing((world_chunk_pos){ pos.x - 1, pos.z }),
+		},
+	};
+
+	if (!chunk_build_mesh(&WORLD.chunk_opts, c, &neighbours))
+		return false;
+
+	world_upload_mesh(c);
+
+	// the face count and mesh bounds changed
+	CULL_TREE_DIRTY = true;
+
+	return true;
+}
+
+unsigned int world_remesh_dirty_chunks(void) {
+	TRACE_ZONE("world_remesh_dirty_chunks");
+
+	unsigned int remeshed = 0;
+	size_t kept = 0;
+
+	for (size_t i = 0; i < DIRTY_CHUNKS.count; i++) {
+		const world_chunk_pos pos = DIRTY_CHUNKS.positions[i];
+		chunk_dict_entry* entry = chunk_dict_lookup(&WORLD.chunk_dict, pos);
+
+		// unloaded since it was edited
+		if (entry == NULL || !entry->value->dirty)
+			continue;
+
+		chunk* c = entry->value;
+
+		// still with a worker, try again next frame
+		if (chunk_get_state(c) != CHUNK_STATE_UPLOADED) {
+			DIRTY_CHUNKS.positions[kept++] = pos;
+			continue;
+		}
+
+		// out of memory, try again next frame
+		if (!world_remesh_chunk(c)) {
+			DIRTY_CHUNKS.positions[kept++] = pos;
+			continue;
+		}
+
+		c->dirty = false;
+		remeshed++;
+	}
+
+	DIRTY_CHUNKS.count = kept;
+
+	return remeshed;
 }
 
 /* checks world dictionary for a chunk in pos.
  * returns NULL if no chunk exists in dictionary
  */
-inline chunk* world_chunk_lookup(world_chunk_pos pos) {
+chunk* world_chunk_lookup(world_chunk_pos pos) {
 
 	chunk_dict_entry* res = chunk_dict_lookup(&WORLD.chunk_dict, pos);
-	if (res)
+
+	// block data is only valid once a worker has generated it
+	if (res && chunk_get_state(res->value) >= CHUNK_STATE_GENERATED)
 		return res->value;
 	else
 		return NULL;
 }
 
-chunk* world_load_chunk(world_chunk_pos pos) {
-	// TODO: if chunk exists, load it from disk
+static void world_push_completed_chunk(chunk* completed) {
+	pthread_mutex_lock(&COMPLETED_CHUNKS.lock);
+
+	if (COMPLETED_CHUNKS.count == COMPLETED_CHUNKS.capacity) {
+		size_t new_capacity = COMPLETED_CHUNKS.capacity ? COMPLETED_CHUNKS.capacity * 2 : 64;
+		chunk** chunks = realloc(COMPLETED_CHUNKS.chunks, sizeof(*chunks) * new_capacity);
+
+		if (chunks == NULL) {
+			// without somewhere to put it the chunk can never be freed
+			fputs("ERROR: Failed to allocate memory for the completed chunk queue\n", stderr);
+			exit(1);
+		}
+
+		COMPLETED_CHUNKS.chunks = chunks;
+		COMPLETED_CHUNKS.capacity = new_capacity;
+	}
 
-	// if chunk does not exist yet, generate a new one
-	if (world_chunk_lookup(pos) != NULL)
+	COMPLETED_CHUNKS.chunks[COMPLETED_CHUNKS.count++] = completed;
+
+	pthread_mutex_unlock(&COMPLETED_CHUNKS.lock);
+}
+
+// runs on a worker thread
+static void world_chunk_job(void* args) {
+	TRACE_ZONE("world_chunk_job");
+
+	chunk* chunk = args;
+
+	// skip the work if the chunk was unloaded while it was queued
+	if (!atomic_load(&chunk->discarded)) {
+		// reading a saved chunk is much cheaper than generating it,
+		// it only needs the heightmap for meshing
+		if (region_load_chunk(chunk)) {
+			chunk_generate_heightmap(&WORLD.chunk_opts, chunk);
+			chunk->from_region = true;
+			chunk_set_state(chunk, CHUNK_STATE_GENERATED);
+		} else if (!chunk_generate_blocks(&WORLD.chunk_opts, chunk)) {
+			// out of memory, world_upload_chunks drops it to be requested again
+			world_push_completed_chunk(chunk);
+			return;
+		}
+	}
+
+	if (!atomic_load(&chunk->discarded))
+		chunk_build_mesh(&WORLD.chunk_opts, chunk, NULL);
+
+	world_push_completed_chunk(chunk);
+}
+
+/* Runs on a worker thread. Meshes a generated chunk at the level
+ * of detail in its pending_mesh, leaving the chunk's own mesh
+ * alone so it can still be drawn.
+ */
+static void world_lod_job(void* args) {
+	TRACE_ZONE("world_lod_job");
+
+	chunk* chunk = args;
+	chunk_mesh* mesh = chunk->pending_mesh;
+
+	// the neighbours may be with workers too, the edited borders are fixed on upload
+	if (atomic_load(&chunk->discarded) || !chunk_mesh_build(&WORLD.chunk_opts, chunk, mesh->lod, NULL, mesh)) {
+		free(mesh);
+		chunk->pending_mesh = NULL;
+	}
+
+	world_push_completed_chunk(chunk);
+}
+
+// level of detail for chunks distance chunks from the center, see SETTINGS.lod_distances
+static unsigned int world_lod_for_distance(int distance) {
+	unsigned int lod = 0;
+
+	for (unsigned int n = 1; n < CHUNK_LOD_COUNT; n++) {
+		const unsigned int ring = SETTINGS.lod_distances[n - 1];
+
+		if (ring != 0 && distance >= (int)ring)
+			lod = n;
+	}
+
+	return lod;
+}
+
+chunk* world_load_chunk(world_chunk_pos pos, unsigned int lod) {
+	TRACE_ZONE("world_load_chunk");
+
+	if (chunk_dict_lookup(&WORLD.chunk_dict, pos) != NULL)
+		return NULL;
+
+	chunk* chunk = chunk_create(pos);
+	if (chunk == NULL)
+		return NULL;
+
+	// a new chunk counts as just viewed so it is not evicted before it is drawn
+	chunk->last_visible_frame = FRAME;
+	chunk->lod = lod < CHUNK_LOD_COUNT ? lod : CHUNK_LOD_COUNT - 1;
+	chunk_dict_insert(&WORLD.chunk_dict, pos, chunk);
+
+	if (!worker_pool_submit(world_chunk_job, chunk)) {
+		chunk_dict_remove(&WORLD.chunk_dict, pos);
+		chunk_free(chunk);
 		return NULL;
+	}
+
+	return chunk;
+}
+
+void world_load_chunks_around(world_chunk_pos center, int radius) {
+	// request chunks in rings around center so the closest are generated first
+	for (int ring = 0; ring < radius; ring++) {
+		for (int i = -ring; i <= ring; i++) {
+			for (int j = -ring; j <= ring; j++) {
+				// only the outline of the ring, the inside was done already
+				if (abs(i) != ring && abs(j) != ring)
+					continue;
+
+				world_load_chunk((world_chunk_pos){
+					.x = center.x + i,
+					.z = center.z + j,
+				}, world_lod_for_distance(ring));
+			}
+		}
+	}
+}
+
+void world_wait_for_chunks_around(world_chunk_pos center, int radius) {
+	world_load_chunks_around(center, radius);
+	worker_pool_wait_idle();
+}
+
+typedef struct {
+	world_chunk_pos pos;
+	unsigned long last_visible_frame;
+	size_t bytes;
+} world_eviction_candidate;
+
+static int world_eviction_compare(const void* a, const void* b) {
+	const unsigned long fa = ((const world_eviction_candidate*)a)->last_visible_frame;
+	const unsigned long fb = ((const world_eviction_candidate*)b)->last_visible_frame;
+
+	return (fa > fb) - (fa < fb);
+}
+
+void world_update_residency(world_chunk_pos center, int radius) {
+	TRACE_ZONE("world_update_residency");
+
+	// world_load_chunks_around keeps chunks closer than radius
+	const int keep = radius - 1;
+	const int unload = keep + (int)SETTINGS.chunk_unload_margin;
+
+	world_eviction_candidate* candidates = NULL;
+	size_t candidate_count = 0, candidate_capacity = 0;
+	size_t total = 0;
+
+	size_t it = 0;
+	chunk_dict_entry* entry;
+
+	while ((entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL) {
+		chunk* chunk = entry->value;
+		const int dx = abs(entry->key.x - center.x);
+		const int dz = abs(entry->key.z - center.z);
+		const int distance = dx > dz ? dx : dz;
+
+		// a worker may still be writing blocks and faces of unfinished chunks
+		const size_t bytes = chunk_is_drawable(chunk) ?
+			chunk_memory_usage(chunk) : sizeof(*chunk);
+
+		if (distance <= keep) {
+			total += bytes;
+			continue;
+		}
+
+		// chunks past the margin always go, the rest are kept while memory allows
+		if (candidate_count == candidate_capacity) {
+			size_t new_capacity = candidate_capacity ? candidate_capacity * 2 : 64;
+			world_eviction_candidate* resized = realloc(candidates, sizeof(*candidates) * new_capacity);
+
+			if (resized == NULL) {
+				fputs("Failed to allocate memory for chunk eviction\n", stderr);
+				break;
+			}
+
+			candidates = resized;
+			candidate_capacity = new_capacity;
+		}
 
-	return chunk_generate_chunk(&WORLD.chunk_opts, &WORLD.chunk_dict, pos);
+		candidates[candidate_count++] = (world_eviction_candidate){
+			.pos = entry->key,
+			.last_visible_frame = distance > unload ? 0 : chunk->last_visible_frame,
+			.bytes = bytes,
+		};
+		total += bytes;
+	}
+
+	// unloading reorders the dictionary, so it is done after iterating
+	if (candidate_count > 0)
+		qsort(candidates, candidate_count, sizeof(*candidates), world_eviction_compare);
+
+	for (size_t i = 0; i < candidate_count; i++) {
+		const world_chunk_pos pos = candidates[i].pos;
+		const int dx = abs(pos.x - center.x);
+		const int dz = abs(pos.z - center.z);
+
+		if ((dx > unload || dz > unload) || total > SETTINGS.chunk_memory_budget) {
+			world_unload_chunk(pos);
+			total -= candidates[i].bytes;
+		}
+	}
+
+	free(candidates);
+
+	static bool warned = false;
+	if (total > SETTINGS.chunk_memory_budget && !warned) {
+		fprintf(stderr, "WARNING: Chunks in render distance use %zu bytes, over the %zu byte budget\n",
+				total, SETTINGS.chunk_memory_budget);
+		warned = true;
+	}
+
+	CHUNK_MEMORY_USAGE = total;
+}
+
+size_t world_chunk_memory_usage(void) {
+	return CHUNK_MEMORY_USAGE;
+}
+
+typedef struct {
+	chunk* chunk;
+	int distance;
+	unsigned char lod;
+} world_lod_change;
+
+static int world_lod_change_compare(const void* a, const void* b) {
+	const int da = ((const world_lod_change*)a)->distance;
+	const int db = ((const world_lod_change*)b)->distance;
+
+	return (da > db) - (da < db);
+}
+
+void world_update_lod(world_chunk_pos center, unsigned int budget) {
+	TRACE_ZONE("world_update_lod");
+
+	world_lod_change* changes = NULL;
+	size_t change_count = 0, change_capacity = 0;
+
+	size_t it = 0;
+	chunk_dict_entry* entry;
+
+	while ((entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL) {
+		chunk* chunk = entry->value;
+
+		// the rest are still with a worker, meshed at the level they were loaded with
+		if (chunk_get_state(chunk) != CHUNK_STATE_UPLOADED)
+			continue;
+
+		const int dx = abs(entry->key.x - center.x);
+		const int dz = abs(entry->key.z - center.z);
+		const int distance = dx > dz ? dx : dz;
+		const unsigned int lod = world_lod_for_distance(distance);
+
+		// a chunk keeps its level until it is a whole chunk past the ring,
+		// so walking back and forth over a chunk border does not remesh the ring
+		if (lod == chunk->lod ||
+				world_lod_for_distance(distance - 1) == chunk->lod ||
+				world_lod_for_distance(distance + 1) == chunk->lod)
+			continue;
+
+		if (change_count == change_capacity) {
+			size_t new_capacity = change_capacity ? change_capacity * 2 : 64;
+			world_lod_change* resized = realloc(changes, sizeof(*changes) * new_capacity);
+
+			if (resized == NULL) {
+				fputs("Failed to allocate memory for level of detail changes\n", stderr);
+				break;
+			}
+
+			changes = resized;
+			change_capacity = new_capacity;
+		}
+
+		changes[change_count++] = (world_lod_change){
+			.chunk = chunk,
+			.distance = distance,
+			.lod = lod,
+		};
+	}
+
+	// closest first, the rest are picked up again next frame
+	if (change_count > budget)
+		qsort(changes, change_count, sizeof(*changes), world_lod_change_compare);
+
+	/* the old mesh is drawn until world_upload_chunks swaps in the
+	 * new one, out of CHUNK_STATE_UPLOADED the blocks are not edited
+	 * under the worker
+	 */
+	for (size_t i = 0; i < change_count && i < budget; i++) {
+		chunk* chunk = changes[i].chunk;
+		chunk_mesh* mesh = calloc(1, sizeof(*mesh));
+
+		if (mesh == NULL) {
+			fputs("Failed to allocate memory for a level of detail mesh\n", stderr);
+			break;
+		}
+
+		mesh->lod = changes[i].lod;
+		chunk->pending_mesh = mesh;
+		chunk->remeshing = true;
+		chunk_set_state(chunk, CHUNK_STATE_GENERATED);
+
+		if (!worker_pool_submit(world_lod_job, chunk)) {
+			chunk_set_state(chunk, CHUNK_STATE_UPLOADED);
+			chunk->remeshing = false;
+			chunk->pending_mesh = NULL;
+			free(mesh);
+			break;
+		}
+	}
+
+	free(changes);
+}
+
+/* Write a chunk to its region file, so coming back to it reads
+ * it instead of generating it again, unless the file already
+ * has these blocks.
+ */
+static void world_save_chunk(const chunk* chunk) {
+	if (chunk->modified || !chunk->from_region)
+		region_save_chunk(chunk);
+}
+
+/* Workers mesh against the neighbours' generated heightmaps,
+ * which are wrong for chunks that were edited. Once a chunk is
+ * up, its borders with any such chunk are meshed again on the
+ * main thread with the real blocks.
+ */
+static void world_remesh_edited_borders(const chunk* uploaded) {
+	const world_chunk_pos pos = uploaded->position;
+	const world_chunk_pos sides[4] = {
+		{ pos.x, pos.z + 1 },
+		{ pos.x, pos.z - 1 },
+		{ pos.x + 1, pos.z },
+		{ pos.x - 1, pos.z },
+	};
+
+	for (unsigned int i = 0; i < 4; i++) {
+		const chunk* neighbour = world_neighbour_for_meshing(sides[i]);
+
+		if (neighbour == NULL)
+			continue;
+
+		// the neighbour's faces against this chunk came from its heightmap
+		if (uploaded->edited)
+			world_mark_chunk_dirty(sides[i]);
+
+		// and this chunk's faces against the neighbour
+		if (neighbour->edited)
+			world_mark_chunk_dirty(pos);
+	}
+}
+
+void world_upload_chunks(unsigned int budget) {
+	TRACE_ZONE("world_upload_chunks");
+
+	unsigned int uploaded = 0;
+
+	pthread_mutex_lock(&COMPLETED_CHUNKS.lock);
+
+	size_t i = 0;
+	for (; i < COMPLETED_CHUNKS.count && uploaded < budget; i++) {
+		chunk* chunk = COMPLETED_CHUNKS.chunks[i];
+
+		if (atomic_load(&chunk->discarded)) {
+			// unloaded while a worker had it, but the blocks may be there already
+			if (chunk_get_state(chunk) != CHUNK_STATE_REQUESTED)
+				world_save_chunk(chunk);
+			chunk_free(chunk);
+			continue;
+		}
+
+		// its blocks could not be generated, the next world_load_chunks_around asks again
+		if (chunk_get_state(chunk) == CHUNK_STATE_REQUESTED) {
+			chunk_dict_remove(&WORLD.chunk_dict, chunk->position);
+			chunk_free(chunk);
+			continue;
+		}
+
+		if (chunk->remeshing) {
+			chunk->remeshing = false;
+
+			// out of memory, the old mesh stays and the change is tried again
+			if (chunk->pending_mesh == NULL) {
+				chunk_set_state(chunk, CHUNK_STATE_UPLOADED);
+				continue;
+			}
+
+			chunk_mesh_apply(chunk, chunk->pending_mesh);
+			free(chunk->pending_mesh);
+			chunk->pending_mesh = NULL;
+		}
+
+		const bool meshed = chunk_get_state(chunk) == CHUNK_STATE_MESHED;
+
+		world_upload_mesh(chunk);
+		uploaded++;
+
+		world_remesh_edited_borders(chunk);
+
+		// it goes up without faces and is meshed again on the main thread
+		if (!meshed) {
+			fprintf(stderr, "WARNING: Chunk (%d, %d) failed to mesh, retrying\n", chunk->position.x, chunk->position.z);
+			world_mark_chunk_dirty(chunk->position);
+		}
+	}
+
+	if (uploaded > 0)
+		CULL_TREE_DIRTY = true;
+
+	// keep whatever did not fit in this frame's budget
+	COMPLETED_CHUNKS.count -= i;
+	memmove(COMPLETED_CHUNKS.chunks, COMPLETED_CHUNKS.chunks + i, sizeof(chunk*) * COMPLETED_CHUNKS.count);
+
+	pthread_mutex_unlock(&COMPLETED_CHUNKS.lock);
 }
 
 void world_unload_chunk(world_chunk_pos pos) {
+	chunk* chunk = chunk_dict_remove(&WORLD.chunk_dict, pos);
+	if (chunk == NULL)
+		return;
+
+	// a worker still owns it, it is saved and freed once it comes back from the queue
+	if (chunk_get_state(chunk) != CHUNK_STATE_UPLOADED) {
+		atomic_store(&chunk->discarded, true);
+
+		// one being meshed at a new level of detail was still drawn
+		if (chunk->remeshing)
+			CULL_TREE_DIRTY = true;
+		return;
+	}
 
-	// TODO save chunk to disk
+	world_save_chunk(chunk);
 
-	chunk_dict_delete(&WORLD.chunk_dict, pos);
+	chunk_free(chunk);
+	CULL_TREE_DIRTY = true;
 }
 
-inline void world_unload_all_chunks(void) {
+void world_unload_all_chunks(void) {
+	// let the workers finish so every chunk is back on the main thread
+	worker_pool_wait_idle();
+
+	pthread_mutex_lock(&COMPLETED_CHUNKS.lock);
+
+	for (size_t i = 0; i < COMPLETED_CHUNKS.count; i++) {
+		chunk* chunk = COMPLETED_CHUNKS.chunks[i];
+
+		// chunks still in the dictionary are saved and freed with it
+		if (atomic_load(&chunk->discarded)) {
+			if (chunk_get_state(chunk) != CHUNK_STATE_REQUESTED)
+				world_save_chunk(chunk);
+			chunk_free(chunk);
+		}
+	}
+	COMPLETED_CHUNKS.count = 0;
+
+	pthread_mutex_unlock(&COMPLETED_CHUNKS.lock);
+
+	// the workers are done, every chunk left is generated unless it ran out of memory
+	size_t it = 0;
+	chunk_dict_entry* entry;
+
+	while ((entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL)
+		if (chunk_get_state(entry->value) != CHUNK_STATE_REQUESTED)
+			world_save_chunk(entry->value);
+
 	chunk_dict_delete_all(&WORLD.chunk_dict);
+
+	chunk_cull_tree_free(&CULL_TREE);
+	CULL_TREE_DIRTY = true;
+
+	free(CAVE_QUEUE.nodes);
+	CAVE_QUEUE.nodes = NULL;
+	CAVE_QUEUE.capacity = 0;
 }
 
 static void render_chunk_border_walls(world_chunk_pos pos) {
@@ -126,43 +892,217 @@ static void render_chunk_border_walls(world_chunk_pos pos) {
 
 }
 
+/* How far from the camera's chunk cave culling reaches. Past the
+ * first level of detail ring chunk meshes are small enough to
+ * draw whole.
+ */
+static int world_cave_radius(void) {
+	int radius = SETTINGS.render_distance;
+
+	for (unsigned int n = 0; n < CHUNK_LOD_COUNT - 1; n++)
+		if (SETTINGS.lod_distances[n] != 0 && (int)SETTINGS.lod_distances[n] < radius)
+			radius = SETTINGS.lod_distances[n];
+
+	return radius;
+}
+
+/* Flood fill from the camera's section through the air of the
+ * sections around it, using each section's visibility graph to
+ * only pass between faces air connects. Every section reached
+ * is set in its chunk's cave_visible for this FRAME.
+ * A fill never steps back against a direction it has already
+ * stepped along, so it only moves away from the camera, and it
+ * does not go into sections outside the frustum.
+ * Chunks that are not uploaded yet count as all air, missing
+ * chunks and world_cave_radius stop the fill.
+ * Returns false if the camera is outside the loaded world, in
+ * which case nothing is culled.
+ */
+static bool world_cave_cull(const Camera3D* camera, const frustum* f) {
+	TRACE_ZONE("world_cave_cull");
+
+	const world_chunk_pos start = {
+		floorf(camera->position.x / WORLD_CHUNK_WIDTH),
+		floorf(camera->position.z / WORLD_CHUNK_WIDTH),
+	};
+	const int camera_y = (int)floorf(camera->position.y) + 1;
+
+	chunk_dict_entry* entry = chunk_dict_lookup(&WORLD.chunk_dict, start);
+	if (entry == NULL || camera_y < 0 || camera_y >= WORLD_CHUNK_HEIGHT)
+		return false;
+
+	// every section is queued at most once
+	const size_t needed = (size_t)WORLD.chunk_dict.count * CHUNK_SECTION_COUNT;
+
+	if (needed > CAVE_QUEUE.capacity) {
+		world_cave_node* nodes = realloc(CAVE_QUEUE.nodes, sizeof(world_cave_node) * needed);
+
+		if (nodes == NULL) {
+			fputs("Failed to allocate memory for cave culling\n", stderr);
+			return false;
+		}
+
+		CAVE_QUEUE.nodes = nodes;
+		CAVE_QUEUE.capacity = needed;
+	}
+
+	const int radius = world_cave_radius();
+	size_t head = 0, count = 0;
+
+	chunk* c = entry->value;
+	c->cave_frame = FRAME;
+	c->cave_visible = 1u << (camera_y / CHUNK_SECTION_HEIGHT);
+
+	CAVE_QUEUE.nodes[count++] = (world_cave_node){
+		.chunk = c,
+		.section = camera_y / CHUNK_SECTION_HEIGHT,
+		.from = WORLD_CAVE_START,
+	};
+
+	while (head < count) {
+		const world_cave_node node = CAVE_QUEUE.nodes[head++];
+		const chunk* current = node.chunk;
+
+		unsigned char sees = 0x3f;
+		if (node.from != WORLD_CAVE_START && chunk_is_drawable(node.chunk))
+			sees = current->section_visibility[node.section][node.from];
+
+		for (unsigned int d = 0; d < 6; d++) {
+			if (!(sees & (1 << d)) || (node.directions & (1 << (d ^ 1))))
+				continue;
+
+			chunk* next = node.chunk;
+			int section = node.section;
+			world_chunk_pos pos = current->position;
+
+			switch (d) {
+				case (FACE_DIR_FRONT): pos.z++; break;
+				case (FACE_DIR_BACK):  pos.z--; break;
+				case (FACE_DIR_LEFT):  pos.x++; break;
+				case (FACE_DIR_RIGHT): pos.x--; break;
+				case (FACE_DIR_TOP):    section++; break;
+				default:                section--;
+			}
+
+			if (section < 0 || section >= CHUNK_SECTION_COUNT)
+				continue;
+
+			if (d != FACE_DIR_TOP && d != FACE_DIR_BOTTOM) {
+				if (abs(pos.x - start.x) > radius || abs(pos.z - start.z) > radius)
+					continue;
+
+				chunk_dict_entry* neighbour = chunk_dict_lookup(&WORLD.chunk_dict, pos);
+				if (neighbour == NULL)
+					continue;
+
+				next = neighbour->value;
+			}
+
+			if (next->cave_frame != FRAME) {
+				next->cave_frame = FRAME;
+				next->cave_visible = 0;
+			}
+
+			if (next->cave_visible & (1u << section))
+				continue;
+
+			// block y spans [y - 1, y] in world space
+			const Vector3 min = { pos.x * WORLD_CHUNK_WIDTH, section * CHUNK_SECTION_HEIGHT - 1, pos.z * WORLD_CHUNK_WIDTH };
+			const Vector3 max = { min.x + WORLD_CHUNK_WIDTH, min.y + CHUNK_SECTION_HEIGHT, min.z + WORLD_CHUNK_WIDTH };
+
+			if (frustum_test_box(f, min, max) == FRUSTUM_OUTSIDE)
+				continue;
+
+			next->cave_visible |= 1u << section;
+
+			CAVE_QUEUE.nodes[count++] = (world_cave_node){
+				.chunk = next,
+				.section = section,
+				.from = d ^ 1,
+				.directions = node.directions | (1 << d),
+			};
+		}
+	}
+
+	return true;
+}
+
 void world_render_chunks(Camera3D* camera, Shader shader) {
+	TRACE_ZONE("world_render_chunks");
+
 	if (camera == NULL) {
 		fprintf(stderr, "%s:%d Cannot render for NULL camera\n", __FILE__, __LINE__);
 		return;
 	}
 
-	for (size_t i = 0; i < CHUNK_DICT_ENTRIES; i++) {
-		chunk_dict_entry* entry = WORLD.chunk_dict.entries[i];
-
-		while (entry != NULL) {
-			// toggle chunk borders
-			if (IsKeyPressed(KEY_F9)) {
-				SETTINGS.show_chunk_borders ^= 0x1;
-			}
+	// toggle chunk borders
+	if (IsKeyPressed(KEY_F9)) {
+		SETTINGS.show_chunk_borders ^= 0x1;
+	}
 
-			if (SETTINGS.show_chunk_borders) {
-				world_chunk_pos pos = entry->key;
+	// toggle cave culling
+	if (IsKeyPressed(KEY_F8)) {
+		SETTINGS.cave_culling ^= 0x1;
+	}
 
-				if (
-						camera->position.x >= pos.x * WORLD_CHUNK_WIDTH &&
-						camera->position.x <  pos.x * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH &&
-						camera->position.z >= pos.z * WORLD_CHUNK_WIDTH &&
-						camera->position.z <  pos.z * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH
-				   )
-					render_chunk_border_walls(pos);
+	if (SETTINGS.show_chunk_borders) {
+		size_t it = 0;
+		chunk_dict_entry* entry;
 
-				// draw chunk borders
-				DrawLine3D(
-						(Vector3){pos.x * WORLD_CHUNK_WIDTH, 0, pos.z * WORLD_CHUNK_WIDTH},
-						(Vector3){pos.x * WORLD_CHUNK_WIDTH,WORLD_CHUNK_HEIGHT, pos.z * WORLD_CHUNK_WIDTH},
-						RED);
+		while ((entry = chunk_dict_next(&WORLD.chunk_dict, &it)) != NULL) {
+			world_chunk_pos pos = entry->key;
 
-			}
+			if (
+					camera->position.x >= pos.x * WORLD_CHUNK_WIDTH &&
+					camera->position.x <  pos.x * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH &&
+					camera->position.z >= pos.z * WORLD_CHUNK_WIDTH &&
+					camera->position.z <  pos.z * WORLD_CHUNK_WIDTH + WORLD_CHUNK_WIDTH
+			   )
+				render_chunk_border_walls(pos);
 
-			// render chunk
-			chunk_render_chunk(entry->key, entry->value, camera, shader);
-			entry = entry->next;
+			// draw chunk borders
+			DrawLine3D(
+					(Vector3){pos.x * WORLD_CHUNK_WIDTH, 0, pos.z * WORLD_CHUNK_WIDTH},
+					(Vector3){pos.x * WORLD_CHUNK_WIDTH,WORLD_CHUNK_HEIGHT, pos.z * WORLD_CHUNK_WIDTH},
+					RED);
 		}
 	}
+
+	if (CULL_TREE_DIRTY) {
+		chunk_cull_tree_build(&CULL_TREE, &WORLD.chunk_dict);
+		CULL_TREE_DIRTY = false;
+	}
+
+	// cull against the matrices BeginMode3D set up, once for the whole frame
+	const frustum f = frustum_from_matrix(MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+	const size_t visible_count = chunk_cull_tree_query(&CULL_TREE, &f);
+
+	FRAME++;
+
+	const bool cave_culled = SETTINGS.cave_culling && world_cave_cull(camera, &f);
+	const int cave_radius = world_cave_radius();
+	const world_chunk_pos camera_chunk = {
+		floorf(camera->position.x / WORLD_CHUNK_WIDTH),
+		floorf(camera->position.z / WORLD_CHUNK_WIDTH),
+	};
+
+	// uniforms shared by every chunk are set once
+	chunk_render_begin(camera, shader);
+
+	for (size_t i = 0; i < visible_count; i++) {
+		chunk* chunk = CULL_TREE.visible[i];
+
+		chunk->last_visible_frame = FRAME;
+
+		// chunks the fill does not reach are drawn whole
+		uint16_t sections = 0xffff;
+		if (cave_culled &&
+				abs(chunk->position.x - camera_chunk.x) <= cave_radius &&
+				abs(chunk->position.z - camera_chunk.z) <= cave_radius)
+			sections = chunk->cave_frame == FRAME ? chunk->cave_visible : 0;
+
+		chunk_render_chunk(chunk->position, chunk, sections);
+	}
+
+	chunk_render_end();
 }
@@ -9,6 +9,8 @@ typedef struct {
 	// resizeable array of pointers to chunks
 	chunk_dictionary chunk_dict;
 	chunk_generation_options chunk_opts;
+	const char* save_directory; // region files are kept here
+	bool headless; // no GL context, meshes are built but never sent to the GPU
 } world_data;
 
 /* Contains data relevent to rendering the world
@@ -18,7 +20,9 @@ extern world_data WORLD;
 /* Initializes WORLD using wd. 
  * If wd is NULL, the default values are used.
  * This must be called before any chunk
- * generation.
+ * generation. It also starts the worker pool
+ * chunks are generated on and opens the save
+ * directory.
  * There is currently no "world_destroy" function.
  */
 void world_init(world_data* wd);
@@ -29,30 +33,128 @@ Vector3 get_block_real_pos(world_chunk_pos chunk_pos, int bx, int by, int bz);
 // CHUNK FUNCTIONS
 
 /* checks world dictionary for a chunk in pos.
- * returns NULL if no chunk exists in dictionary
+ * returns NULL if no chunk exists in dictionary, or if
+ * its block data has not been generated yet
+ * Call from the main thread, or from a worker while the main
+ * thread waits for it (as entities_update does): lookups only
+ * read the dictionary, so they are safe as long as no chunk is
+ * loaded or unloaded meanwhile.
  */
 chunk* world_chunk_lookup(world_chunk_pos position);
 
-/* Will generate a chunk at pos if no chunk exists already
+/* Requests a chunk at pos if no chunk exists already, to be
+ * meshed at level of detail lod (see chunk.lod).
+ * Chunks saved in the world's region files are read from
+ * disk, others are generated.
+ * Loading and meshing happen on the worker pool, the
+ * returned chunk is not usable until it reaches
+ * CHUNK_STATE_GENERATED. Returns NULL if the chunk already
+ * existed or could not be requested.
  */
-chunk* world_load_chunk(world_chunk_pos pos);
+chunk* world_load_chunk(world_chunk_pos pos, unsigned int lod);
 
-/* Unloads a chunk at pos
+/* Requests every chunk within radius (square) of center,
+ * closest chunks first, at the level of detail of the
+ * SETTINGS.lod_distances ring they are in.
+ */
+void world_load_chunks_around(world_chunk_pos center, int radius);
+
+/* Requests every chunk within radius of center and blocks until
+ * the worker pool has generated them. For replays and tools that
+ * need the world to be there before simulating, not for frames.
+ */
+void world_wait_for_chunks_around(world_chunk_pos center, int radius);
+
+/* Unloads chunks that are no longer needed around center:
+ * everything further than render distance plus
+ * SETTINGS.chunk_unload_margin, and while chunks use more than
+ * SETTINGS.chunk_memory_budget, the least recently viewed
+ * chunks outside render distance.
+ * Call once per frame from the main thread.
+ */
+void world_update_residency(world_chunk_pos center, int radius);
+
+/* Bytes used by loaded chunks as of the last world_update_residency
+ */
+size_t world_chunk_memory_usage(void);
+
+/* Sends uploaded chunks whose SETTINGS.lod_distances ring
+ * changed as center moved to the worker pool to be meshed
+ * again, closest first and at most budget of them, the rest wait
+ * for later frames. Their old mesh is drawn until
+ * world_upload_chunks swaps in the new one, and they cannot be
+ * edited meanwhile.
+ * Call once per frame from the main thread.
+ */
+void world_update_lod(world_chunk_pos center, unsigned int budget);
+
+/* Uploads up to budget chunks that workers have finished meshing,
+ * new ones and level of detail changes alike.
+ * Chunks a worker failed to mesh go up without faces and are
+ * retried by world_remesh_dirty_chunks, failed level of detail
+ * changes keep their old mesh.
+ * Call once per frame from the main thread.
+ */
+void world_upload_chunks(unsigned int budget);
+
+/* Unloads a chunk at pos, saving it to its region file so a
+ * later visit reads it instead of generating it again
  */
 void world_unload_chunk(world_chunk_pos pos);
 
-/* Unload every chunk in world
+/* Save and unload every chunk in world.
+ * Waits for the worker pool to finish any queued chunks.
  */
 void world_unload_all_chunks(void);
 
-/* Get a block's handle from a loaded chunk.
+/* Get a block from a loaded chunk, air if the chunk is not loaded.
  * ONLY USE FOR ONE-OFFS.
  * Ths function does a chunk lookup to get one block,
- * if you want to manipulate a lot of block data,
+ * if you want to read a lot of block data,
  * use world_chunk_lookup and keep the chunk* around.
  */
-block* world_get_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz);
+block world_get_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz);
+
+typedef struct {
+	bool hit;
+	world_chunk_pos chunk_pos;      // chunk of the block that was hit
+	int bx, by, bz;                 // the block, relative to its chunk
+	chunk_face_direction face;      // face the ray entered through
+	Vector3 normal;                 // outward normal of that face
+	float distance;                 // along the ray, in units of direction's length
+	block block;
+} world_raycast_result;
+
+/* Find the first solid block along a ray, up to max_distance.
+ * Steps through the block grid one cell at a time
+ * (Amanatides & Woo), so only cells the ray passes through are
+ * looked at and the chunk lookup happens once per chunk crossed.
+ * Chunks that are not loaded are passed through as air.
+ * A ray that starts inside a block hits it at distance 0, with
+ * face set as if it had entered against its direction.
+ * The block in front of the face, where a new block would be
+ * placed, is the hit block plus normal.
+ */
+world_raycast_result world_raycast(Vector3 origin, Vector3 direction, float max_distance);
+
+/* Set a block in a loaded chunk. The chunk, and its neighbour if
+ * the block is on the border, is remeshed by the next
+ * world_remesh_dirty_chunks, however many blocks were set.
+ * Returns false if the chunk is not loaded (or still being
+ * generated), the coordinates are outside the chunk or the
+ * block storage could not grow.
+ */
+bool world_set_block(world_chunk_pos chunk_pos, uint16_t bx, uint16_t by, uint16_t bz, block b);
+
+/* Rebuild the mesh of every chunk changed by world_set_block
+ * since the last call. Chunks that fail to mesh stay dirty and
+ * are tried again on the next call.
+ * Returns how many chunks were remeshed.
+ * Call once per frame from the main thread.
+ */
+unsigned int world_remesh_dirty_chunks(void);
 
-/* Render all chunks in WORLD dictionary
+/* Render the chunks in WORLD dictionary that are inside the
+ * camera's view. Call between BeginMode3D and EndMode3D.
  */
 void world_render_chunks(Camera3D* camera, Shader shader);